@@ -0,0 +1,72 @@
+// -*- C++ -*-
+//
+// Counting replacements of the global operator new and delete, for the
+// allocation counts of MC_BOOSTEDHBB (see AllocCounter.hh). Link this into
+// an executable, as the benchmark does, or build it as a library and
+// preload it:
+//
+//     make liballoccounter.so
+//     LD_PRELOAD=./liballoccounter.so MC_BOOSTEDHBB_ALLOCS=1 rivet ...
+
+#include "AllocCounter.hh"
+
+#include <cstdlib>
+#include <new>
+
+// per thread, so that every thread can attribute its own allocations
+static thread_local uint64_t nallocs = 0;
+
+
+extern "C" uint64_t mcboostedhbb_heap_allocations() {
+    return nallocs;
+}
+
+
+static void* countedAlloc(std::size_t n) {
+    ++nallocs;
+    return std::malloc(n ? n : 1);
+}
+
+
+void* operator new(std::size_t n) {
+    void* p = countedAlloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+
+void* operator new[](std::size_t n) {
+    void* p = countedAlloc(n);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+    return countedAlloc(n);
+}
+
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {
+    return countedAlloc(n);
+}
+
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
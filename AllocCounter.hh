@@ -0,0 +1,28 @@
+// -*- C++ -*-
+#ifndef RIVET_ALLOCCOUNTER_HH
+#define RIVET_ALLOCCOUNTER_HH
+
+#include <stdint.h>
+
+/// Number of heap allocations made by the calling thread so far. Defined
+/// by AllocCounter.cc, which replaces the global operator new. That only
+/// works in the executable or a preloaded library, never in a plugin, so
+/// the plugin refers to it weakly: where nothing provides it the address
+/// is null and nothing is counted.
+extern "C" uint64_t mcboostedhbb_heap_allocations() __attribute__((weak));
+
+namespace Rivet {
+
+    /// whether the process counts heap allocations
+    inline bool allocationsCounted() {
+        return mcboostedhbb_heap_allocations != 0;
+    }
+
+    /// heap allocations of the calling thread so far, 0 if not counted
+    inline uint64_t heapAllocations() {
+        return allocationsCounted() ? mcboostedhbb_heap_allocations() : 0;
+    }
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+// -*- C++ -*-
+#include "CategoryCube.hh"
+
+#include <cctype>
+#include <cmath>
+#include <sstream>
+
+namespace Rivet {
+
+void CategoryCube::addAxis(const string& name, const vector<double>& edges) {
+    if (name.empty() || name.find('_') != string::npos || std::isdigit(name[name.size() - 1]))
+        throw Exception("CategoryCube: bad axis name '" + name + "'");
+    if (edges.empty())
+        throw Exception("CategoryCube: axis " + name + " has no bins");
+    for (size_t i = 1; i < edges.size(); ++i)
+        if (!(edges[i] > edges[i-1]))
+            throw Exception("CategoryCube: the edges of axis " + name + " do not increase");
+
+    Axis axis;
+    axis.name = name;
+    axis.edges = edges;
+    axis.stride = 1;
+    axis.integer = true;
+    for (size_t i = 0; i + 1 < edges.size(); ++i)
+        axis.integer = axis.integer && edges[i] == std::floor(edges[i]) && edges[i+1] == edges[i] + 1;
+
+    // the new axis is the fastest
+    foreach (Axis& a, axes)
+        a.stride *= edges.size();
+    axes.push_back(axis);
+    ncategories *= edges.size();
+
+    return;
+}
+
+
+string CategoryCube::label(size_t category) const {
+    std::ostringstream s;
+    for (size_t i = 0; i < axes.size(); ++i) {
+        if (i) s << "_";
+        s << axes[i].name << categoryBin(category, i);
+    }
+
+    return s.str();
+}
+
+
+string CategoryCube::title(size_t category) const {
+    std::ostringstream s;
+    for (size_t i = 0; i < axes.size(); ++i) {
+        const Axis& a = axes[i];
+        const size_t b = categoryBin(category, i);
+        const bool last = b + 1 == a.edges.size();
+
+        if (i) s << "; ";
+        s << a.name;
+        if (last && b == 0)
+            s << " any";
+        else if (last)
+            s << " >= " << a.edges[b];
+        else if (a.integer)
+            s << " = " << a.edges[b];
+        else if (b == 0)
+            s << " < " << a.edges[1];
+        else
+            s << " in [" << a.edges[b] << ", " << a.edges[b+1] << ")";
+    }
+
+    return s.str();
+}
+
+}
@@ -0,0 +1,80 @@
+// -*- C++ -*-
+#ifndef RIVET_CATEGORYCUBE_HH
+#define RIVET_CATEGORYCUBE_HH
+
+#include "Rivet/Rivet.hh"
+
+namespace Rivet {
+
+    /// Event categories on a grid of axes, e.g. lepton multiplicity x
+    /// number of b-tags x MET bin. Every axis has bins [edges[i],
+    /// edges[i+1]), the first one open downwards and the last one
+    /// upwards, so that every event has a category. Categories are
+    /// numbered from the bins with the last axis fastest, so anything
+    /// kept per category is one table indexed by category.
+    ///
+    /// A category is named by its bins, e.g. "nlep1_nbtag2_met3", and
+    /// titled by their ranges, e.g. "nlep = 1; nbtag >= 2; met in [100,
+    /// 150)", both in axis order. cubeproject relies on that to add up
+    /// the categories of written histograms over any of the axes.
+    class CategoryCube {
+        public:
+            CategoryCube()
+                : ncategories(1) {
+
+                return;
+            }
+
+            /// edges are the lower edges of the bins, increasing. The name
+            /// must not contain '_' or end in a digit.
+            void addAxis(const string& name, const vector<double>& edges);
+
+            size_t numAxes() const { return axes.size(); }
+            size_t numCategories() const { return ncategories; }
+
+            const string& axisName(size_t axis) const { return axes[axis].name; }
+            size_t numBins(size_t axis) const { return axes[axis].edges.size(); }
+
+            /// the bin of x on axis
+            size_t bin(size_t axis, double x) const {
+                const vector<double>& edges = axes[axis].edges;
+                size_t i = 1;
+                while (i < edges.size() && x >= edges[i]) ++i;
+                return i - 1;
+            }
+
+            /// the category with bins[i] on axis i
+            size_t category(const size_t* bins) const {
+                size_t c = 0;
+                for (size_t i = 0; i < axes.size(); ++i)
+                    c = c*axes[i].edges.size() + bins[i];
+                return c;
+            }
+
+            /// the bin of category on axis
+            size_t categoryBin(size_t category, size_t axis) const {
+                return (category/axes[axis].stride) % axes[axis].edges.size();
+            }
+
+            string label(size_t category) const;
+            string title(size_t category) const;
+
+        private:
+            struct Axis {
+                string name;
+                vector<double> edges;
+
+                /// categories per bin of this axis
+                size_t stride;
+
+                /// all bins but the last hold one integer
+                bool integer;
+            };
+
+            vector<Axis> axes;
+            size_t ncategories;
+    };
+
+}
+
+#endif
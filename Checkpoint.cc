@@ -0,0 +1,141 @@
+// -*- C++ -*-
+#include "Checkpoint.hh"
+
+#include <cstdio>
+#include <sstream>
+
+#include <unistd.h>
+
+namespace Rivet {
+
+static const char FILEMAGIC[8] = {'M', 'C', 'B', 'H', 'C', 'K', 'P', '1'};
+
+
+// FNV-1a, 64 bit
+static uint64_t checksum(const vector<char>& bytes) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        h ^= (unsigned char) bytes[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+
+CheckpointWriter::CheckpointWriter(const string& filename)
+    : filename(filename), pending(0), done(false), nwritten(0) {
+
+    thread = std::thread(&CheckpointWriter::run, this);
+
+    return;
+}
+
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cond.notify_all();
+    }
+    thread.join();
+
+    delete pending;
+
+    return;
+}
+
+
+void CheckpointWriter::write(CheckpointData* snapshot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    delete pending;
+    pending = snapshot;
+    cond.notify_all();
+
+    return;
+}
+
+
+unsigned long CheckpointWriter::numWritten() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nwritten;
+}
+
+
+string CheckpointWriter::error() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastError;
+}
+
+
+void CheckpointWriter::run() {
+    std::ostringstream tmpname;
+    tmpname << filename << "." << getpid() << ".tmp";
+
+    for (;;) {
+        CheckpointData* snapshot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return done || pending; });
+            if (done) return;
+
+            snapshot = pending;
+            pending = 0;
+        }
+
+        const uint64_t size = snapshot->bytes.size();
+        const uint64_t sum = checksum(snapshot->bytes);
+
+        bool ok = false;
+        FILE* file = fopen(tmpname.str().c_str(), "wb");
+        if (file) {
+            ok = fwrite(FILEMAGIC, 1, 8, file) == 8
+                && fwrite(&size, sizeof(size), 1, file) == 1
+                && fwrite(&sum, sizeof(sum), 1, file) == 1
+                && fwrite(snapshot->bytes.data(), 1, size, file) == size
+                && fflush(file) == 0
+                && fsync(fileno(file)) == 0;
+            ok = fclose(file) == 0 && ok;
+            ok = ok && rename(tmpname.str().c_str(), filename.c_str()) == 0;
+            if (!ok) remove(tmpname.str().c_str());
+        }
+        delete snapshot;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ok) {
+            ++nwritten;
+            lastError.clear();
+        } else {
+            lastError = "cannot write " + filename;
+        }
+    }
+}
+
+
+bool readCheckpoint(const string& filename, CheckpointData& data) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) return false;
+
+    char magic[8];
+    uint64_t size = 0;
+    uint64_t sum = 0;
+    bool ok = fread(magic, 1, 8, file) == 8
+        && memcmp(magic, FILEMAGIC, 8) == 0
+        && fread(&size, sizeof(size), 1, file) == 1
+        && fread(&sum, sizeof(sum), 1, file) == 1;
+    if (ok) {
+        data = CheckpointData();
+        data.bytes.resize(size);
+        ok = fread(data.bytes.data(), 1, size, file) == size
+            && fgetc(file) == EOF
+            && checksum(data.bytes) == sum;
+    }
+    fclose(file);
+
+    if (!ok)
+        throw Exception("readCheckpoint: " + filename + " is not a complete checkpoint");
+
+    return true;
+}
+
+}
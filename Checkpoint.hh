@@ -0,0 +1,124 @@
+// -*- C++ -*-
+#ifndef RIVET_CHECKPOINT_HH
+#define RIVET_CHECKPOINT_HH
+
+#include "Rivet/Rivet.hh"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+namespace Rivet {
+
+    /// A snapshot of analysis state as raw bytes: plain data appended with
+    /// put(), and read back in the same order with get(). Reading past the
+    /// end throws.
+    class CheckpointData {
+        public:
+            CheckpointData()
+                : pos(0) {
+
+                return;
+            }
+
+            template <class T>
+            void put(const T& x) {
+                putArray(&x, 1);
+            }
+
+            template <class T>
+            void putArray(const T* p, size_t n) {
+                const char* c = reinterpret_cast<const char*>(p);
+                bytes.insert(bytes.end(), c, c + n*sizeof(T));
+            }
+
+            /// the size, then the elements
+            template <class T>
+            void putVector(const vector<T>& xs) {
+                put<uint64_t>(xs.size());
+                putArray(xs.data(), xs.size());
+            }
+
+            template <class T>
+            T get() {
+                T x;
+                getArray(&x, 1);
+                return x;
+            }
+
+            template <class T>
+            void getArray(T* p, size_t n) {
+                if (n > (bytes.size() - pos)/sizeof(T))
+                    throw Exception("CheckpointData: truncated checkpoint");
+                if (n) memcpy(p, &bytes[pos], n*sizeof(T));
+                pos += n*sizeof(T);
+            }
+
+            template <class T>
+            void getVector(vector<T>& xs) {
+                xs.resize(get<uint64_t>());
+                getArray(xs.data(), xs.size());
+            }
+
+            /// all bytes read
+            bool atEnd() const { return pos == bytes.size(); }
+
+            vector<char> bytes;
+
+        private:
+            size_t pos;
+    };
+
+
+    /// Writes checkpoints to a file on a thread of its own, so that the
+    /// event loop only pays for taking the snapshot. Every checkpoint is
+    /// written under a name of its own, synced and renamed over the file,
+    /// which therefore always holds a complete one. A snapshot handed
+    /// over while the thread is still writing replaces any older one
+    /// waiting, as only the latest matters.
+    ///
+    /// Layout:
+    ///   "MCBHCKP1" size checksum bytes[size]
+    /// with the FNV-1a hash of the bytes as checksum.
+    class CheckpointWriter {
+        public:
+            CheckpointWriter(const string& filename);
+
+            /// finishes the checkpoint being written and drops any waiting
+            ~CheckpointWriter();
+
+            /// write snapshot, which the writer takes over
+            void write(CheckpointData* snapshot);
+
+            /// checkpoints written so far
+            unsigned long numWritten() const;
+
+            /// the error of the last checkpoint that could not be written,
+            /// empty if there was none
+            string error() const;
+
+        private:
+            void run();
+
+            string filename;
+
+            CheckpointData* pending;
+            bool done;
+            unsigned long nwritten;
+            string lastError;
+
+            mutable std::mutex mutex;
+            std::condition_variable cond;
+            std::thread thread;
+    };
+
+
+    /// read the checkpoint in filename into data, false if there is no
+    /// such file. Throws if it is not a complete checkpoint.
+    bool readCheckpoint(const string& filename, CheckpointData& data);
+
+}
+
+#endif
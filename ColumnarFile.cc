@@ -0,0 +1,101 @@
+// -*- C++ -*-
+#include "ColumnarFile.hh"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Rivet {
+
+void MappedFile::open(const string& filename, const string& who) {
+    close();
+
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw Exception(who + ": cannot open " + filename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw Exception(who + ": cannot stat " + filename);
+    }
+
+    length = st.st_size;
+    if (!length) {
+        ::close(fd);
+        return;
+    }
+
+    void* p = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        length = 0;
+        throw Exception(who + ": cannot map " + filename);
+    }
+
+    mapped = static_cast<const char*>(p);
+    madvise(p, length, MADV_SEQUENTIAL);
+
+    return;
+}
+
+
+void MappedFile::close() {
+    if (mapped) munmap(const_cast<char*>(mapped), length);
+    mapped = 0;
+    length = 0;
+
+    return;
+}
+
+
+namespace ColumnarFile {
+
+static const char BLOCKTAG[4] = {'B', 'L', 'C', 'K'};
+static const char FOOTERTAG[4] = {'E', 'N', 'D', '_'};
+
+
+void writeBytes(FILE* file, const void* p, size_t n, const char* who) {
+    if (n && fwrite(p, 1, n, file) != n)
+        throw Exception(string(who) + ": write failed");
+
+    return;
+}
+
+
+void writePadding(FILE* file, uint64_t n, const char* who) {
+    const char zeros[8] = {0};
+    writeBytes(file, zeros, padding(n), who);
+
+    return;
+}
+
+
+void writeTag(FILE* file, sections section, const char* who) {
+    const uint32_t pad = 0;
+    writeBytes(file, section == FOOTER ? FOOTERTAG : BLOCKTAG, 4, who);
+    writeBytes(file, &pad, sizeof(pad), who);
+
+    return;
+}
+
+
+sections readTag(const char* data, size_t size, size_t& pos, const char* who) {
+    // 4 byte tag, 4 bytes padding
+    if (size - pos < 8) return END;
+
+    const char* tag = data + pos;
+    pos += 8;
+
+    if (memcmp(tag, FOOTERTAG, sizeof(FOOTERTAG)) == 0) return FOOTER;
+    if (memcmp(tag, BLOCKTAG, sizeof(BLOCKTAG)) == 0) return BLOCK;
+
+    throw Exception(string(who) + ": corrupt block header");
+}
+
+}
+
+}
@@ -0,0 +1,95 @@
+// -*- C++ -*-
+#ifndef RIVET_COLUMNARFILE_HH
+#define RIVET_COLUMNARFILE_HH
+
+#include "Rivet/Rivet.hh"
+
+#include <cstdio>
+#include <stdint.h>
+
+namespace Rivet {
+
+    /// A whole file mapped read-only, to be read through once.
+    class MappedFile {
+        public:
+            MappedFile()
+                : mapped(0), length(0) {
+
+                return;
+            }
+
+            ~MappedFile() {
+                close();
+
+                return;
+            }
+
+            /// map filename. An empty file maps to null. Errors are thrown
+            /// as coming from who.
+            void open(const string& filename, const string& who);
+            void close();
+
+            const char* data() const { return mapped; }
+            size_t size() const { return length; }
+
+        private:
+            MappedFile(const MappedFile&);
+            MappedFile& operator=(const MappedFile&);
+
+            const char* mapped;
+            size_t length;
+    };
+
+
+    /// The block structure the columnar files (skims and cut masks) share:
+    ///
+    ///   magic[8] header, padded to 8 bytes
+    ///   blocks:  "BLCK" pad counts, then every column as one contiguous
+    ///            array in native byte order, widest type first, and
+    ///            zeros up to an 8-byte boundary
+    ///   footer:  "END_" pad run totals
+    ///
+    /// so that every column is aligned where the reader maps it. A file
+    /// without a footer comes from a run that did not finish.
+    namespace ColumnarFile {
+
+        enum sections { BLOCK, FOOTER, END };
+
+        /// n bytes at p, throwing as coming from who if that fails
+        void writeBytes(FILE* file, const void* p, size_t n, const char* who);
+
+        template <class T>
+        void writeColumn(FILE* file, const vector<T>& col, const char* who) {
+            writeBytes(file, col.data(), col.size()*sizeof(T), who);
+        }
+
+        /// zeros to get back to an 8-byte boundary after n bytes
+        inline size_t padding(uint64_t n) {
+            return (8 - n%8)%8;
+        }
+
+        void writePadding(FILE* file, uint64_t n, const char* who);
+
+        /// the tag and padding that start a block or the footer
+        void writeTag(FILE* file, sections section, const char* who);
+
+        /// the section starting at pos, which is advanced past its tag.
+        /// END if no tag fits before size.
+        sections readTag(const char* data, size_t size, size_t& pos, const char* who);
+
+        /// pointer to n objects of type T at pos, advancing pos
+        template <class T>
+        const T* column(const char* data, size_t size, size_t& pos, uint64_t n, const char* who) {
+            if (n > (size - pos)/sizeof(T))
+                throw Exception(string(who) + ": truncated file");
+
+            const T* p = reinterpret_cast<const T*>(data + pos);
+            pos += n*sizeof(T);
+            return p;
+        }
+
+    }
+
+}
+
+#endif
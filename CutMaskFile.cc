@@ -0,0 +1,235 @@
+// -*- C++ -*-
+#include "CutMaskFile.hh"
+
+#include <cstring>
+
+namespace Rivet {
+
+using ColumnarFile::padding;
+
+static const char FILEMAGIC[8] = {'M', 'C', 'B', 'H', 'C', 'U', 'T', '1'};
+static const char WRITER[] = "CutMaskWriter";
+static const char READER[] = "CutMaskReader";
+
+
+static void writeBytes(FILE* file, const void* p, size_t n) {
+    ColumnarFile::writeBytes(file, p, n, WRITER);
+
+    return;
+}
+
+
+template <class T>
+static void writeColumn(FILE* file, const vector<T>& col) {
+    ColumnarFile::writeColumn(file, col, WRITER);
+
+    return;
+}
+
+
+template <class T>
+static const T* column(const char* data, size_t size, size_t& pos, uint64_t n) {
+    return ColumnarFile::column<T>(data, size, pos, n, READER);
+}
+
+
+// bytes of the 32 and 8 bit columns of a block
+static uint64_t narrowColumns(uint64_t nev) {
+    return (sizeof(uint32_t) + 5*sizeof(float) + 5)*nev;
+}
+
+
+CutMaskWriter::CutMaskWriter(const string& filename, const vector<string>& cutNames, size_t blocksize)
+    : blocksize(blocksize), nwritten(0) {
+
+    if (cutNames.size() > 32)
+        throw Exception("CutMaskWriter: more than 32 cuts");
+
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+        throw Exception("CutMaskWriter: cannot open " + filename);
+
+    string names;
+    foreach (const string& name, cutNames) {
+        names += name;
+        names += '\0';
+    }
+
+    const uint64_t header[2] = { cutNames.size(), names.size() };
+    writeBytes(file, FILEMAGIC, sizeof(FILEMAGIC));
+    writeBytes(file, header, sizeof(header));
+    writeBytes(file, names.data(), names.size());
+    ColumnarFile::writePadding(file, names.size(), WRITER);
+
+    return;
+}
+
+
+CutMaskWriter::~CutMaskWriter() {
+    if (!file) return;
+
+    // no footer: readers see a file from an unfinished run
+    flush();
+    fclose(file);
+
+    return;
+}
+
+
+void CutMaskWriter::write(const CutMaskEvent& ev) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    weight.push_back(ev.weight);
+    cutMask.push_back(ev.cutMask);
+    floats[0].push_back(ev.vbosonPt);
+    floats[1].push_back(ev.met);
+    floats[2].push_back(ev.akt10Pt);
+    floats[3].push_back(ev.akt10Pt2);
+    floats[4].push_back(ev.akt10Mass);
+    counts[0].push_back(ev.nleptons);
+    counts[1].push_back(ev.nbhads);
+    counts[2].push_back(ev.nakt10);
+    counts[3].push_back(ev.ntrackJets);
+    counts[4].push_back(ev.nbtags);
+
+    ++nwritten;
+    if (cutMask.size() >= blocksize) flush();
+
+    return;
+}
+
+
+void CutMaskWriter::close(double sumw, double xsec, uint64_t nevents) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+
+    flush();
+
+    ColumnarFile::writeTag(file, ColumnarFile::FOOTER, WRITER);
+    writeBytes(file, &xsec, sizeof(xsec));
+    writeBytes(file, &nevents, sizeof(nevents));
+    writeBytes(file, &sumw, sizeof(sumw));
+
+    fclose(file);
+    file = 0;
+
+    return;
+}
+
+
+void CutMaskWriter::flush() {
+    if (cutMask.empty()) return;
+
+    const uint64_t nev = cutMask.size();
+    ColumnarFile::writeTag(file, ColumnarFile::BLOCK, WRITER);
+    writeBytes(file, &nev, sizeof(nev));
+
+    // widest first, so every column stays aligned in the map
+    writeColumn(file, weight);
+    writeColumn(file, cutMask);
+    for (size_t i = 0; i < 5; ++i) writeColumn(file, floats[i]);
+    for (size_t i = 0; i < 5; ++i) writeColumn(file, counts[i]);
+
+    ColumnarFile::writePadding(file, narrowColumns(nev), WRITER);
+
+    weight.clear();
+    cutMask.clear();
+    for (size_t i = 0; i < 5; ++i) {
+        floats[i].clear();
+        counts[i].clear();
+    }
+
+    return;
+}
+
+
+CutMaskReader::CutMaskReader(const string& filename)
+    : data(0), size(0), pos(0), nev(0), iev(0),
+        footer(false), sumw(0), xsec(0), nevents(0) {
+
+    mapped.open(filename, READER);
+    data = mapped.data();
+    size = mapped.size();
+
+    if (size < sizeof(FILEMAGIC) + 2*sizeof(uint64_t) || memcmp(data, FILEMAGIC, sizeof(FILEMAGIC)) != 0)
+        throw Exception("CutMaskReader: " + filename + " is not a cut mask file");
+    pos = sizeof(FILEMAGIC);
+
+    const uint64_t* header = column<uint64_t>(data, size, pos, 2);
+    const uint64_t ncuts = header[0];
+    const uint64_t namesize = header[1];
+    const char* namedata = column<char>(data, size, pos, namesize);
+    column<char>(data, size, pos, padding(namesize));
+
+    size_t start = 0;
+    for (size_t i = 0; i < namesize; ++i) {
+        if (namedata[i]) continue;
+        names.push_back(string(namedata + start, i - start));
+        start = i + 1;
+    }
+    if (names.size() != ncuts)
+        throw Exception("CutMaskReader: corrupt cut names in " + filename);
+
+    return;
+}
+
+
+int CutMaskReader::cutBit(const string& name) const {
+    for (size_t i = 0; i < names.size(); ++i)
+        if (names[i] == name) return i;
+
+    return -1;
+}
+
+
+bool CutMaskReader::nextBlock() {
+    const ColumnarFile::sections section = ColumnarFile::readTag(data, size, pos, READER);
+    if (section == ColumnarFile::END) return false;
+
+    if (section == ColumnarFile::FOOTER) {
+        if (size - pos < 3*8) return false;
+
+        memcpy(&xsec, data + pos, 8);
+        memcpy(&nevents, data + pos + 8, 8);
+        memcpy(&sumw, data + pos + 16, 8);
+        pos = size;
+        footer = true;
+        return false;
+    }
+
+    nev = *column<uint64_t>(data, size, pos, 1);
+    weight = column<double>(data, size, pos, nev);
+    cutMask = column<uint32_t>(data, size, pos, nev);
+    for (size_t i = 0; i < 5; ++i) floats[i] = column<float>(data, size, pos, nev);
+    for (size_t i = 0; i < 5; ++i) counts[i] = column<uint8_t>(data, size, pos, nev);
+    column<uint8_t>(data, size, pos, padding(narrowColumns(nev)));
+
+    iev = 0;
+
+    return true;
+}
+
+
+bool CutMaskReader::next(CutMaskEvent& ev) {
+    while (iev == nev)
+        if (!nextBlock()) return false;
+
+    ev.weight = weight[iev];
+    ev.cutMask = cutMask[iev];
+    ev.vbosonPt = floats[0][iev];
+    ev.met = floats[1][iev];
+    ev.akt10Pt = floats[2][iev];
+    ev.akt10Pt2 = floats[3][iev];
+    ev.akt10Mass = floats[4][iev];
+    ev.nleptons = counts[0][iev];
+    ev.nbhads = counts[1][iev];
+    ev.nakt10 = counts[2][iev];
+    ev.ntrackJets = counts[3][iev];
+    ev.nbtags = counts[4][iev];
+
+    ++iev;
+
+    return true;
+}
+
+}
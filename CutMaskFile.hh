@@ -0,0 +1,143 @@
+// -*- C++ -*-
+#ifndef RIVET_CUTMASKFILE_HH
+#define RIVET_CUTMASKFILE_HH
+
+#include "Rivet/Rivet.hh"
+
+#include <cstdio>
+#include <mutex>
+#include <stdint.h>
+
+#include "ColumnarFile.hh"
+
+namespace Rivet {
+
+    /// The cut mask of one event, with every cut evaluated whether or not
+    /// an earlier one failed, and the quantities the cuts are made on. All
+    /// momenta in GeV, 0 where there is no such object.
+    struct CutMaskEvent {
+        CutMaskEvent()
+            : weight(0), cutMask(0),
+                vbosonPt(0), met(0), akt10Pt(0), akt10Pt2(0), akt10Mass(0),
+                nleptons(0), nbhads(0), nakt10(0), ntrackJets(0), nbtags(0) {
+
+            return;
+        }
+
+        /// nominal weight
+        double weight;
+
+        /// bit i set if cut i passed
+        uint32_t cutMask;
+
+        float vbosonPt;
+        float met;
+
+        /// leading and second AKT10 calo jet
+        float akt10Pt;
+        float akt10Pt2;
+        float akt10Mass;
+
+        uint8_t nleptons;
+        uint8_t nbhads;
+
+        /// AKT10 calo jets and VR track jets above the thresholds of the
+        /// selection, and the b-tagged track jets
+        uint8_t nakt10;
+        uint8_t ntrackJets;
+        uint8_t nbtags;
+    };
+
+
+    /// Writes CutMaskEvents to a compact columnar binary file, in blocks as
+    /// the skims (see SkimFile.hh). The header names the cuts of the mask
+    /// bits, so readers do not depend on their order in the analysis.
+    ///
+    /// Layout:
+    ///   "MCBHCUT1" ncuts namesize names padding to 8 bytes
+    ///              (the names NUL-terminated, namesize bytes in all)
+    ///   blocks:  "BLCK" pad nev
+    ///            weight[nev] cutmask[nev]
+    ///            vbosonpt[nev] met[nev] akt10pt[nev] akt10pt2[nev]
+    ///            akt10m[nev] (floats)
+    ///            nleptons[nev] nbhads[nev] nakt10[nev] ntrackjets[nev]
+    ///            nbtags[nev]  padding to 8 bytes
+    ///   footer:  "END_" pad xsec nevents sumw
+    ///
+    /// write() may be called from several threads.
+    class CutMaskWriter {
+        public:
+            CutMaskWriter(const string& filename, const vector<string>& cutNames,
+                    size_t blocksize=16384);
+            ~CutMaskWriter();
+
+            void write(const CutMaskEvent& ev);
+
+            /// flush and write the footer, with the totals of the run
+            void close(double sumw, double xsec, uint64_t nevents);
+
+            uint64_t numWritten() const { return nwritten; }
+
+        private:
+            void flush();
+
+            FILE* file;
+            size_t blocksize;
+            uint64_t nwritten;
+            std::mutex mutex;
+
+            vector<double> weight;
+            vector<uint32_t> cutMask;
+            vector<float> floats[5];
+            vector<uint8_t> counts[5];
+    };
+
+
+    /// Reads a cut mask file through a read-only memory map.
+    class CutMaskReader {
+        public:
+            CutMaskReader(const string& filename);
+
+            /// next event, false at the end of the file
+            bool next(CutMaskEvent& ev);
+
+            /// names of the cuts, by bit
+            const vector<string>& cutNames() const { return names; }
+
+            /// bit of the named cut, -1 if there is none
+            int cutBit(const string& name) const;
+
+            /// whether the writer got to write the footer
+            bool hasFooter() const { return footer; }
+
+            /// nominal sum of weights of the run that wrote the file
+            double sumOfWeights() const { return sumw; }
+            double crossSection() const { return xsec; }
+            uint64_t numEvents() const { return nevents; }
+
+        private:
+            bool nextBlock();
+
+            MappedFile mapped;
+            const char* data;
+            size_t size;
+            size_t pos;
+            vector<string> names;
+
+            // current block
+            uint64_t nev;
+            uint64_t iev;
+            const double* weight;
+            const uint32_t* cutMask;
+            const float* floats[5];
+            const uint8_t* counts[5];
+
+            bool footer;
+            double sumw;
+            double xsec;
+            uint64_t nevents;
+    };
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+// -*- C++ -*-
+#include "DeltaRMatcher.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Rivet {
+
+const int DeltaRMatrix::NOMATCH;
+
+
+void DeltaRMatrix::compute(const EtaPhiBuffer& rows, const EtaPhiBuffer& cols) {
+
+    nrows = rows.size();
+    ncols = cols.size();
+    dr.resize(nrows*ncols);
+
+    const double* __restrict__ ceta = cols.eta.data();
+    const double* __restrict__ cphi = cols.phi.data();
+
+    // the inner loop is branch free over contiguous arrays so that it is
+    // vectorised by the compiler.
+    for (size_t iRow = 0; iRow < nrows; ++iRow) {
+        const double reta = rows.eta[iRow];
+        const double rphi = rows.phi[iRow];
+        double* __restrict__ out = dr.data() + iRow*ncols;
+
+        for (size_t iCol = 0; iCol < ncols; ++iCol) {
+            const double deta = reta - ceta[iCol];
+            double dphi = std::fabs(rphi - cphi[iCol]);
+            dphi = std::min(dphi, TWOPI - dphi);
+            out[iCol] = std::sqrt(deta*deta + dphi*dphi);
+        }
+    }
+
+    return;
+}
+
+
+void DeltaRMatrix::match(const vector<size_t>& rows, const vector<size_t>& cols,
+        strategy strat, vector<int>& matches, double maxdr) const {
+
+    matches.assign(rows.size(), NOMATCH);
+    if (rows.empty() || cols.empty()) return;
+
+    switch (strat) {
+        case NEAREST:
+            matchNearest(rows, cols, matches, maxdr);
+            break;
+        case GREEDY:
+            matchGreedy(rows, cols, matches, maxdr);
+            break;
+        case OPTIMAL:
+            matchOptimal(rows, cols, matches, maxdr);
+            break;
+    }
+
+    return;
+}
+
+
+void DeltaRMatrix::matchNearest(const vector<size_t>& rows, const vector<size_t>& cols,
+        vector<int>& matches, double maxdr) const {
+
+    for (size_t iRow = 0; iRow < rows.size(); ++iRow) {
+        double best = 0;
+        foreach (size_t col, cols) {
+            const double d = (*this)(rows[iRow], col);
+            if (d <= maxdr && (matches[iRow] == NOMATCH || d < best)) {
+                best = d;
+                matches[iRow] = col;
+            }
+        }
+    }
+
+    return;
+}
+
+
+void DeltaRMatrix::matchGreedy(const vector<size_t>& rows, const vector<size_t>& cols,
+        vector<int>& matches, double maxdr) const {
+
+    colUsed.assign(cols.size(), false);
+
+    const size_t npairs = std::min(rows.size(), cols.size());
+    for (size_t iPair = 0; iPair < npairs; ++iPair) {
+        double best = 0;
+        int bestRow = NOMATCH, bestCol = NOMATCH;
+
+        for (size_t iRow = 0; iRow < rows.size(); ++iRow) {
+            if (matches[iRow] != NOMATCH) continue;
+
+            for (size_t iCol = 0; iCol < cols.size(); ++iCol) {
+                if (colUsed[iCol]) continue;
+
+                const double d = (*this)(rows[iRow], cols[iCol]);
+                if (d <= maxdr && (bestRow == NOMATCH || d < best)) {
+                    best = d;
+                    bestRow = iRow;
+                    bestCol = iCol;
+                }
+            }
+        }
+
+        // nothing left within maxdr
+        if (bestRow == NOMATCH) break;
+
+        matches[bestRow] = cols[bestCol];
+        colUsed[bestCol] = true;
+    }
+
+    return;
+}
+
+
+void DeltaRMatrix::matchOptimal(const vector<size_t>& rows, const vector<size_t>& cols,
+        vector<int>& matches, double maxdr) const {
+
+    // Hungarian method on the rows x cols sub-matrix. It needs at most as
+    // many rows as columns, so work on the transpose otherwise.
+    const bool transposed = rows.size() > cols.size();
+    const size_t n = transposed ? cols.size() : rows.size();
+    const size_t m = transposed ? rows.size() : cols.size();
+
+    // pairs beyond maxdr get a cost larger than any sum of allowed pairs
+    // and are dropped again afterwards.
+    const double forbidden = 1e6;
+    cost.resize(n*m);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < m; ++j) {
+            const double d = transposed ?
+                (*this)(rows[j], cols[i]) : (*this)(rows[i], cols[j]);
+            cost[i*m + j] = d > maxdr ? forbidden : d;
+        }
+    }
+
+    // potentials and column assignments, 1-indexed with slot 0 as the
+    // virtual starting column.
+    const double inf = std::numeric_limits<double>::infinity();
+    u.assign(n+1, 0);
+    v.assign(m+1, 0);
+    minv.resize(m+1);
+    p.assign(m+1, 0);
+    way.assign(m+1, 0);
+    used.resize(m+1);
+
+    for (size_t i = 1; i <= n; ++i) {
+        p[0] = i;
+        size_t j0 = 0;
+        minv.assign(m+1, inf);
+        used.assign(m+1, false);
+
+        do {
+            used[j0] = true;
+            const size_t i0 = p[j0];
+            double delta = inf;
+            size_t j1 = 0;
+
+            for (size_t j = 1; j <= m; ++j) {
+                if (used[j]) continue;
+
+                const double cur = cost[(i0-1)*m + j-1] - u[i0] - v[j];
+                if (cur < minv[j]) {
+                    minv[j] = cur;
+                    way[j] = j0;
+                }
+                if (minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+
+            for (size_t j = 0; j <= m; ++j) {
+                if (used[j]) {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    minv[j] -= delta;
+                }
+            }
+
+            j0 = j1;
+        } while (p[j0] != 0);
+
+        do {
+            const size_t j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+
+    for (size_t j = 1; j <= m; ++j) {
+        if (!p[j] || cost[(p[j]-1)*m + j-1] >= forbidden) continue;
+
+        if (transposed)
+            matches[j-1] = cols[p[j]-1];
+        else
+            matches[p[j]-1] = cols[j-1];
+    }
+
+    return;
+}
+
+}
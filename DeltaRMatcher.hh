@@ -0,0 +1,97 @@
+// -*- C++ -*-
+#ifndef RIVET_DELTARMATCHER_HH
+#define RIVET_DELTARMATCHER_HH
+
+#include "Rivet/Rivet.hh"
+#include "Rivet/Math/Vector4.hh"
+
+#include <limits>
+
+namespace Rivet {
+
+    /// (eta, phi) of a set of objects stored as structure of arrays, so the
+    /// Delta R kernel can stream through contiguous coordinates.
+    class EtaPhiBuffer {
+        public:
+            void clear() {
+                eta.clear();
+                phi.clear();
+            }
+
+            void push_back(const FourMomentum& p) {
+                eta.push_back(p.eta());
+                phi.push_back(p.phi());
+            }
+
+            size_t size() const { return eta.size(); }
+
+            vector<double> eta;
+            vector<double> phi;
+    };
+
+
+    /// Full Delta R matrix between two sets of objects, plus the
+    /// assignment of rows to columns.
+    ///
+    /// Rows and columns are usually b hadrons (or the large-R jet) and
+    /// track jets. The matrix is computed once per event and shared by
+    /// everything that needs distances between the two sets.
+    class DeltaRMatrix {
+        public:
+            enum strategy {
+                NEAREST,    // every row takes its nearest column, columns may be shared
+                GREEDY,     // repeatedly pair the closest free row and column
+                OPTIMAL     // minimise the summed Delta R over a one-to-one assignment
+            };
+
+            /// sentinel for rows that were not matched
+            static const int NOMATCH = -1;
+
+            DeltaRMatrix()
+                : nrows(0), ncols(0) {
+
+                return;
+            }
+
+            /// compute all row-column distances.
+            void compute(const EtaPhiBuffer& rows, const EtaPhiBuffer& cols);
+
+            size_t numRows() const { return nrows; }
+            size_t numCols() const { return ncols; }
+
+            double operator()(size_t row, size_t col) const {
+                return dr[row*ncols + col];
+            }
+
+            /// match the given rows to the given columns.
+            ///
+            /// matches[k] is set to the column matched to rows[k] or NOMATCH.
+            /// Pairs further apart than maxdr are never matched.
+            void match(const vector<size_t>& rows, const vector<size_t>& cols,
+                    strategy strat, vector<int>& matches,
+                    double maxdr = std::numeric_limits<double>::max()) const;
+
+        private:
+            void matchNearest(const vector<size_t>& rows, const vector<size_t>& cols,
+                    vector<int>& matches, double maxdr) const;
+            void matchGreedy(const vector<size_t>& rows, const vector<size_t>& cols,
+                    vector<int>& matches, double maxdr) const;
+            void matchOptimal(const vector<size_t>& rows, const vector<size_t>& cols,
+                    vector<int>& matches, double maxdr) const;
+
+            size_t nrows;
+            size_t ncols;
+
+            // row-major, nrows x ncols
+            vector<double> dr;
+
+            // scratch space of the matching, kept from call to call
+            mutable vector<bool> colUsed;
+            mutable vector<double> cost, u, v, minv;
+            mutable vector<size_t> p, way;
+            mutable vector<bool> used;
+    };
+
+}
+
+#endif
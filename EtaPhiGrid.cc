@@ -0,0 +1,110 @@
+// -*- C++ -*-
+#include "EtaPhiGrid.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Rivet {
+
+EtaPhiGrid::EtaPhiGrid(double cellsize, double etamax)
+    : cellsize(cellsize), etamax(etamax) {
+
+    neta = std::max<size_t>(1, std::ceil(2*etamax/cellsize));
+    nphi = std::max<size_t>(1, std::floor(2*M_PI/cellsize));
+    phicell = 2*M_PI/nphi;
+    cellStart.assign(neta*nphi + 1, 0);
+
+    return;
+}
+
+
+double EtaPhiGrid::wrapPhi(double phi) {
+    return phi - 2*M_PI*std::floor(phi/(2*M_PI));
+}
+
+
+size_t EtaPhiGrid::etaBin(double eta) const {
+    const double bin = std::floor((eta + etamax)/cellsize);
+    if (bin < 0) return 0;
+    return std::min<size_t>(bin, neta - 1);
+}
+
+
+void EtaPhiGrid::sort() {
+    const size_t ncells = cellStart.size() - 1;
+    const size_t n = objs.size();
+
+    std::fill(cellStart.begin(), cellStart.end(), 0);
+    objCell.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const size_t iphi = std::min<size_t>(objs.phi[i]/phicell, nphi - 1);
+        objCell[i] = etaBin(objs.eta[i])*nphi + iphi;
+        ++cellStart[objCell[i] + 1];
+    }
+
+    for (size_t c = 0; c < ncells; ++c)
+        cellStart[c+1] += cellStart[c];
+
+    // place the objects, moving every cellStart to the end of its cell,
+    // then shift them back
+    cellObjs.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        cellObjs[cellStart[objCell[i]]++] = i;
+    for (size_t c = ncells; c > 0; --c)
+        cellStart[c] = cellStart[c-1];
+    cellStart[0] = 0;
+
+    return;
+}
+
+
+template <class F>
+void EtaPhiGrid::visit(double eta, double phi, double dr, F f) const {
+    phi = wrapPhi(phi);
+
+    const size_t eta0 = etaBin(eta - dr);
+    const size_t eta1 = etaBin(eta + dr);
+
+    // phi bins, possibly outside [0, nphi), wrapped below
+    long phi0 = std::floor((phi - dr)/phicell);
+    long phi1 = std::floor((phi + dr)/phicell);
+    if (phi1 - phi0 + 1 >= (long) nphi) {
+        phi0 = 0;
+        phi1 = nphi - 1;
+    }
+
+    const double dr2 = dr*dr;
+    for (size_t ieta = eta0; ieta <= eta1; ++ieta) {
+        for (long ip = phi0; ip <= phi1; ++ip) {
+            const size_t c = ieta*nphi + ((ip % (long) nphi) + nphi) % nphi;
+            for (unsigned int k = cellStart[c]; k < cellStart[c+1]; ++k) {
+                const unsigned int i = cellObjs[k];
+                const double deta = objs.eta[i] - eta;
+                double dphi = std::fabs(objs.phi[i] - phi);
+                if (dphi > M_PI) dphi = 2*M_PI - dphi;
+                if (deta*deta + dphi*dphi < dr2) f(i);
+            }
+        }
+    }
+
+    return;
+}
+
+
+void EtaPhiGrid::within(double eta, double phi, double dr, vector<size_t>& out) const {
+    const size_t first = out.size();
+    visit(eta, phi, dr, [&out](size_t i) { out.push_back(i); });
+    std::sort(out.begin() + first, out.end());
+
+    return;
+}
+
+
+size_t EtaPhiGrid::countWithin(double eta, double phi, double dr) const {
+    size_t n = 0;
+    visit(eta, phi, dr, [&n](size_t) { ++n; });
+
+    return n;
+}
+
+}
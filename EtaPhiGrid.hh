@@ -0,0 +1,71 @@
+// -*- C++ -*-
+#ifndef RIVET_ETAPHIGRID_HH
+#define RIVET_ETAPHIGRID_HH
+
+#include "DeltaRMatcher.hh"
+
+namespace Rivet {
+
+    /// Objects binned in an (eta, phi) grid, to find everything within some
+    /// Delta R of a point without looking at every object.
+    ///
+    /// The cells are at least cellsize wide, so a query with a radius up to
+    /// cellsize looks at no more than 3x3 cells however many objects there
+    /// are. phi wraps around; objects beyond |eta| = etamax go into the
+    /// outermost cells. fill() is a counting sort, linear in the number of
+    /// objects.
+    class EtaPhiGrid {
+        public:
+            EtaPhiGrid(double cellsize=0.6, double etamax=5.0);
+
+            /// bin the objects in ps (anything with eta() and phi()),
+            /// replacing the previous contents
+            template <class T>
+            void fill(const vector<T>& ps) {
+                objs.clear();
+                foreach (const T& p, ps) {
+                    objs.eta.push_back(p.eta());
+                    objs.phi.push_back(wrapPhi(p.phi()));
+                }
+                sort();
+            }
+
+            size_t size() const { return objs.size(); }
+
+            /// append the positions of the objects closer than dr to
+            /// (eta, phi) to out, in increasing order
+            void within(double eta, double phi, double dr, vector<size_t>& out) const;
+
+            /// number of objects closer than dr to (eta, phi)
+            size_t countWithin(double eta, double phi, double dr) const;
+
+        private:
+            static double wrapPhi(double phi);
+
+            size_t etaBin(double eta) const;
+
+            /// bin the objects into the cells
+            void sort();
+
+            /// call f(i) for every object i closer than dr to (eta, phi)
+            template <class F>
+            void visit(double eta, double phi, double dr, F f) const;
+
+            double cellsize;
+            double etamax;
+            size_t neta;
+            size_t nphi;
+            double phicell;
+
+            EtaPhiBuffer objs;
+
+            /// objects of cell c are cellObjs[cellStart[c]] to
+            /// cellObjs[cellStart[c+1]-1]
+            vector<unsigned int> cellStart;
+            vector<unsigned int> cellObjs;
+            vector<unsigned int> objCell;
+    };
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+// -*- C++ -*-
+#include "EventPreFilter.hh"
+#include "ParticlePartitioner.hh"
+
+#include "Rivet/Event.hh"
+
+#include <cmath>
+
+namespace Rivet {
+
+// relative margin of the bounds computed in a different order than the
+// quantities they bound
+static const double MARGIN = 1e-9;
+
+
+EventPreFilter::EventPreFilter(double lepEtaMax, double lepPtMin,
+        double caloEtaMax, double visPtMin,
+        double bhadEtaMax, double bhadPtMin,
+        double metMin, double caloJetPtMin)
+    : lepEtaMax(lepEtaMax), lepPtMin(lepPtMin),
+        caloEtaMax(caloEtaMax), visPtMin(visPtMin),
+        bhadEtaMax(bhadEtaMax), bhadPtMin(bhadPtMin),
+        metMin(metMin), caloJetPtMin(caloJetPtMin) {
+
+    return;
+}
+
+
+unsigned EventPreFilter::check(const GenEvent* ge) const {
+    size_t nleptons = 0;
+    double visx = 0, visy = 0;
+    double caloPt = 0;
+    bool bhadron = false;
+
+    for (GenEvent::particle_const_iterator it = ge->particles_begin(); it != ge->particles_end(); ++it) {
+        const GenParticle* gp = *it;
+        const HepMC::FourVector& p = gp->momentum();
+        const PdgId pid = gp->pdg_id();
+
+        // b hadrons decay, so any status
+        if (gp->status() != 1) {
+            if (!bhadron && PID::isHadron(pid) && PID::hasBottom(pid))
+                bhadron = std::fabs(p.eta()) <= bhadEtaMax && p.perp() >= bhadPtMin;
+            continue;
+        }
+
+        const double pt = p.perp();
+        const double abseta = std::fabs(p.eta());
+
+        if (abseta < caloEtaMax && pt >= visPtMin && !isInvisible(pid)) {
+            visx += p.px();
+            visy += p.py();
+        }
+
+        if (abseta < lepEtaMax && pt >= lepPtMin) {
+            if (PID::isChLepton(pid)) {
+                ++nleptons;
+                continue;
+            }
+            if (PID::isNeutrino(pid)) continue;
+        }
+
+        if (abseta < caloEtaMax) caloPt += pt;
+
+        if (!bhadron && PID::isHadron(pid) && PID::hasBottom(pid))
+            bhadron = abseta <= bhadEtaMax && pt >= bhadPtMin;
+    }
+
+    unsigned failed = 0;
+
+    // the Z/W finders only run for one or two leptons, Z -> nu nu only
+    // for none
+    const double met = std::sqrt(visx*visx + visy*visy);
+    if (nleptons > 2 || (nleptons == 0 && met*(1 + MARGIN) <= metMin))
+        failed |= 1u << VBOSON;
+
+    if (!bhadron)
+        failed |= 1u << BHADRON;
+
+    if (caloPt*(1 + MARGIN) < caloJetPtMin)
+        failed |= 1u << CALOJET;
+
+    return failed;
+}
+
+
+const char* EventPreFilter::boundName(size_t bound) {
+    static const char* const names[BOUNDSLEN] = {
+        "no vector boson",
+        "no b hadron",
+        "no AKT10 jet"
+    };
+
+    return names[bound];
+}
+
+}
@@ -0,0 +1,63 @@
+// -*- C++ -*-
+#ifndef RIVET_EVENTPREFILTER_HH
+#define RIVET_EVENTPREFILTER_HH
+
+#include "Rivet/Rivet.hh"
+
+namespace Rivet {
+
+    /// Necessary conditions for an event to pass the vetoes of
+    /// MC_BOOSTEDHBB, from one walk over the GenEvent and before any
+    /// projection runs. Each condition is a bound on what a stage of the
+    /// selection can find, so an event failing one can never be selected:
+    ///
+    ///   VBOSON    one or two charged leptons as counted by the
+    ///             ParticlePartitioner, or none and a visible momentum
+    ///             imbalance above the loosest missing pT cut
+    ///   BHADRON   a b hadron in the acceptance of HeavyHadrons
+    ///   CALOJET   scalar sum of the pT of the AKT10 inputs above the
+    ///             loosest jet threshold; no jet has more pT than all its
+    ///             constituents together
+    ///
+    /// The lepton count and the imbalance repeat what the partitioner
+    /// computes, in the same order, so they are exact rather than bounds.
+    class EventPreFilter {
+        public:
+            enum bounds {
+                VBOSON,
+                BHADRON,
+                CALOJET,
+                BOUNDSLEN
+            };
+
+            EventPreFilter()
+                : lepEtaMax(0), lepPtMin(0), caloEtaMax(0), visPtMin(0),
+                    bhadEtaMax(0), bhadPtMin(0), metMin(0), caloJetPtMin(0) {
+
+                return;
+            }
+
+            /// the first four as given to the ParticlePartitioner
+            EventPreFilter(double lepEtaMax, double lepPtMin,
+                    double caloEtaMax, double visPtMin,
+                    double bhadEtaMax, double bhadPtMin,
+                    double metMin, double caloJetPtMin);
+
+            /// the bounds the event fails, bit i for bound i. 0 if it
+            /// may pass.
+            unsigned check(const GenEvent* ge) const;
+
+            static const char* boundName(size_t bound);
+
+        private:
+            double lepEtaMax, lepPtMin;
+            double caloEtaMax;
+            double visPtMin;
+            double bhadEtaMax, bhadPtMin;
+            double metMin;
+            double caloJetPtMin;
+    };
+
+}
+
+#endif
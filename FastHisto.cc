@@ -0,0 +1,231 @@
+// -*- C++ -*-
+#include "FastHisto.hh"
+
+namespace Rivet {
+
+UniformAxis::UniformAxis(int nbins, double xmin, double xmax)
+    : nbins(nbins), xmin(xmin), xmax(xmax),
+        scale(nbins/(xmax - xmin)) {
+
+    if (nbins <= 0 || !(xmax > xmin))
+        throw Exception("UniformAxis: needs nbins > 0 and xmax > xmin");
+
+    // as YODA::linspace(), which books the bins of a YODA histogram
+    const double width = (xmax - xmin)/nbins;
+    for (int i = 0; i < nbins; ++i)
+        edges.push_back(xmin + i*width);
+    edges.push_back(xmax);
+
+    return;
+}
+
+
+void FastHisto1D::book(size_t nweights, int nbins, double xmin, double xmax) {
+    axis = UniformAxis(nbins, xmin, xmax);
+    this->nweights = nweights;
+    stride = nbins + 3;
+    dbns.assign(nweights*stride, Dbn());
+
+    return;
+}
+
+
+FastHisto1D::Dbn& FastHisto1D::Dbn::operator+=(const Dbn& other) {
+    numEntries += other.numEntries;
+    sumW += other.sumW;
+    sumW2 += other.sumW2;
+    sumWX += other.sumWX;
+    sumWX2 += other.sumWX2;
+
+    return *this;
+}
+
+
+void FastHisto1D::Dbn::addScaled(const Dbn& other, double k) {
+    numEntries += other.numEntries;
+    sumW += k*other.sumW;
+    sumW2 += k*k*other.sumW2;
+    sumWX += k*other.sumWX;
+    sumWX2 += k*other.sumWX2;
+
+    return;
+}
+
+
+YODA::Dbn1D FastHisto1D::Dbn::yoda() const {
+    return YODA::Dbn1D(numEntries, sumW, sumW2, sumWX, sumWX2);
+}
+
+
+FastHisto1D& FastHisto1D::operator+=(const FastHisto1D& other) {
+    if (other.dbns.size() != dbns.size())
+        throw Exception("FastHisto1D: adding histograms with different binning");
+
+    for (size_t i = 0; i < dbns.size(); ++i)
+        dbns[i] += other.dbns[i];
+
+    return *this;
+}
+
+
+void FastHisto1D::addScaled(const FastHisto1D& other, const vector<double>& factors) {
+    if (other.dbns.size() != dbns.size())
+        throw Exception("FastHisto1D: adding histograms with different binning");
+
+    for (size_t i = 0; i < dbns.size(); ++i)
+        dbns[i].addScaled(other.dbns[i], factors[i/stride]);
+
+    return;
+}
+
+
+void FastHisto1D::reset() {
+    dbns.assign(dbns.size(), Dbn());
+
+    return;
+}
+
+
+void FastHisto1D::save(CheckpointData& data) const {
+    data.putVector(dbns);
+
+    return;
+}
+
+
+void FastHisto1D::restore(CheckpointData& data) {
+    const size_t n = dbns.size();
+    data.getVector(dbns);
+    if (dbns.size() != n)
+        throw Exception("FastHisto1D: restoring histogram with different binning");
+
+    return;
+}
+
+
+void FastHisto1D::flush(size_t iw, YODA::Histo1D& h) const {
+    const Dbn* d = &dbns[iw*stride];
+    const int nbins = axis.numBins();
+
+    h.underflow() += d[0].yoda();
+    for (int i = 0; i < nbins; ++i) {
+        if (!d[i+1].numEntries) continue;
+        h.bin(h.binIndexAt(axis.binMid(i))).dbn() += d[i+1].yoda();
+    }
+    h.overflow() += d[nbins+1].yoda();
+    h.totalDbn() += d[nbins+2].yoda();
+
+    return;
+}
+
+
+void FastHisto2D::book(size_t nweights, int nxbins, double xmin, double xmax,
+        int nybins, double ymin, double ymax) {
+
+    xaxis = UniformAxis(nxbins, xmin, xmax);
+    yaxis = UniformAxis(nybins, ymin, ymax);
+    this->nweights = nweights;
+    stride = nxbins*nybins + 1;
+    dbns.assign(nweights*stride, Dbn());
+
+    return;
+}
+
+
+FastHisto2D::Dbn& FastHisto2D::Dbn::operator+=(const Dbn& other) {
+    numEntries += other.numEntries;
+    sumW += other.sumW;
+    sumW2 += other.sumW2;
+    sumWX += other.sumWX;
+    sumWX2 += other.sumWX2;
+    sumWY += other.sumWY;
+    sumWY2 += other.sumWY2;
+    sumWXY += other.sumWXY;
+
+    return *this;
+}
+
+
+void FastHisto2D::Dbn::addScaled(const Dbn& other, double k) {
+    numEntries += other.numEntries;
+    sumW += k*other.sumW;
+    sumW2 += k*k*other.sumW2;
+    sumWX += k*other.sumWX;
+    sumWX2 += k*other.sumWX2;
+    sumWY += k*other.sumWY;
+    sumWY2 += k*other.sumWY2;
+    sumWXY += k*other.sumWXY;
+
+    return;
+}
+
+
+YODA::Dbn2D FastHisto2D::Dbn::yoda() const {
+    return YODA::Dbn2D(numEntries, sumW, sumW2, sumWX, sumWX2, sumWY, sumWY2, sumWXY);
+}
+
+
+FastHisto2D& FastHisto2D::operator+=(const FastHisto2D& other) {
+    if (other.dbns.size() != dbns.size())
+        throw Exception("FastHisto2D: adding histograms with different binning");
+
+    for (size_t i = 0; i < dbns.size(); ++i)
+        dbns[i] += other.dbns[i];
+
+    return *this;
+}
+
+
+void FastHisto2D::addScaled(const FastHisto2D& other, const vector<double>& factors) {
+    if (other.dbns.size() != dbns.size())
+        throw Exception("FastHisto2D: adding histograms with different binning");
+
+    for (size_t i = 0; i < dbns.size(); ++i)
+        dbns[i].addScaled(other.dbns[i], factors[i/stride]);
+
+    return;
+}
+
+
+void FastHisto2D::reset() {
+    dbns.assign(dbns.size(), Dbn());
+
+    return;
+}
+
+
+void FastHisto2D::save(CheckpointData& data) const {
+    data.putVector(dbns);
+
+    return;
+}
+
+
+void FastHisto2D::restore(CheckpointData& data) {
+    const size_t n = dbns.size();
+    data.getVector(dbns);
+    if (dbns.size() != n)
+        throw Exception("FastHisto2D: restoring histogram with different binning");
+
+    return;
+}
+
+
+void FastHisto2D::flush(size_t iw, YODA::Histo2D& h) const {
+    const Dbn* d = &dbns[iw*stride];
+    const int nx = xaxis.numBins();
+    const int ny = yaxis.numBins();
+
+    for (int iy = 0; iy < ny; ++iy) {
+        for (int ix = 0; ix < nx; ++ix) {
+            const Dbn& b = d[iy*nx + ix];
+            if (!b.numEntries) continue;
+            h.bin(h.binIndexAt(xaxis.binMid(ix), yaxis.binMid(iy))).dbn() += b.yoda();
+        }
+    }
+    h.totalDbn() += d[stride - 1].yoda();
+
+    return;
+}
+
+}
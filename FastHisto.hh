@@ -0,0 +1,248 @@
+// -*- C++ -*-
+#ifndef RIVET_FASTHISTO_HH
+#define RIVET_FASTHISTO_HH
+
+#include "Rivet/Rivet.hh"
+
+#include "Checkpoint.hh"
+
+#include "YODA/Histo1D.h"
+#include "YODA/Histo2D.h"
+
+#include <cmath>
+
+namespace Rivet {
+
+    /// Uniform binning of one axis, with the bin edges YODA computes for
+    /// the same number of bins and range.
+    class UniformAxis {
+        public:
+            UniformAxis()
+                : nbins(0), xmin(0), xmax(0), scale(0) {
+
+                return;
+            }
+
+            UniformAxis(int nbins, double xmin, double xmax);
+
+            int numBins() const { return nbins; }
+
+            double binMid(int i) const { return 0.5*(edges[i] + edges[i+1]); }
+
+            /// bin of x, -1 below the range and nbins above. Bins include
+            /// their lower edge, as in YODA.
+            int index(double x) const {
+                if (x < xmin) return -1;
+                if (x >= xmax) return nbins;
+
+                int i = std::min(int((x - xmin)*scale), nbins - 1);
+                // the product can round x into a neighbour of its bin
+                while (i > 0 && x < edges[i]) --i;
+                while (i < nbins - 1 && x >= edges[i+1]) ++i;
+
+                return i;
+            }
+
+        private:
+            int nbins;
+            double xmin, xmax;
+            double scale;
+            vector<double> edges;
+    };
+
+
+    /// A uniformly binned 1D histogram for the fills of the event loop,
+    /// with one set of bins per event weight.
+    ///
+    /// A fill finds the bin once with index arithmetic and adds to plain
+    /// arrays for all weights. flush() adds one weight to a YODA histogram
+    /// with the same binning. The sums are accumulated exactly as YODA's
+    /// Dbn1D does, so flushing into an empty histogram gives bit for bit
+    /// what filling it directly would have.
+    class FastHisto1D {
+        public:
+            FastHisto1D()
+                : nweights(0), stride(0) {
+
+                return;
+            }
+
+            void book(size_t nweights, int nbins, double xmin, double xmax);
+            bool booked() const { return nweights > 0; }
+
+            /// fill with weights[iw] into the bins of weight iw
+            void fill(double x, const vector<double>& weights) {
+                const size_t b = bin(x);
+                Dbn* d = &dbns[0];
+                for (size_t iw = 0; iw < nweights; ++iw, d += stride) {
+                    d[b].fill(x, weights[iw]);
+                    d[stride - 1].fill(x, weights[iw]);
+                }
+            }
+
+            /// unit weight fill, the same for every weight
+            void fill(double x) {
+                const size_t b = bin(x);
+                Dbn* d = &dbns[0];
+                for (size_t iw = 0; iw < nweights; ++iw, d += stride) {
+                    d[b].fill(x, 1.0);
+                    d[stride - 1].fill(x, 1.0);
+                }
+            }
+
+            /// add the contents of other, which has the same binning
+            FastHisto1D& operator+=(const FastHisto1D& other);
+
+            /// add the contents of weight iw of other scaled by factors[iw],
+            /// as YODA's scaleW() would scale them
+            void addScaled(const FastHisto1D& other, const vector<double>& factors);
+
+            /// empty the bins, keeping the binning
+            void reset();
+
+            /// the raw sums, exactly. restore() needs the histogram booked
+            /// with the same binning and weights.
+            void save(CheckpointData& data) const;
+            void restore(CheckpointData& data);
+
+            /// add the contents of weight iw to h, which has the same binning
+            void flush(size_t iw, YODA::Histo1D& h) const;
+
+        private:
+            /// the sums of YODA::Dbn1D
+            struct Dbn {
+                Dbn()
+                    : numEntries(0), sumW(0), sumW2(0), sumWX(0), sumWX2(0) {
+
+                    return;
+                }
+
+                void fill(double x, double w) {
+                    ++numEntries;
+                    sumW += w;
+                    sumW2 += w*w;
+                    sumWX += w*x;
+                    sumWX2 += w*x*x;
+                }
+
+                Dbn& operator+=(const Dbn& other);
+                void addScaled(const Dbn& other, double k);
+                YODA::Dbn1D yoda() const;
+
+                unsigned long numEntries;
+                double sumW, sumW2, sumWX, sumWX2;
+            };
+
+            /// position in the block of one weight
+            size_t bin(double x) const {
+                if (std::isnan(x)) throw Exception("FastHisto1D: x is NaN");
+                return axis.index(x) + 1;
+            }
+
+            UniformAxis axis;
+            size_t nweights;
+
+            /// one block per weight: the underflow, the bins, the overflow
+            /// and the total
+            size_t stride;
+            vector<Dbn> dbns;
+    };
+
+
+    /// The 2D version of FastHisto1D, with the sums of YODA::Dbn2D. As in
+    /// YODA, fills outside the range only go into the total.
+    class FastHisto2D {
+        public:
+            FastHisto2D()
+                : nweights(0), stride(0) {
+
+                return;
+            }
+
+            void book(size_t nweights, int nxbins, double xmin, double xmax,
+                    int nybins, double ymin, double ymax);
+            bool booked() const { return nweights > 0; }
+
+            void fill(double x, double y, const vector<double>& weights) {
+                const size_t b = bin(x, y);
+                Dbn* d = &dbns[0];
+                for (size_t iw = 0; iw < nweights; ++iw, d += stride) {
+                    d[b].fill(x, y, weights[iw]);
+                    if (b != stride - 1) d[stride - 1].fill(x, y, weights[iw]);
+                }
+            }
+
+            void fill(double x, double y) {
+                const size_t b = bin(x, y);
+                Dbn* d = &dbns[0];
+                for (size_t iw = 0; iw < nweights; ++iw, d += stride) {
+                    d[b].fill(x, y, 1.0);
+                    if (b != stride - 1) d[stride - 1].fill(x, y, 1.0);
+                }
+            }
+
+            FastHisto2D& operator+=(const FastHisto2D& other);
+
+            void addScaled(const FastHisto2D& other, const vector<double>& factors);
+
+            void reset();
+
+            void save(CheckpointData& data) const;
+            void restore(CheckpointData& data);
+
+            void flush(size_t iw, YODA::Histo2D& h) const;
+
+        private:
+            struct Dbn {
+                Dbn()
+                    : numEntries(0), sumW(0), sumW2(0),
+                        sumWX(0), sumWX2(0), sumWY(0), sumWY2(0), sumWXY(0) {
+
+                    return;
+                }
+
+                void fill(double x, double y, double w) {
+                    ++numEntries;
+                    sumW += w;
+                    sumW2 += w*w;
+                    sumWX += w*x;
+                    sumWX2 += w*x*x;
+                    sumWY += w*y;
+                    sumWY2 += w*y*y;
+                    sumWXY += w*x*y;
+                }
+
+                Dbn& operator+=(const Dbn& other);
+                void addScaled(const Dbn& other, double k);
+                YODA::Dbn2D yoda() const;
+
+                unsigned long numEntries;
+                double sumW, sumW2, sumWX, sumWX2, sumWY, sumWY2, sumWXY;
+            };
+
+            /// position in the block of one weight, the total if (x, y) is
+            /// outside the bins
+            size_t bin(double x, double y) const {
+                if (std::isnan(x)) throw Exception("FastHisto2D: x is NaN");
+                if (std::isnan(y)) throw Exception("FastHisto2D: y is NaN");
+
+                const int ix = xaxis.index(x);
+                const int iy = yaxis.index(y);
+                if (ix < 0 || ix == xaxis.numBins() || iy < 0 || iy == yaxis.numBins())
+                    return stride - 1;
+
+                return iy*xaxis.numBins() + ix;
+            }
+
+            UniformAxis xaxis;
+            UniformAxis yaxis;
+            size_t nweights;
+
+            /// one block per weight: the bins, x fastest, and the total
+            size_t stride;
+            vector<Dbn> dbns;
+    };
+
+}
+
+#endif
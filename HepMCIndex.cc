@@ -0,0 +1,202 @@
+// -*- C++ -*-
+#include "HepMCIndex.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <sys/stat.h>
+
+namespace Rivet {
+
+static const char FILEMAGIC[8] = {'M', 'C', 'B', 'H', 'I', 'D', 'X', '1'};
+
+static const char STARTKEY[] = "HepMC::IO_GenEvent-START_EVENT_LISTING";
+static const char ENDKEY[] = "HepMC::IO_GenEvent-END_EVENT_LISTING";
+
+
+// size and modification time of filename
+static void fileStatus(const string& filename, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        throw Exception("HepMCIndex: cannot stat " + filename);
+
+    size = st.st_size;
+    mtime = st.st_mtime;
+
+    return;
+}
+
+
+static bool startsWith(const char* line, size_t length, const char* key, size_t keyLength) {
+    return length >= keyLength && memcmp(line, key, keyLength) == 0;
+}
+
+
+void HepMCIndex::build(const string& hepmcfile) {
+    fileStatus(hepmcfile, fileSize, mtime);
+    offsets.clear();
+
+    MappedFile mapped;
+    mapped.open(hepmcfile, "HepMCIndex");
+    const char* data = mapped.data();
+    const size_t size = mapped.size();
+
+    // without a footer the events run to the end of the file
+    uint64_t end = size;
+    bool started = false;
+    bool ended = false;
+
+    size_t pos = 0;
+    while (pos < size) {
+        const char* line = data + pos;
+        const char* newline = static_cast<const char*>(memchr(line, '\n', size - pos));
+        const size_t length = newline ? newline - line : size - pos;
+
+        if (startsWith(line, length, "E ", 2)) {
+            if (ended) break;
+            offsets.push_back(pos);
+        } else if (startsWith(line, length, STARTKEY, sizeof(STARTKEY) - 1)) {
+            if (started) break;
+            started = true;
+        } else if (!ended && startsWith(line, length, ENDKEY, sizeof(ENDKEY) - 1)) {
+            end = pos;
+            ended = true;
+        }
+
+        pos += length + 1;
+    }
+
+    if (pos < size)
+        throw Exception("HepMCIndex: " + hepmcfile + " holds more than one event listing");
+    if (!started)
+        throw Exception("HepMCIndex: " + hepmcfile + " is not an IO_GenEvent file");
+
+    offsets.push_back(end);
+
+    return;
+}
+
+
+bool HepMCIndex::load(const string& indexfile, const string& hepmcfile) {
+    FILE* file = fopen(indexfile.c_str(), "rb");
+    if (!file) return false;
+
+    uint64_t size = 0, nevents = 0;
+    int64_t time = 0;
+    char magic[8];
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, FILEMAGIC, 8) == 0
+        && fread(&size, sizeof(size), 1, file) == 1
+        && fread(&time, sizeof(time), 1, file) == 1
+        && fread(&nevents, sizeof(nevents), 1, file) == 1;
+
+    uint64_t currentSize;
+    int64_t currentTime;
+    fileStatus(hepmcfile, currentSize, currentTime);
+    ok = ok && size == currentSize && time == currentTime;
+
+    if (ok) {
+        offsets.resize(nevents + 1);
+        ok = fread(&offsets[0], sizeof(uint64_t), nevents + 1, file) == nevents + 1;
+    }
+    fclose(file);
+
+    if (!ok) {
+        offsets.clear();
+        return false;
+    }
+
+    fileSize = size;
+    mtime = time;
+
+    return true;
+}
+
+
+void HepMCIndex::save(const string& indexfile) const {
+    // written under a name of its own and renamed, so that jobs indexing
+    // the same file at once never see half an index
+    std::ostringstream tmpname;
+    tmpname << indexfile << "." << getpid() << ".tmp";
+
+    FILE* file = fopen(tmpname.str().c_str(), "wb");
+    if (!file)
+        throw Exception("HepMCIndex: cannot write " + tmpname.str());
+
+    const uint64_t nevents = numEvents();
+    bool ok = fwrite(FILEMAGIC, 1, 8, file) == 8
+        && fwrite(&fileSize, sizeof(fileSize), 1, file) == 1
+        && fwrite(&mtime, sizeof(mtime), 1, file) == 1
+        && fwrite(&nevents, sizeof(nevents), 1, file) == 1
+        && fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), file) == offsets.size();
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || rename(tmpname.str().c_str(), indexfile.c_str()) != 0) {
+        remove(tmpname.str().c_str());
+        throw Exception("HepMCIndex: cannot write " + indexfile);
+    }
+
+    return;
+}
+
+
+void HepMCIndex::open(const string& hepmcfile) {
+    const string indexfile = hepmcfile + ".idx";
+    if (load(indexfile, hepmcfile)) return;
+
+    build(hepmcfile);
+
+    // the index is only a cache: without it the next run scans again
+    try {
+        save(indexfile);
+    } catch (const Exception&) {
+    }
+
+    return;
+}
+
+
+HepMCRangeStream::HepMCRangeStream(const string& hepmcfile, const HepMCIndex& index,
+        uint64_t first, uint64_t last)
+    : std::istream(0) {
+
+    if (first > last || last > index.numEvents())
+        throw Exception("HepMCRangeStream: bad event range");
+
+    mapped.open(hepmcfile, "HepMCRangeStream");
+    const char* data = mapped.data();
+    const size_t size = mapped.size();
+    if (size != index.size())
+        throw Exception("HepMCRangeStream: the index does not match " + hepmcfile);
+
+    const uint64_t end = index.offset(index.numEvents());
+    buffer.addRegion(data, data + index.offset(0));
+    buffer.addRegion(data + index.offset(first), data + index.offset(last));
+    buffer.addRegion(data + end, data + size);
+    rdbuf(&buffer);
+
+    return;
+}
+
+
+
+void HepMCRangeStream::Buffer::addRegion(const char* begin, const char* end) {
+    if (begin != end) regions.push_back(std::make_pair(begin, end));
+
+    return;
+}
+
+
+HepMCRangeStream::Buffer::int_type HepMCRangeStream::Buffer::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+    if (iregion == regions.size()) return traits_type::eof();
+
+    char* begin = const_cast<char*>(regions[iregion].first);
+    char* end = const_cast<char*>(regions[iregion].second);
+    ++iregion;
+    setg(begin, begin, end);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+}
@@ -0,0 +1,92 @@
+// -*- C++ -*-
+#ifndef RIVET_HEPMCINDEX_HH
+#define RIVET_HEPMCINDEX_HH
+
+#include "Rivet/Rivet.hh"
+
+#include <istream>
+#include <stdint.h>
+
+#include "ColumnarFile.hh"
+
+namespace Rivet {
+
+    /// Byte offsets of the events of an uncompressed HepMC (IO_GenEvent)
+    /// file, from one scan over it, so that any range of events can be
+    /// read without parsing the ones before it.
+    ///
+    /// The index is written next to the file, as file.idx:
+    ///   "MCBHIDX1" filesize mtime nevents offsets[nevents+1]
+    /// where offsets[nevents] is the end of the last event, i.e. the
+    /// start of the footer. An index whose size or modification time does
+    /// not match the file any more is stale.
+    class HepMCIndex {
+        public:
+            HepMCIndex()
+                : fileSize(0), mtime(0) {
+
+                return;
+            }
+
+            /// scan hepmcfile
+            void build(const string& hepmcfile);
+
+            /// read indexfile, false if it is missing or stale for hepmcfile
+            bool load(const string& indexfile, const string& hepmcfile);
+
+            void save(const string& indexfile) const;
+
+            /// the index of hepmcfile from hepmcfile.idx, built and written
+            /// there if that is missing or stale
+            void open(const string& hepmcfile);
+
+            uint64_t numEvents() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+            /// start of event i, or the end of the events for i = numEvents()
+            uint64_t offset(uint64_t i) const { return offsets[i]; }
+
+            uint64_t size() const { return fileSize; }
+
+        private:
+            uint64_t fileSize;
+            int64_t mtime;
+            vector<uint64_t> offsets;
+    };
+
+
+    /// The events [first, last) of an indexed HepMC file as a stream, with
+    /// the header and footer of the file around them: what IO_GenEvent
+    /// reads is a complete file holding only those events. Read through a
+    /// memory map of the file.
+    class HepMCRangeStream : public std::istream {
+        public:
+            HepMCRangeStream(const string& hepmcfile, const HepMCIndex& index,
+                    uint64_t first, uint64_t last);
+
+        private:
+            /// reads a list of regions of the map one after the other
+            class Buffer : public std::streambuf {
+                public:
+                    Buffer()
+                        : iregion(0) {
+
+                        return;
+                    }
+
+                    void addRegion(const char* begin, const char* end);
+
+                protected:
+                    int_type underflow();
+
+                private:
+                    vector<std::pair<const char*, const char*> > regions;
+                    size_t iregion;
+            };
+
+            Buffer buffer;
+            MappedFile mapped;
+    };
+
+}
+
+#endif
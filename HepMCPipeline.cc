@@ -0,0 +1,377 @@
+// -*- C++ -*-
+#include "HepMCPipeline.hh"
+
+#include "HepMC/GenEvent.h"
+#include "HepMC/IO_GenEvent.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace Rivet {
+
+// bytes per chunk passed from the reader to the parser
+static const size_t CHUNKSIZE = 1 << 20;
+
+// chunks queued for the parser
+static const size_t MAXCHUNKS = 16;
+
+
+// seconds on a monotonic clock
+static double wallTime() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+template <class T>
+bool BoundedQueue<T>::push(T item, double& waited) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!closed && items.size() >= capacity) {
+        const double start = wallTime();
+        cond.wait(lock, [this] { return closed || items.size() < capacity; });
+        waited += wallTime() - start;
+    }
+    if (closed) return false;
+
+    items.push_back(item);
+    cond.notify_all();
+
+    return true;
+}
+
+
+template <class T>
+bool BoundedQueue<T>::pop(T& item, double& waited) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!closed && items.empty()) {
+        const double start = wallTime();
+        cond.wait(lock, [this] { return closed || !items.empty(); });
+        waited += wallTime() - start;
+    }
+    if (items.empty()) return false;
+
+    item = items.front();
+    items.pop_front();
+    cond.notify_all();
+
+    return true;
+}
+
+
+template <class T>
+void BoundedQueue<T>::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    cond.notify_all();
+
+    return;
+}
+
+
+template class BoundedQueue<vector<char>*>;
+template class BoundedQueue<GenEvent*>;
+
+
+/// Reads the chunks of the queue one after the other, for the parser.
+class HepMCPipeline::ChunkBuffer : public std::streambuf {
+    public:
+        ChunkBuffer(BoundedQueue<vector<char>*>& chunks)
+            : chunks(chunks), chunk(0), starved(0), ended(false) {
+
+            return;
+        }
+
+        ~ChunkBuffer() {
+            delete chunk;
+
+            return;
+        }
+
+        /// all chunks read
+        bool atEnd() const { return ended; }
+
+        BoundedQueue<vector<char>*>& chunks;
+        vector<char>* chunk;
+
+        /// seconds waited for the reader
+        double starved;
+
+    protected:
+        int_type underflow() {
+            if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+            delete chunk;
+            chunk = 0;
+            if (!chunks.pop(chunk, starved)) {
+                ended = true;
+                return traits_type::eof();
+            }
+
+            setg(&(*chunk)[0], &(*chunk)[0], &(*chunk)[0] + chunk->size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        bool ended;
+};
+
+
+HepMCPipeline::HepMCPipeline(const string& filename, size_t queueSize)
+    : fd(0), ownFd(false),
+        chunks(MAXCHUNKS), events(queueSize),
+        nread(0), ninflated(0), nevents(0) {
+
+    if (filename != "-") {
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw Exception("HepMCPipeline: cannot open " + filename);
+        ownFd = true;
+    }
+
+    reader = std::thread(&HepMCPipeline::readInput, this);
+    parser = std::thread(&HepMCPipeline::parseEvents, this);
+
+    return;
+}
+
+
+HepMCPipeline::~HepMCPipeline() {
+    chunks.close();
+    events.close();
+    reader.join();
+    parser.join();
+
+    GenEvent* ge;
+    double waited = 0;
+    while (events.pop(ge, waited))
+        delete ge;
+    vector<char>* chunk;
+    while (chunks.pop(chunk, waited))
+        delete chunk;
+
+    if (ownFd) close(fd);
+
+    return;
+}
+
+
+GenEvent* HepMCPipeline::next() {
+    GenEvent* ge = 0;
+    double waited = 0;
+    const bool popped = events.pop(ge, waited);
+
+    Times t;
+    t.consumerStarved = waited;
+    account(t);
+
+    if (popped) {
+        ++nevents;
+        return ge;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error.empty()) throw Exception(error);
+
+    return 0;
+}
+
+
+HepMCPipeline::Times HepMCPipeline::times() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return elapsed;
+}
+
+
+uint64_t HepMCPipeline::bytesRead() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nread;
+}
+
+
+uint64_t HepMCPipeline::bytesInflated() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return ninflated;
+}
+
+
+void HepMCPipeline::fail(const string& what) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error.empty()) error = what;
+    }
+
+    chunks.close();
+    events.close();
+
+    return;
+}
+
+
+void HepMCPipeline::account(const Times& t, uint64_t read, uint64_t inflated) {
+    std::lock_guard<std::mutex> lock(mutex);
+    elapsed.read += t.read;
+    elapsed.inflate += t.inflate;
+    elapsed.readerBlocked += t.readerBlocked;
+    elapsed.parse += t.parse;
+    elapsed.parserStarved += t.parserStarved;
+    elapsed.parserBlocked += t.parserBlocked;
+    elapsed.consumerStarved += t.consumerStarved;
+    nread += read;
+    ninflated += inflated;
+
+    return;
+}
+
+
+void HepMCPipeline::readInput() {
+    vector<char> in(CHUNKSIZE);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    bool compressed = false;
+    bool first = true;
+
+    // inside a gzip member, which the input must not end in
+    bool midStream = false;
+
+    for (;;) {
+        Times t;
+
+        // the first read needs the two bytes of the gzip magic, which a
+        // pipe may hand out one at a time
+        double start = wallTime();
+        ssize_t n = 0;
+        while (n >= 0) {
+            const ssize_t m = read(fd, &in[n], in.size() - n);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) {
+                if (m < 0) n = -1;
+                break;
+            }
+            n += m;
+            if (!first || n >= 2) break;
+        }
+        t.read = wallTime() - start;
+        if (n < 0) {
+            fail(string("HepMCPipeline: read failed: ") + strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            if (midStream) fail("HepMCPipeline: the gzip input is truncated");
+            break;
+        }
+
+        // 15 + 32: inflate gzip or zlib streams
+        if (first) {
+            first = false;
+            compressed = n >= 2 && (unsigned char) in[0] == 0x1f && (unsigned char) in[1] == 0x8b;
+            if (compressed && inflateInit2(&zs, 15 + 32) != Z_OK) {
+                fail("HepMCPipeline: cannot initialise zlib");
+                break;
+            }
+        }
+
+        if (!compressed) {
+            vector<char>* chunk = new vector<char>(in.begin(), in.begin() + n);
+            const bool pushed = chunks.push(chunk, t.readerBlocked);
+            account(t, n, n);
+            if (!pushed) {
+                delete chunk;
+                break;
+            }
+            continue;
+        }
+
+        // inflate until all of the input is used and the output buffer
+        // is no longer filled up, i.e. zlib holds nothing back
+        zs.next_in = reinterpret_cast<Bytef*>(&in[0]);
+        zs.avail_in = n;
+        bool ok = true;
+        uint64_t inflated = 0;
+        do {
+            start = wallTime();
+            vector<char>* chunk = new vector<char>(CHUNKSIZE);
+            zs.next_out = reinterpret_cast<Bytef*>(&(*chunk)[0]);
+            zs.avail_out = chunk->size();
+
+            const int ret = inflate(&zs, Z_NO_FLUSH);
+            chunk->resize(chunk->size() - zs.avail_out);
+            inflated += chunk->size();
+
+            // concatenated gzip files are one stream
+            midStream = ret != Z_STREAM_END;
+            if (ret == Z_STREAM_END) {
+                inflateReset(&zs);
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                fail(string("HepMCPipeline: corrupt gzip input: ") + (zs.msg ? zs.msg : "inflate failed"));
+                ok = false;
+            }
+            t.inflate += wallTime() - start;
+
+            if (ok && !chunk->empty()) {
+                if (chunks.push(chunk, t.readerBlocked))
+                    chunk = 0;
+                else
+                    ok = false;
+            }
+            delete chunk;
+        } while (ok && (zs.avail_in || !zs.avail_out));
+
+        account(t, n, inflated);
+        if (!ok) break;
+    }
+
+    if (compressed) inflateEnd(&zs);
+    chunks.close();
+
+    return;
+}
+
+
+void HepMCPipeline::parseEvents() {
+    ChunkBuffer buffer(chunks);
+    std::istream in(&buffer);
+    HepMC::IO_GenEvent io(in);
+    unsigned long nparsed = 0;
+
+    for (;;) {
+        Times t;
+
+        const double starved = buffer.starved;
+        const double start = wallTime();
+        GenEvent* ge = io.read_next_event();
+        t.parserStarved = buffer.starved - starved;
+        t.parse = wallTime() - start - t.parserStarved;
+
+        if (!ge) {
+            account(t);
+            // the input ended on a complete event, or the reader failed
+            if (!buffer.atEnd()) {
+                std::ostringstream msg;
+                msg << "HepMCPipeline: cannot parse event " << nparsed << " of the input";
+                fail(msg.str());
+            }
+            break;
+        }
+
+        ++nparsed;
+        const bool pushed = events.push(ge, t.parserBlocked);
+        account(t);
+        if (!pushed) {
+            delete ge;
+            break;
+        }
+    }
+
+    events.close();
+
+    return;
+}
+
+}
@@ -0,0 +1,135 @@
+// -*- C++ -*-
+#ifndef RIVET_HEPMCPIPELINE_HH
+#define RIVET_HEPMCPIPELINE_HH
+
+#include "Rivet/Rivet.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+namespace Rivet {
+
+    /// A queue holding at most capacity items between two threads. push()
+    /// blocks while it is full and pop() while it is empty; both add the
+    /// seconds they waited to waited. After close() pop() drains what is
+    /// left and then fails, and push() fails at once, leaving the item to
+    /// the caller.
+    template <class T>
+    class BoundedQueue {
+        public:
+            BoundedQueue(size_t capacity)
+                : capacity(capacity), closed(false) {
+
+                return;
+            }
+
+            /// false if the queue is closed
+            bool push(T item, double& waited);
+
+            /// false once the queue is closed and empty
+            bool pop(T& item, double& waited);
+
+            void close();
+
+        private:
+            size_t capacity;
+            bool closed;
+            std::deque<T> items;
+            std::mutex mutex;
+            std::condition_variable cond;
+    };
+
+
+    /// Reads HepMC (IO_GenEvent) events from a file or a pipe, plain or
+    /// gzip-compressed, ahead of the thread analysing them:
+    ///
+    ///   reader   reads the input and inflates it if it starts with the
+    ///            gzip magic, in chunks into a queue
+    ///   parser   parses the chunks into GenEvents, into a second queue
+    ///
+    /// next() hands out the parsed events in order. Each thread records
+    /// the time it spends working and waiting on its neighbours, which
+    /// shows whether a run is limited by the input or by the analysis.
+    class HepMCPipeline {
+        public:
+            /// filename "-" reads standard input. At most queueSize parsed
+            /// events are held in memory.
+            HepMCPipeline(const string& filename, size_t queueSize=64);
+
+            /// stops the threads, even before the end of the input
+            ~HepMCPipeline();
+
+            /// the next event, owned by the caller, or null at the end of
+            /// the input. Throws if reading or parsing failed.
+            GenEvent* next();
+
+            /// seconds spent by each thread, up to now
+            struct Times {
+                Times()
+                    : read(0), inflate(0), readerBlocked(0),
+                        parse(0), parserStarved(0), parserBlocked(0),
+                        consumerStarved(0) {
+
+                    return;
+                }
+
+                /// reader: in read() on the input, inflating, and waiting
+                /// for the parser to take a chunk
+                double read, inflate, readerBlocked;
+
+                /// parser: parsing, waiting for input and waiting for the
+                /// consumer to take an event
+                double parse, parserStarved, parserBlocked;
+
+                /// the caller of next(), waiting for events
+                double consumerStarved;
+            };
+
+            Times times() const;
+
+            /// events handed out by next()
+            unsigned long numEvents() const { return nevents; }
+
+            /// bytes read from the input, and after inflating them (the
+            /// same for plain input)
+            uint64_t bytesRead() const;
+            uint64_t bytesInflated() const;
+
+        private:
+            class ChunkBuffer;
+
+            void readInput();
+            void parseEvents();
+
+            /// record error, unless there is one already, and stop both
+            /// threads
+            void fail(const string& what);
+
+            /// add to the times and byte counts
+            void account(const Times& t, uint64_t read=0, uint64_t inflated=0);
+
+            int fd;
+            bool ownFd;
+
+            BoundedQueue<vector<char>*> chunks;
+            BoundedQueue<GenEvent*> events;
+
+            std::thread reader;
+            std::thread parser;
+
+            /// guards elapsed, error and the byte counts
+            mutable std::mutex mutex;
+            Times elapsed;
+            string error;
+            uint64_t nread;
+            uint64_t ninflated;
+
+            unsigned long nevents;
+    };
+
+}
+
+#endif
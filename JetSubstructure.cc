@@ -0,0 +1,54 @@
+// -*- C++ -*-
+#include "JetSubstructure.hh"
+
+#include <algorithm>
+
+#include "fastjet/ClusterSequence.hh"
+#include "fastjet/tools/Filter.hh"
+#include "fastjet/tools/MassDropTagger.hh"
+#include "fastjet/contrib/Nsubjettiness.hh"
+
+namespace Rivet {
+
+void JetSubstructure::compute() {
+    if (done) return;
+    done = true;
+
+    tau21Val = filteredMassVal = trimmedMassVal = 0;
+
+    if (!jets) return;
+    const vector<fastjet::PseudoJet> pjs = jets->pseudoJetsByPt();
+    if (pjs.empty()) return;
+    const fastjet::PseudoJet& jet = pjs[0];
+
+    // N-subjettiness
+    const fastjet::contrib::Nsubjettiness tau1(1, fastjet::contrib::OnePass_KT_Axes(), fastjet::contrib::UnnormalizedMeasure(1.0));
+    const fastjet::contrib::Nsubjettiness tau2(2, fastjet::contrib::OnePass_KT_Axes(), fastjet::contrib::UnnormalizedMeasure(1.0));
+    const double t1 = tau1(jet);
+    tau21Val = t1 > 0 ? tau2(jet)/t1 : 0;
+
+    // trimming
+    const fastjet::Filter trimmer(fastjet::JetDefinition(fastjet::kt_algorithm, 0.2),
+            fastjet::SelectorPtFractionMin(0.05));
+    trimmedMassVal = trimmer(jet).m();
+
+    // mass drop and filtering, on the C/A history of the constituents
+    const fastjet::ClusterSequence caSeq(jet.constituents(),
+            fastjet::JetDefinition(fastjet::cambridge_algorithm, 1.5));
+    const vector<fastjet::PseudoJet> caJets = fastjet::sorted_by_pt(caSeq.inclusive_jets());
+    if (caJets.empty()) return;
+
+    const fastjet::MassDropTagger mdt(0.67, 0.09);
+    const fastjet::PseudoJet tagged = mdt(caJets[0]);
+    if (tagged == 0) return;
+
+    const vector<fastjet::PseudoJet> pieces = tagged.pieces();
+    const double rbb = pieces.size() == 2 ? pieces[0].delta_R(pieces[1]) : 0.6;
+    const fastjet::Filter filter(fastjet::JetDefinition(fastjet::cambridge_algorithm, std::min(0.3, rbb/2)),
+            fastjet::SelectorNHardest(3));
+    filteredMassVal = filter(tagged).m();
+
+    return;
+}
+
+}
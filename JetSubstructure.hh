@@ -0,0 +1,65 @@
+// -*- C++ -*-
+#ifndef RIVET_JETSUBSTRUCTURE_HH
+#define RIVET_JETSUBSTRUCTURE_HH
+
+#include "Rivet/Rivet.hh"
+#include "Rivet/Projections/FastJets.hh"
+
+namespace Rivet {
+
+    /// Substructure of the leading jet of a clustering, computed on first
+    /// use and kept until the next event.
+    ///
+    /// The jet is taken from the ClusterSequence of the existing clustering,
+    /// so the event is not clustered again; only the constituents of the
+    /// one jet are reclustered where an algorithm needs it:
+    ///
+    ///   tau21         N-subjettiness tau2/tau1, beta = 1, one-pass kT axes
+    ///   filteredMass  BDRS: C/A with R = 1.5, mass drop (mu = 0.67,
+    ///                 ycut = 0.09), filtered to the 3 hardest C/A subjets
+    ///                 with R = min(0.3, Rbb/2). 0 without a mass drop.
+    ///   trimmedMass   kT subjets with R = 0.2 and at least 5% of the jet pT
+    class JetSubstructure {
+        public:
+            JetSubstructure()
+                : jets(0), done(false), tau21Val(0), filteredMassVal(0), trimmedMassVal(0) {
+
+                return;
+            }
+
+            /// a new event with its leading jet in jets. nothing is
+            /// computed until compute(); jets has to stay clustered until
+            /// then.
+            void setJets(const FastJets& jets) {
+                this->jets = &jets;
+                done = false;
+            }
+
+            /// a new event with known values, e.g. from a skim
+            void setValues(double tau21, double filteredMass, double trimmedMass) {
+                jets = 0;
+                done = true;
+                tau21Val = tau21;
+                filteredMassVal = filteredMass;
+                trimmedMassVal = trimmedMass;
+            }
+
+            bool computed() const { return done; }
+            void compute();
+
+            double tau21() const { return tau21Val; }
+            double filteredMass() const { return filteredMassVal; }
+            double trimmedMass() const { return trimmedMassVal; }
+
+        private:
+            const FastJets* jets;
+            bool done;
+
+            double tau21Val;
+            double filteredMassVal;
+            double trimmedMassVal;
+    };
+
+}
+
+#endif
@@ -1,28 +1,32 @@
 // -*- C++ -*-
 #include "MC_BOOSTEDHBB.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "Rivet/Tools/Logging.hh"
 
 #include "Rivet/Projections/FinalState.hh"
-#include "Rivet/Projections/VisibleFinalState.hh"
-#include "Rivet/Projections/MergedFinalState.hh"
-#include "Rivet/Projections/VetoedFinalState.hh"
-#include "Rivet/Projections/IdentifiedFinalState.hh"
-#include "Rivet/Projections/ChargedLeptons.hh"
 #include "Rivet/Projections/ZFinder.hh"
 #include "Rivet/Projections/WFinder.hh"
-#include "Rivet/Projections/MissingMomentum.hh"
 #include "Rivet/Projections/HeavyHadrons.hh"
 
 #include "Rivet/Jet.hh"
 #include "Rivet/Projections/FastJets.hh"
 
-#include "fastjet/JetDefinition.hh"
-#include "fastjet/contrib/VariableR.hh"
+#include "fastjet/ClusterSequence.hh"
 
 using std::map;
 using std::string;
@@ -35,79 +39,368 @@ const string mlab = "mass / GeV";
 const string drlab = "$\\Delta R";
 const string etalab = "$\\eta";
 const string philab = "$\\phi";
+
+
+// analysis options come from the environment, as rivet has no other way
+// of passing them to a plugin.
+static string envOption(const string& name, const string& def) {
+    const char* val = std::getenv(name.c_str());
+    return val ? string(val) : def;
+}
+
+
+// seconds on a monotonic clock
+static double wallTime() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
 namespace Rivet {
 
+
+// copy of ps without the links to the GenEvent, which is gone by the time
+// a worker thread gets to the particles.
+static void detachParticles(const Particles& ps, Particles& out) {
+    foreach (const Particle& p, ps)
+        out.push_back(Particle(p.pid(), p.momentum()));
+
+    return;
+}
+
+
+const double MC_BOOSTEDHBB::CALOJETR = 1.0;
+const double MC_BOOSTEDHBB::VRRHO = 60*GeV;   // rho < mH
+const double MC_BOOSTEDHBB::VRRMIN = 0.2;
+const double MC_BOOSTEDHBB::VRRMAX = 0.6;
+const double MC_BOOSTEDHBB::SMALLJETPT = 25*GeV;
+
+const char* const MC_BOOSTEDHBB::cutNames[CUTSLEN] = {
+    "NONE", "WLNU", "ZNUNU", "ZLL", "VBOSON", "ONEAKT10JET",
+    "ONEBTAGGEDTRACKJET", "TWOBTAGGEDTRACKJET", "ALLTRACKJETSCONNECTEDTOCALOJET",
+    "ONEBHADRONSFOUND", "TWOBHADRONSFOUND"
+};
+
+
+double MC_BOOSTEDHBB::vrRadius(double pt) {
+    return std::min(VRRMAX, std::max(VRRMIN, VRRHO/pt));
+}
+
+
+/// Adds the allocations of one analyze() call outside the projections,
+/// clusterings and substructure tools to the totals.
+class MC_BOOSTEDHBB::EventAllocations {
+    public:
+        EventAllocations(MC_BOOSTEDHBB& analysis)
+            : analysis(analysis),
+                allocs0(analysis.countAllocs ? heapAllocations() : 0),
+                external0(analysis.countAllocs ? analysis.externalAllocs() : 0) {
+
+            return;
+        }
+
+        ~EventAllocations() {
+            if (!analysis.countAllocs) return;
+
+            const uint64_t own = (heapAllocations() - allocs0) - (analysis.externalAllocs() - external0);
+            // the event timer has already stopped
+            if (analysis.stageTimers->calls[TIME_EVENT] <= 1) {
+                analysis.ownAllocsFirst += own;
+                return;
+            }
+
+            analysis.ownAllocsLater += own;
+            if (own) ++analysis.allocatingEvents;
+            analysis.maxOwnAllocs = std::max(analysis.maxOwnAllocs, own);
+        }
+
+    private:
+        MC_BOOSTEDHBB& analysis;
+        uint64_t allocs0;
+        uint64_t external0;
+};
+
+
 /// @name Analysis methods
 //@{
 
 /// Book histograms and initialise projections before the run
 void MC_BOOSTEDHBB::init() {
-    bookChannel("AllChannels");
-    bookChannel("ZllBoostedHbb");
-    bookChannel("ZllBoostedHb");
+    // look the logger up while there is only one thread
+    getLog();
+
+    allChannels = bookChannel("AllChannels");
+    boostedHbbChannel[ZLLCHAN] = bookChannel("ZllBoostedHbb");
+    boostedHbChannel[ZLLCHAN] = bookChannel("ZllBoostedHb");
+
+    boostedHbbChannel[WLNUCHAN] = bookChannel("WlnuBoostedHbb");
+    boostedHbChannel[WLNUCHAN] = bookChannel("WlnuBoostedHb");
+
+    boostedHbbChannel[ZNUNUCHAN] = bookChannel("ZnunuBoostedHbb");
+    boostedHbChannel[ZNUNUCHAN] = bookChannel("ZnunuBoostedHb");
+
+    // selection working points. the default one comes first and keeps the
+    // plain histogram names.
+    selections.push_back(Selection());
+    addSelections(envOption("MC_BOOSTEDHBB_SELECTIONS", ""));
+
+    // the projections are configured with the loosest cuts of all
+    // selections; each selection applies its own cuts to their results.
+    Selection loosest = selections[0];
+    foreach (const Selection& sel, selections) {
+        loosest.zMassMin = std::min(loosest.zMassMin, sel.zMassMin);
+        loosest.zMassMax = std::max(loosest.zMassMax, sel.zMassMax);
+        loosest.wMassMin = std::min(loosest.wMassMin, sel.wMassMin);
+        loosest.wMassMax = std::max(loosest.wMassMax, sel.wMassMax);
+        loosest.metMin = std::min(loosest.metMin, sel.metMin);
+        loosest.caloJetPtMin = std::min(loosest.caloJetPtMin, sel.caloJetPtMin);
+        loosest.trackJetPtMin = std::min(loosest.trackJetPtMin, sel.trackJetPtMin);
+    }
+    loosestCaloJetPt = loosest.caloJetPtMin;
+    loosestTrackJetPt = loosest.trackJetPtMin;
 
-    bookChannel("WlnuBoostedHbb");
-    bookChannel("WlnuBoostedHb");
+    // leptons, visible momentum and the jet constituents, in one pass
+    // over the final state.
+    // TODO
+    // minimum pt cutoff for the visible momentum?
+    // don't include high-pt neutrinos or leptons in jets
+    // include electrons?
+    const double lepEtaMax = 2.5, lepPtMin = 25*GeV, caloEtaMax = 4.2, visPtMin = 0.5*GeV;
+    const ParticlePartitioner& parts =
+        addProjection(ParticlePartitioner(lepEtaMax, lepPtMin, caloEtaMax, 2.5, 5*GeV, visPtMin), "ParticlePartitioner");
 
-    bookChannel("ZnunuBoostedHbb");
-    bookChannel("ZnunuBoostedHb");
+    FinalState fs;
+    addProjection(ZFinder(fs, etaIn(-2.5, 2.5) & (pT >= 25*GeV), PID::ELECTRON, loosest.zMassMin, loosest.zMassMax), "ZeeFinder");
+    addProjection(ZFinder(fs, etaIn(-2.5, 2.5) & (pT >= 25*GeV), PID::MUON, loosest.zMassMin, loosest.zMassMax), "ZmumuFinder");
+
+    addProjection(WFinder(fs, etaIn(-2.5, 2.5) & (pT > 25*GeV), PID::ELECTRON, loosest.wMassMin, loosest.wMassMax, 25*GeV), "WenuFinder");
+    addProjection(WFinder(fs, etaIn(-2.5, 2.5) & (pT > 25*GeV), PID::MUON, loosest.wMassMin, loosest.wMassMax, 25*GeV), "WmunuFinder");
+
+    // jet collections, clustered from the partitioned inputs on first use:
+    // the AKT10 calo jets, C/A small-R calo jets and variable-R track jets.
+    //R=1 is rather wide so this should include two boosted higgs jets. We will be able to resolve these in the tracker. 
+    MultiRadiusJets jets(parts, CALOJETR, VRRHO, VRRMIN, VRRMAX);
+    std::istringstream radii(envOption("MC_BOOSTEDHBB_SMALLJETR", "0.4,0.3"));
+    string radius;
+    while (std::getline(radii, radius, ','))
+        if (!radius.empty()) jets.addRadius(std::atof(radius.c_str()));
+    addProjection(jets, "MultiRadiusJets");
 
-    ChargedLeptons clfs(FinalState(-2.5, 2.5, 25*GeV));
-    addProjection(clfs, "ChargedLeptons");
+		//This is to look for the b hadrons. We do this to find the exact location of the b-Hadron relative to the centre of the jet.
+		addProjection(HeavyHadrons(-2.5,2.5,0.1*GeV), "HeavyHadrons");
 
-    // TODO
-    // minimum pt cutoff?
-    MissingMomentum mmfs(FinalState(-4.2, 4.2, 0.5*GeV));
-    addProjection(mmfs, "MissingMomentum");
+    // the same cuts, as bounds on what the projections can find
+    preFilter = EventPreFilter(lepEtaMax, lepPtMin, caloEtaMax, visPtMin,
+            2.5, 0.1*GeV, loosest.metMin, loosestCaloJetPt);
+
+    // one histogram set and selection state per selection. the collection
+    // handles are the same for all of them.
+    histos.resize(selections.size());
+    states.resize(selections.size());
+    foreach (EventState& st, states)
+        st.substructure = &akt10Substructure;
+    for (size_t iSel = 0; iSel < selections.size(); ++iSel) {
+        HistoSet& hs = histos[iSel];
+        hs.nchannels = channels.size();
+        hs.analysis = this;
+        if (iSel) hs.prefix = selections[iSel].name + "_";
+
+        // register Z and W bosons
+        vbosonColl = bookFourMom(hs, "vboson");
+
+        // register special collections
+        boostedHbColl = bookFourMomJet(hs, "BoostedHb");
+        boostedHbbColl = bookFourMomJet(hs, "BoostedHbb");
+        vbosonHiggsColl = bookFourMomPair(hs, "vboson_higgs");
+        bhadBTrackJet1tagColl = bookFourMomPair(hs, "BHadron-BTrackJet-1tag");
+        vbosonBoostedHiggs1tagColl = bookFourMomPair(hs, "vboson-boostedhiggs-1tag");
+        vbosonBoostedHiggs2tagsColl = bookFourMomPair(hs, "vboson-boostedhiggs-2tags");
+        bhadBTrackJet2tagColl = bookFourMomPair(hs, "BHadron-BTrackJet-2tag");
+
+        // e.g. CA4dijet for R = 0.4
+        smallRDijetColls.resize(jets.numSmallR());
+        for (size_t iR = 0; iR < jets.numSmallR(); ++iR) {
+            std::ostringstream name;
+            name << "CA" << 10*jets.smallR(iR) << "dijet";
+            smallRDijetColls[iR] = bookFourMomPair(hs, name.str());
+        }
 
-    FinalState fs;
-    addProjection(ZFinder(fs, etaIn(-2.5, 2.5) & (pT >= 25*GeV), PID::ELECTRON, 75*GeV, 105*GeV), "ZeeFinder");
-    addProjection(ZFinder(fs, etaIn(-2.5, 2.5) & (pT >= 25*GeV), PID::MUON, 75*GeV, 105*GeV), "ZmumuFinder");
+        hs.cutflow.push_back(bookHisto1D(hs.prefix + "cutflow", CUTSLEN, 0, CUTSLEN, "cutflow", "cut", "entries"));
+    }
 
-    addProjection(WFinder(fs, etaIn(-2.5, 2.5) & (pT > 25*GeV), PID::ELECTRON, 65*GeV, 95*GeV, 25*GeV), "WenuFinder");
-    addProjection(WFinder(fs, etaIn(-2.5, 2.5) & (pT > 25*GeV), PID::MUON, 65*GeV, 95*GeV, 25*GeV), "WmunuFinder");
-    
-    // calo jets constituents
-    // TODO
-    // don't include high-pt neutrinos or leptons in jets
-    // include electrons?
-    IdentifiedFinalState nufs(FinalState(-2.5, 2.5, 25*GeV)); //This will look for a range of particle specified by their pid
-    nufs.acceptNeutrinos(); //Here we specify what particle we are looking for.In this case any Neutrino.
+    // the histograms declared above are booked on their first fill. those
+    // never filled are only written without MC_BOOSTEDHBB_SPARSE.
+    const string sparse = envOption("MC_BOOSTEDHBB_SPARSE", "");
+    sparseOutput = !sparse.empty() && sparse != "0";
+
+    // weight variations are booked once the first event shows how many
+    // weights there are.
+    maxWeights = std::atoi(envOption("MC_BOOSTEDHBB_NWEIGHTS", "0").c_str());
+    const string unnorm = envOption("MC_BOOSTEDHBB_UNNORMALISED", "");
+    unnormalised = !unnorm.empty() && unnorm != "0";
+
+    // how the b hadrons are matched to the b-tagged track jets
+    const string matching = envOption("MC_BOOSTEDHBB_MATCHING", "nearest");
+    if (matching == "nearest")
+        matchStrategy = DeltaRMatrix::NEAREST;
+    else if (matching == "greedy")
+        matchStrategy = DeltaRMatrix::GREEDY;
+    else if (matching == "optimal")
+        matchStrategy = DeltaRMatrix::OPTIMAL;
+    else
+        throw Exception("MC_BOOSTEDHBB: MC_BOOSTEDHBB_MATCHING must be nearest, greedy or optimal, not " + matching);
+    if (matchStrategy != DeltaRMatrix::NEAREST)
+        MSG_INFO("Matching b hadrons to track jets " << matching << ".");
+
+    // skims. when replaying one there is nothing to do per event.
+    skimInput = envOption("MC_BOOSTEDHBB_SKIMIN", "");
+    if (!skimInput.empty()) {
+        MSG_INFO("Replaying skim " << skimInput << ", the input events are ignored.");
+        return;
+    }
+    skimOutput = envOption("MC_BOOSTEDHBB_SKIMOUT", "");
+
+    // the category cube, booked per category on the first fill
+    const string cubeOption = envOption("MC_BOOSTEDHBB_CUBE", "");
+    if (!cubeOption.empty() && cubeOption != "0") {
+        cube.addAxis("nlep", {0, 1, 2});
+        cube.addAxis("ntrackjet", {0, 1, 2, 3, 4});
+        cube.addAxis("nbtag", {0, 1, 2, 3});
+        cube.addAxis("met", {0, 50*GeV, 100*GeV, 150*GeV, 200*GeV, 300*GeV});
+        cube.addAxis("vpt", {0, 150*GeV, 250*GeV, 400*GeV});
+
+        const char* names[CUBEOBSLEN] = { "higgsm", "higgspt", "vhm" };
+        const string xlabels[CUBEOBSLEN] = { "higgs candidate " + mlab, "higgs candidate " + ptlab, "VH " + mlab };
+        const int nbins[CUBEOBSLEN] = { 30, 20, 25 };
+        const double xmax[CUBEOBSLEN] = { 300*GeV, 1000*GeV, 2500*GeV };
+
+        cubeSpecs.resize(CUBEOBSLEN);
+        for (size_t iObs = 0; iObs < CUBEOBSLEN; ++iObs) {
+            HistoSpec& spec = cubeSpecs[iObs];
+            spec.name = names[iObs];
+            spec.xlabel = xlabels[iObs];
+            spec.nxbins = nbins[iObs];
+            spec.xmin = 0;
+            spec.xmax = xmax[iObs];
+        }
 
-    MergedFinalState leptonsAndNeutrinos(clfs, nufs);
-    addProjection(leptonsAndNeutrinos, "LeptonsAndNeutrinos");
+        foreach (HistoSet& hs, histos)
+            hs.cube.resize(cube.numCategories()*CUBEOBSLEN);
+        MSG_INFO("Filling a cube of " << cube.numCategories() << " event categories.");
+    }
 
-    VetoedFinalState caloParts(FinalState(-4.2, 4.2));
-    caloParts.addVetoOnThisFinalState(leptonsAndNeutrinos);//Here we appear veto if we find a lepton  
+    const string cutMaskOutput = envOption("MC_BOOSTEDHBB_CUTMASKS", "");
+    if (!cutMaskOutput.empty()) {
+        MSG_INFO("Writing the cut mask of every event to " << cutMaskOutput);
+        cutMaskWriter = new CutMaskWriter(cutMaskOutput, vector<string>(cutNames, cutNames + CUTSLEN));
+    }
 
-    // track jets constituents
-		VetoedFinalState trackParts(ChargedFinalState(-2.5, 2.5, 5*GeV));
-		trackParts.addVetoOnThisFinalState(leptonsAndNeutrinos);
+    const string prefilterOption = envOption("MC_BOOSTEDHBB_PREFILTER", "");
+    if (prefilterOption == "validate")
+        prefilterMode = PREFILTER_VALIDATE;
+    else if (!prefilterOption.empty() && prefilterOption != "0")
+        prefilterMode = PREFILTER_ON;
 
-    // register jet collections
-    addProjection(FastJets(caloParts, FastJets::ANTIKT, 1.0), "AntiKt10CaloJets"); //R=1 is rather wide so this should include two boosted higgs jets. We will be able to resolve these in the tracker. 
+    if (prefilterMode == PREFILTER_ON && cutMaskWriter) {
+        MSG_WARNING("Cut masks need every event selected, the pre-filter only validates.");
+        prefilterMode = PREFILTER_VALIDATE;
+    }
+    if (prefilterMode == PREFILTER_ON)
+        MSG_INFO("Pre-filtering the events before the projections.");
+    else if (prefilterMode == PREFILTER_VALIDATE)
+        MSG_INFO("Validating the pre-filter, it vetoes no events.");
+
+    // multi-threaded mode. the workers are started on the first event.
+    nthreads = std::atoi(envOption("MC_BOOSTEDHBB_NTHREADS", "0").c_str());
+
+    // slices of one process, each normalised on its own. the driver gives
+    // the number of events of every slice, else a new slice starts
+    // wherever the event number does not increase.
+    const string slices = envOption("MC_BOOSTEDHBB_SLICES", "");
+    std::istringstream sizes(envOption("MC_BOOSTEDHBB_SLICEEVENTS", ""));
+    string size;
+    while (std::getline(sizes, size, ',')) {
+        if (size.empty()) continue;
+        sliceSizes.push_back(std::strtoul(size.c_str(), 0, 10));
+        if (!sliceSizes.back())
+            throw Exception("MC_BOOSTEDHBB: MC_BOOSTEDHBB_SLICEEVENTS lists a slice without events");
+    }
+    stitchSlices = (!slices.empty() && slices != "0") || !sliceSizes.empty();
+    if (stitchSlices) {
+        if (!skimOutput.empty() || cutMaskWriter)
+            throw Exception("MC_BOOSTEDHBB: skims and cut masks are normalised with the totals of the run, "
+                    "they cannot be written for stitched slices");
+        if (unnormalised) {
+            MSG_WARNING("MC_BOOSTEDHBB_UNNORMALISED is ignored when stitching slices.");
+            unnormalised = false;
+        }
+        if (nthreads) {
+            MSG_WARNING("Stitched slices are analysed on one thread.");
+            nthreads = 0;
+        }
+        if (sliceSizes.empty())
+            MSG_INFO("Stitching slices, a new one starts wherever the event number does not increase.");
+        else
+            MSG_INFO("Stitching " << sliceSizes.size() << " slices of the sizes in MC_BOOSTEDHBB_SLICEEVENTS.");
+    }
 
-    // variable-R jets. With the tracker.
-    fastjet::JetDefinition::Plugin *vrPlugTrack =
-        new fastjet::contrib::VariableRPlugin(60*GeV /* rho < mH */, 0.2, 0.6, fastjet::contrib::VariableRPlugin::AKTLIKE);//Here we create specify the jet definition 
-    addProjection(FastJets(trackParts, vrPlugTrack), "AntiKtVRTrackJets");//Here we add the projection and call it usign the string argument. 
+    // checkpoints, read back if this job is a restart
+    checkpointFile = envOption("MC_BOOSTEDHBB_CHECKPOINT", "");
+    if (!checkpointFile.empty()) {
+        checkpointEvery = std::strtoul(envOption("MC_BOOSTEDHBB_CHECKPOINTEVERY", "10000").c_str(), 0, 10);
+        if (!checkpointEvery)
+            throw Exception("MC_BOOSTEDHBB: MC_BOOSTEDHBB_CHECKPOINTEVERY must be a positive number of events");
+        if (!skimOutput.empty() || cutMaskWriter)
+            throw Exception("MC_BOOSTEDHBB: skims and cut masks are not part of the checkpoints, "
+                    "they cannot be written with them");
+        if (nthreads) {
+            MSG_WARNING("Checkpoints are taken on one thread.");
+            nthreads = 0;
+        }
 
-		//This is to look for the b hadrons. We do this to find the exact location of the b-Hadron relative to the centre of the jet.
-		addProjection(HeavyHadrons(-2.5,2.5,0.1*GeV), "HeavyHadrons");
+        if (readCheckpoint(checkpointFile, resumeData)) {
+            resumeEvents = resumeData.get<uint64_t>();
+            resumeWeights = resumeData.get<uint64_t>();
+            const bool sameLayout = resumeData.get<uint64_t>() == histos.size()
+                && resumeData.get<uint64_t>() == histos[0].size1D
+                && resumeData.get<uint64_t>() == histos[0].size2D
+                && resumeData.get<uint64_t>() == histos[0].cube.size()
+                && resumeData.get<uint8_t>() == stitchSlices;
+            if (!sameLayout)
+                throw Exception("MC_BOOSTEDHBB: checkpoint " + checkpointFile
+                        + " was written with other selections or options");
+            MSG_INFO("Resuming from checkpoint " << checkpointFile << ", skipping the "
+                    << resumeEvents << " events it covers.");
+        }
 
-    // register Z and W bosons
-    bookFourMom("vboson");
+        MSG_INFO("Writing a checkpoint to " << checkpointFile << " every " << checkpointEvery << " events.");
+        checkpointWriter = new CheckpointWriter(checkpointFile);
+    }
 
-    // register special collections
-    bookFourMom("BoostedHb");
-    bookFourMom("BoostedHbb");
-    bookFourMomPair("vboson_higgs");
-    bookFourMomPair("BHadron-BTrackJet-1tag");
-    bookFourMomPair("vboson-boostedhiggs-1tag");
-    bookFourMomPair("vboson-boostedhiggs-2tags");
-    bookFourMomPair("BHadron-BTrackJet-2tag");
+    // instrumentation. allocations are counted by the timers.
+    timingOutput = envOption("MC_BOOSTEDHBB_TIMING", "");
+    if (timingOutput == "0") timingOutput.clear();
+    const string allocs = envOption("MC_BOOSTEDHBB_ALLOCS", "");
+    countAllocs = !allocs.empty() && allocs != "0";
+    if (countAllocs && !allocationsCounted()) {
+        MSG_WARNING("MC_BOOSTEDHBB_ALLOCS is set, but nothing counts the allocations in this process. "
+                << "Link or preload AllocCounter.cc.");
+        countAllocs = false;
+    }
+    // the counters are per thread, the workers' allocations would be missed
+    if (countAllocs && nthreads) {
+        MSG_WARNING("Allocations are counted on one thread.");
+        nthreads = 0;
+    }
 
-    cutflow = bookHisto1D("cutflow", CUTSLEN, 0, CUTSLEN, "cutflow", "cut", "entries");
+    if (!timingOutput.empty() || countAllocs) {
+        stageTimers = new StageTimers(TIMERSLEN);
+        foreach (EventState& st, states)
+            st.stageTimers = stageTimers;
+        foreach (HistoSet& hs, histos)
+            hs.stageTimers = stageTimers;
+        cycleClock.start();
+    }
 
     return;
 }
@@ -115,162 +408,535 @@ void MC_BOOSTEDHBB::init() {
 
 /// Perform the per-event analysis
 void MC_BOOSTEDHBB::analyze(const Event& event) {
-    const double weight = event.weight();
+    if (!skimInput.empty()) return;
 
-    // reset cut bits.
-    for (unsigned int iCut = 0; iCut < CUTSLEN; ++iCut){
-			cutBits[iCut] = false;
-		}
-    cutBits[NONE] = true;
+    // events the checkpoint read back holds already
+    if (nanalysed < resumeEvents) {
+        ++nanalysed;
+        return;
+    }
+
+    EventAllocations allocs(*this);
+    selectEvent(event);
 
-    // find a boson...
-    const Particles& zeebosons = applyProjection<ZFinder>(event, "ZeeFinder").bosons();
-    const Particles& zmumubosons = applyProjection<ZFinder>(event, "ZmumuFinder").bosons();
+    // vetoed or not
+    if (cutMaskWriter) writeCutMask(event);
 
-    const Particles& wenubosons = applyProjection<WFinder>(event, "WenuFinder").bosons();
-    const Particles& wmunubosons =  applyProjection<WFinder>(event, "WmunuFinder").bosons();
+    ++nanalysed;
+    if (checkpointWriter && nanalysed % checkpointEvery == 0) writeCheckpoint();
+
+    return;
+}
+
+
+/// The ParticlePartitioner first sorts the final state into leptons,
+/// visible momentum and jet constituents in one pass. The selection is then
+/// applied in stages, cheapest first: the vector boson finders, the
+/// b-hadron count, the AKT10 calo jet clustering and finally the VR track
+/// jet clustering. Each stage only applies the projections it needs, so an
+/// event vetoed early never pays for the jet clusterings.
+void MC_BOOSTEDHBB::selectEvent(const Event& event) {
+    StageLaps laps(stageTimers, TIME_EVENT, TIME_VBOSONSTAGE);
+
+    // first event: book the weight variations and set up everything that
+    // depends on the number of weights.
+    if (sumW.empty()) {
+        size_t nweights = std::max<size_t>(event.genEvent()->weights().size(), 1);
+        if (maxWeights && nweights > maxWeights) nweights = maxWeights;
+
+        startEvents(nweights);
+    }
+
+    eventWeights(event, weights);
+    for (size_t iw = 0; iw < sumW.size(); ++iw)
+        sumW[iw] += weights[iw];
+    if (stitchSlices) nextSlice(event);
+
+    // events failing a bound of the pre-filter cannot pass any selection
+    if (!prefilter(event)) {
+        foreach (EventState& st, states)
+            ++st.stageCounts[VBOSONSTAGE];
+        vetoEvent;
+    }
+
+    // stage 1: leptons and vector boson
 
     // leptons
     // TODO
     // isolation?
-    const Particles& leptons = applyProjection<ChargedLeptons>(event, "ChargedLeptons").particles();
-
-    const Particle& mm = Particle(0, -applyProjection<MissingMomentum>(event, "MissingMomentum").visibleMomentum()); //Note the 4 vector momentum should sum to zero so if visible momentum is none zero is must be balanced in the opposite direction.
-
-		const Jets& akt10cjs = applyProjection<FastJets>(event, "AntiKt10CaloJets").jetsByPt(250*GeV);//Again find jets over 250 GeV in the calo.
-
-    const Jets& antiKtVRTrackJets = applyProjection<FastJets>(event, "AntiKtVRTrackJets").jetsByPt(25*GeV);//Now we use the variableR algorithm to search for jets in the tracker. 
-    const Jets& antiKtVRTrackJetsBTagged = bTagged(antiKtVRTrackJets);
-
-		const Particles& bhads = applyProjection<HeavyHadrons>(event, "HeavyHadrons").bHadrons();
-
-    // find vboson
-    Particle vboson;
-    if (zeebosons.size() && leptons.size() == 2){ //We look for a single Z boson that has decayed into 2 leptons. 
-        vboson = zeebosons[0];
-        cutBits[ZLL] = true;
-    } else if (zmumubosons.size() && leptons.size() == 2) {
-        vboson = zmumubosons[0];
-        cutBits[ZLL] = true;
-    } else if (wenubosons.size() && leptons.size() == 1) {//We look for a single W boson decaying into electron/muon and neutrino. 
-        vboson = wenubosons[0];
-        cutBits[WLNU] = true;
-    } else if (wmunubosons.size() && leptons.size() == 1) {
-        vboson = wmunubosons[0];
-        cutBits[WLNU] = true;
-    } else if (leptons.size() == 0 && mm.pT() > 30*GeV) { //This is looking for a single Z boson decaying into 2 Neutrinos. We look for missing momentum.
-        vboson = Particle(23, mm);
-        cutBits[ZNUNU] = true;
-    }
-    // find channel
-    string lepchan;
-    if (cutBits[ZLL]){
-			lepchan = "Zll";
-		}else if(cutBits[WLNU]){
-			lepchan = "Wlnu";
-		}else if (cutBits[ZNUNU]){
-			lepchan = "Znunu";
-		}else{
-			vetoEvent;
-		}
+    const ParticlePartitioner& parts = applyTimed<ParticlePartitioner>(event, "ParticlePartitioner", TIME_PARTITIONER);
+    const size_t nleptons = parts.leptons().size();
+
+    //Note the 4 vector momentum should sum to zero so if visible momentum is none zero is must be balanced in the opposite direction.
+    const FourMomentum missingMom = -parts.visibleMomentum();
+
+    // find vboson. only the finders matching the lepton multiplicity are
+    // run, each at most once for all selections.
+    const Particles* zeebosons = 0;
+    const Particles* zmumubosons = 0;
+    const Particles* wenubosons = 0;
+    const Particles* wmunubosons = 0;
+
+    bool anyPassed = false;
+    for (size_t iSel = 0; iSel < selections.size(); ++iSel) {
+        const Selection& sel = selections[iSel];
+        EventState& st = states[iSel];
+
+        // reset cut bits.
+        st.reset();
+        st.weights = weights;
+        CutMask& cutBits = st.cutBits;
+
+        ++st.stageCounts[VBOSONSTAGE];
+
+        st.met = missingMom.pT();
+
+        Particle& vboson = st.vboson;
+        if (nleptons == 2) { //We look for a single Z boson that has decayed into 2 leptons. 
+            if (!zeebosons) zeebosons = &applyTimed<ZFinder>(event, "ZeeFinder", TIME_ZEEFINDER).bosons();
+            if (inMassWindow(*zeebosons, sel.zMassMin, sel.zMassMax)) {
+                vboson = zeebosons->at(0);
+                cutBits[ZLL] = true;
+            } else {
+                if (!zmumubosons) zmumubosons = &applyTimed<ZFinder>(event, "ZmumuFinder", TIME_ZMUMUFINDER).bosons();
+                if (inMassWindow(*zmumubosons, sel.zMassMin, sel.zMassMax)) {
+                    vboson = zmumubosons->at(0);
+                    cutBits[ZLL] = true;
+                }
+            }
+        } else if (nleptons == 1) { //We look for a single W boson decaying into electron/muon and neutrino. 
+            if (!wenubosons) wenubosons = &applyTimed<WFinder>(event, "WenuFinder", TIME_WENUFINDER).bosons();
+            if (inMassWindow(*wenubosons, sel.wMassMin, sel.wMassMax)) {
+                vboson = wenubosons->at(0);
+                cutBits[WLNU] = true;
+            } else {
+                if (!wmunubosons) wmunubosons = &applyTimed<WFinder>(event, "WmunuFinder", TIME_WMUNUFINDER).bosons();
+                if (inMassWindow(*wmunubosons, sel.wMassMin, sel.wMassMax)) {
+                    vboson = wmunubosons->at(0);
+                    cutBits[WLNU] = true;
+                }
+            }
+        } else if (nleptons == 0) { //This is looking for a single Z boson decaying into 2 Neutrinos. We look for missing momentum.
+            if (missingMom.pT() > sel.metMin) {
+                vboson = Particle(23, missingMom);
+                cutBits[ZNUNU] = true;
+            }
+        }
+
+        // find channel
+        if (cutBits[ZLL]){
+            st.lepchan = ZLLCHAN;
+        }else if(cutBits[WLNU]){
+            st.lepchan = WLNUCHAN;
+        }else if (cutBits[ZNUNU]){
+            st.lepchan = ZNUNUCHAN;
+        }else{
+            continue;
+        }
+
+        cutBits[VBOSON] = cutBits[ZLL] || cutBits[WLNU] || cutBits[ZNUNU];
+        st.passed = true;
+        anyPassed = true;
+    }
+
+    if (!anyPassed)
+        vetoEvent;
+    if (prefilterFailed & (1u << EventPreFilter::VBOSON))
+        prefilterMiss(EventPreFilter::VBOSON);
+
+
+    // stage 2: b hadrons. the same for all selections.
+    laps.next(TIME_BHADRONSTAGE);
+    foreach (EventState& st, states)
+        if (st.passed) ++st.stageCounts[BHADRONSTAGE];
+
+    {
+        ScopedTimer t(stageTimers, TIME_HEAVYHADRONS);
+        bhadrons = applyProjection<HeavyHadrons>(event, "HeavyHadrons").bHadrons();
+    }
+    const Particles& bhads = bhadrons;
+
+		//Here we look for b hadrons. We look for b-hadron separate from the jet so we can determine the deltaR between the jet and B-hadron. Note should compare to the nearest jet.  
+		//We veto the event if no b hadrons are found or if more than 2 are found
+    if (bhads.size() != 1 && bhads.size() != 2)
+        vetoEvent;
+    if (prefilterFailed & (1u << EventPreFilter::BHADRON))
+        prefilterMiss(EventPreFilter::BHADRON);
+
+    foreach (EventState& st, states) {
+        if (!st.passed) continue;
+
+        st.cutBits[ONEBHADRONSFOUND] = bhads.size() == 1;
+        st.cutBits[TWOBHADRONSFOUND] = bhads.size() == 2;
+        st.bhads = bhads;
+    }
+
+
+    // the jet stages run on the worker threads in multi-threaded mode
+    if (nthreads) {
+        laps.next(TIME_DISPATCH);
+        dispatch(parts);
+        return;
+    }
+
+
+    // stage 3: AKT10 calo jets, clustered once with the loosest threshold
+    laps.next(TIME_CALOJETSTAGE);
+    const MultiRadiusJets* jets;
+    Jets akt10cjs;
+    {
+        ScopedTimer t(stageTimers, TIME_CALOJETS);
+        jets = &applyProjection<MultiRadiusJets>(event, "MultiRadiusJets");
+        akt10cjs = jets->caloJets(loosestCaloJetPt);//Again find jets over 250 GeV in the calo.
+    }
+    foreach (EventState& st, states)
+        st.jets = jets;
+    if (!selectCaloJets(akt10cjs, states))
+        vetoEvent;
+    if (prefilterFailed & (1u << EventPreFilter::CALOJET))
+        prefilterMiss(EventPreFilter::CALOJET);
+    akt10Substructure.setJets(jets->caloClustering());
+
+
+    // stage 4: VR track jets
+    laps.next(TIME_TRACKJETSTAGE);
+    Jets antiKtVRTrackJets;
+    {
+        ScopedTimer t(stageTimers, TIME_TRACKJETS);
+        antiKtVRTrackJets = jets->trackJets(loosestTrackJetPt);//Now we use the variableR algorithm to search for jets in the tracker. 
+    }
+    selectTrackJets(antiKtVRTrackJets, states, histos);
+
+    return;
+}
+
+
+/// Normalise histograms etc., after the run
+void MC_BOOSTEDHBB::finalize() {
+
+    // a restart after the last checkpoint had no events left
+    if (resumeEvents && sumW.empty()) startEvents(resumeWeights);
+
+    if (nthreads) {
+        stopWorkers();
+        replayFinished(true);
+        mergeWorkers();
+    }
+
+    // normalize to 1/fb, every weight variation with its own sum of weights
+    vector<double> norms;
+    if (!skimInput.empty()) {
+        replaySkim(norms);
+        if (unnormalised)
+            MSG_WARNING("MC_BOOSTEDHBB_UNNORMALISED is ignored when replaying a skim.");
+    } else if (stitchSlices) {
+        // every slice is normalised already
+        finishSlices();
+        norms.assign(histos[0].nweights, 1);
+    } else {
+        sumW.resize(histos[0].nweights, 0);
+        foreach (double sw, sumW)
+            norms.push_back(unnormalised ? 1 : 1000*crossSection()/sw);
+        if (unnormalised) writeSums();
+
+        if (skimWriter) {
+            skimWriter->close(sumW, crossSection(), states[0].stageCounts[VBOSONSTAGE]);
+            MSG_INFO(skimWriter->numWritten() << " events written to the skim.");
+        }
+
+        if (cutMaskWriter) {
+            cutMaskWriter->close(sumW[0], crossSection(), states[0].stageCounts[VBOSONSTAGE]);
+            MSG_INFO(cutMaskWriter->numWritten() << " cut masks written.");
+        }
+    }
+
+    flushHistos();
+
+    foreach (HistoSet& hs, histos) {
+        for (size_t iHisto = 0; iHisto < hs.histos1D.size(); ++iHisto) {
+            Histo1DPtr& h = hs.histos1D[iHisto];
+            if (h) h->scaleW(norms[iHisto/hs.size1D]); // norm to cross section
+        }
+
+        for (size_t iHisto = 0; iHisto < hs.histos2D.size(); ++iHisto) {
+            Histo2DPtr& h = hs.histos2D[iHisto];
+            if (h) h->scaleW(norms[iHisto/hs.size2D]); // norm to cross section
+        }
+
+        for (size_t iHisto = 0; iHisto < hs.cubeHistos.size(); ++iHisto) {
+            Histo1DPtr& h = hs.cubeHistos[iHisto];
+            if (h) h->scaleW(norms[iHisto/hs.cube.size()]);
+        }
+
+
+        for (size_t iw = 0; iw < hs.nweights; ++iw)
+            hs.cutflow[iw]->scaleW(norms[iw]);
+    }
+
+    if (!skimInput.empty()) return;
 
-    cutBits[VBOSON] = cutBits[ZLL] || cutBits[WLNU] || cutBits[ZNUNU];
 
+    // how far events got through the staged selection in analyze().
+    // everything that did not reach a stage skipped its projections.
+    const char* stageNames[STAGESLEN] = {
+        "vboson", "bhadrons", "AntiKt10CaloJets", "AntiKtVRTrackJets", "selected"
+    };
+
+    for (size_t iSel = 0; iSel < selections.size(); ++iSel) {
+        const vector<unsigned long>& stageCounts = states[iSel].stageCounts;
+        MSG_INFO("Events reaching each selection stage"
+                << (iSel ? " in selection " + selections[iSel].name : string()) << ":");
+        for (unsigned int iStage = 0; iStage < STAGESLEN; ++iStage) {
+            MSG_INFO("    " << stageNames[iStage] << ": " << stageCounts[iStage]
+                    << " (" << stageCounts[VBOSONSTAGE] - stageCounts[iStage] << " skipped)");
+        }
+    }
+
+    // the run is complete, a restart would start over
+    if (checkpointWriter) {
+        MSG_INFO(checkpointWriter->numWritten() << " checkpoints written, removing " << checkpointFile);
+        delete checkpointWriter;
+        checkpointWriter = 0;
+        std::remove(checkpointFile.c_str());
+    }
+
+    if (prefilterMode != PREFILTER_OFF) writePrefilter();
+    if (!timingOutput.empty()) writeTiming();
+    if (countAllocs) writeAllocations();
+
+
+    return;
+}
+
+//@}
+
+
+void MC_BOOSTEDHBB::addSelections(const string& spec) {
+    // name:key=value,key=value;name:...
+    std::istringstream specs(spec);
+    string item;
+    while (std::getline(specs, item, ';')) {
+        if (item.empty()) continue;
+
+        Selection sel = selections[0];
+
+        const size_t colon = item.find(':');
+        sel.name = item.substr(0, colon);
+        if (sel.name.empty())
+            throw Exception("MC_BOOSTEDHBB: selection without a name in " + spec);
+
+        std::istringstream cuts(colon == string::npos ? string() : item.substr(colon + 1));
+        string cut;
+        while (std::getline(cuts, cut, ',')) {
+            const size_t eq = cut.find('=');
+            if (eq == string::npos)
+                throw Exception("MC_BOOSTEDHBB: bad cut " + cut + " in selection " + sel.name);
+
+            const string key = cut.substr(0, eq);
+            const double val = std::atof(cut.substr(eq + 1).c_str())*GeV;
+            if (key == "zmassmin") sel.zMassMin = val;
+            else if (key == "zmassmax") sel.zMassMax = val;
+            else if (key == "wmassmin") sel.wMassMin = val;
+            else if (key == "wmassmax") sel.wMassMax = val;
+            else if (key == "met") sel.metMin = val;
+            else if (key == "calojetpt") sel.caloJetPtMin = val;
+            else if (key == "trackjetpt") sel.trackJetPtMin = val;
+            else throw Exception("MC_BOOSTEDHBB: unknown cut " + key + " in selection " + sel.name);
+        }
+
+        MSG_INFO("Selection " << sel.name << ": Z mass " << sel.zMassMin/GeV << "-" << sel.zMassMax/GeV
+                << " GeV, W mass " << sel.wMassMin/GeV << "-" << sel.wMassMax/GeV
+                << " GeV, MET > " << sel.metMin/GeV
+                << " GeV, AKT10 pT > " << sel.caloJetPtMin/GeV
+                << " GeV, track jet pT > " << sel.trackJetPtMin/GeV << " GeV");
+
+        selections.push_back(sel);
+    }
+
+    return;
+}
+
+
+bool MC_BOOSTEDHBB::inMassWindow(const Particles& bosons, double mmin, double mmax) {
+    if (bosons.empty()) return false;
+
+    const double m = bosons[0].mass();
+    return m >= mmin && m <= mmax;
+}
+
+
+bool MC_BOOSTEDHBB::selectCaloJets(const Jets& akt10cjs, vector<EventState>& sts) {
+    bool anyPassed = false;
+    for (size_t iSel = 0; iSel < selections.size(); ++iSel) {
+        EventState& st = sts[iSel];
+        if (!st.passed) continue;
+
+        st.passed = selectCaloJets(akt10cjs, selections[iSel], st);
+        anyPassed = anyPassed || st.passed;
+    }
+
+    return anyPassed;
+}
+
+
+void MC_BOOSTEDHBB::selectTrackJets(const Jets& antiKtVRTrackJets, vector<EventState>& sts, vector<HistoSet>& hss) {
+    for (size_t iSel = 0; iSel < selections.size(); ++iSel)
+        if (sts[iSel].passed) selectTrackJets(antiKtVRTrackJets, iSel, sts[iSel], hss[iSel]);
+
+    return;
+}
+
+
+bool MC_BOOSTEDHBB::selectCaloJets(const Jets& akt10cjs, const Selection& sel, EventState& st) {
+    ++st.stageCounts[CALOJETSTAGE];
 
     // find boosted higgs
-    Particle boostedhiggs;
 
     // very simple boosted higgs tagging
     // exactly one akt10 calo jet
     // all track jets in event must be in the calo jet cone
 
-    if (akt10cjs.size() == 1 ){ //Look for at least 1 high energy=250 GeV jet in calo and large R=1 value. Must be single large calo get or vetoEvent.
-			cutBits[ONEAKT10JET] = true;	
+    // the jets are sorted in pT and may include softer ones for looser
+    // selections.
+    size_t njets = 0;
+    while (njets < akt10cjs.size() && akt10cjs[njets].pT() >= sel.caloJetPtMin)
+        ++njets;
+
+    if (njets == 1 ){ //Look for at least 1 high energy=250 GeV jet in calo and large R=1 value. Must be single large calo get or vetoEvent.
+			st.cutBits[ONEAKT10JET] = true;	
 		}else{
-			vetoEvent;
+			return false;
 		}
 		//Associate this energy deposit with the higgs.
-		boostedhiggs = Particle(25, akt10cjs.at(0).mom());
+		st.boostedhiggs = Particle(25, akt10cjs.at(0).mom());
+
+    return true;
+}
+
+
+void MC_BOOSTEDHBB::selectTrackJets(const Jets& antiKtVRTrackJets, size_t iSel, EventState& st, HistoSet& hs) {
+    ++st.stageCounts[TRACKJETSTAGE];
+
+    // the leading jets passing this selection's threshold
+    const double ptmin = selections[iSel].trackJetPtMin;
+    st.trackJets.clear();
+    foreach (const Jet& tj, antiKtVRTrackJets) {
+        if (tj.pT() < ptmin) break;
+        st.trackJets.push_back(tj.mom());
+    }
+    {
+        ScopedTimer t(st.stageTimers, TIME_BTAGGING);
+        bTagged(st);
+    }
+
+    // the skim holds the default selection
+    if (skimWriter && iSel == 0) writeSkim(st);
+
+    selectBoostedHiggs(st, hs);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::selectBoostedHiggs(EventState& st, HistoSet& hs) {
+    CutMask& cutBits = st.cutBits;
+    const Particles& bhads = st.bhads;
+    const Particle& vboson = st.vboson;
+    const Particle& boostedhiggs = st.boostedhiggs;
+    const vector<FourMomentum>& trackJets = st.trackJets;
+    const vector<double>& weights = st.weights;
+
+    const vector<size_t>& btagCols = st.btagCols;
+
+    // categorised before any b-tag requirement
+    fillCube(st, hs);
 
 		//Now we have 1 large energy deposit in the calorimeter. Now try to match this with two jets in the tracker.  	
-		if(antiKtVRTrackJetsBTagged.size() > 2){
+		if(btagCols.size() > 2){
 			vetoEvent;
 		}
-		cutBits[ONEBTAGGEDTRACKJET] = antiKtVRTrackJetsBTagged.size() == 1; //Now look for low energy single 25 GeV jet in the tracker with VariableR. Which is b tagged.
-		cutBits[TWOBTAGGEDTRACKJET] = antiKtVRTrackJetsBTagged.size() == 2; //Same again but 2 tracks this time both b tagged.
 
-		//Can we connect calo jet with track jets? If they are within a certain cut then we say we have associated the two different types of jet. Otherwise we assume they are different.
-		cutBits[ALLTRACKJETSCONNECTEDTOCALOJET] = true;//Set to true to begin with.
-		foreach (const Jet& tj, antiKtVRTrackJets) {
-			if (Rivet::deltaR(boostedhiggs, tj) > 10.0) { //DeltaR is the difference in pseudo rapidity and azimuthal angle between them. 
-				cutBits[ALLTRACKJETSCONNECTEDTOCALOJET] = false;
-				break;
-			}
-		}
+    ScopedTimer matchTimer(st.stageTimers, TIME_MATCHING);
+    trackJetCuts(st);
+
+    // Delta R matrix with the b hadrons as rows and all track jets as
+    // columns
+    st.drRows.clear();
+    st.bhadRows.clear();
+    foreach (const Particle& bhad, bhads) {
+        st.bhadRows.push_back(st.drRows.size());
+        st.drRows.push_back(bhad.mom());
+    }
+
+    st.drCols.clear();
+    foreach (const FourMomentum& tj, trackJets)
+        st.drCols.push_back(tj);
+
+    st.drMatrix.compute(st.drRows, st.drCols);
+
+    // match every b hadron to a b-tagged track jet
+    vector<int>& bhadMatches = st.bhadMatches;
+    st.drMatrix.match(st.bhadRows, btagCols, matchStrategy, bhadMatches);
+    matchTimer.stop();
+
+    ++st.stageCounts[SELECTEDSTAGE];
+
+    // only the b-tagged events fill the higgs candidate histograms
+    const JetSubstructure* sub = 0;
+    const vector<FourMomentum>* smallRJets = 0;
+    if (cutBits[ONEBTAGGEDTRACKJET] || cutBits[TWOBTAGGEDTRACKJET]) {
+        sub = &substructure(st);
+        smallRJets = &leadingSmallRJets(st);
+    }
+
+    ScopedTimer fillTimer(st.stageTimers, TIME_FILLS);
+
+    const lepchans lepchan = st.lepchan;
 
-		//Here we look for b hadrons. We look for b-hadron separate from the jet so we can determine the deltaR between the jet and B-hadron. Note should compare to the nearest jet.  
-    if (bhads.size() == 1){
-			cutBits[ONEBHADRONSFOUND] = true;
-		}
-		else if (bhads.size() == 2){
-			cutBits[TWOBHADRONSFOUND] = true;
-		}else{//We veto the event if no b hadrons are found or if more than 2 are found
-			vetoEvent;
-		}
     // fill cuts.
     for (int iCut = 0; iCut < CUTSLEN; ++iCut){
 			if (cutBits[iCut]){
-				cutflow->fill(iCut, weight);
+				hs.fillCutflow(iCut, weights);
 			}
 		}
-    string channel;
+    size_t channel;
 		//Now we want to determine the deltaR between the b-Hadron and the jet which has been b-tagged for a particular channel. It is not important to ensure that this is associated to calo since data should come from Higgs events.
 		//TO DO: Should we expect to see a difference between association with b-tagged jet and the nearest if we have two jets?
 		if(cutBits[ONEBHADRONSFOUND] and cutBits[ONEBTAGGEDTRACKJET]){
-			channel = lepchan + "BoostedHb";
-			fillFourMomPair(channel, "BHadron-BTrackJet-1tag", bhads.at(0).mom(), antiKtVRTrackJetsBTagged.at(0).mom(), weight);//We assume only one b hadron since only 1 tagged jet. This might be a bad idea.
-			//Do the same again but this time plot for all channels together.
-			fillFourMomPair("AllChannels", "BHadron-BTrackJet-1tag", bhads.at(0).mom(), antiKtVRTrackJetsBTagged.at(0).mom(), weight);//We assume only one b hadron since only 1 tagged jet. This might be a bad idea.
-		}
-		//This is used to determine the deltaR between the first hadron and it's closest jet. 
-		if(cutBits[TWOBHADRONSFOUND] and cutBits[TWOBTAGGEDTRACKJET]){
-			channel = lepchan + "BoostedHbb";
-			double dr1 = Rivet::deltaR(bhads.at(0).mom(),antiKtVRTrackJetsBTagged.at(0).mom());
-			double dr2 = Rivet::deltaR(bhads.at(0).mom(),antiKtVRTrackJetsBTagged.at(1).mom());
-			int trackPosition;
-			if(dr1 < dr2){ //So we want to match the first b-hadrons to it's closest jets.
-				trackPosition=0;	
-			}else{
-				trackPosition=1;
+			channel = boostedHbChannel[lepchan];
+			for (size_t iBHad = 0; iBHad < bhads.size(); ++iBHad) {
+				if (bhadMatches[iBHad] == DeltaRMatrix::NOMATCH) continue;
+
+				const FourMomentum& tj = trackJets[bhadMatches[iBHad]];
+				fillFourMomPair(hs, channel, bhadBTrackJet1tagColl, bhads[iBHad].mom(), tj, weights);
+				//Do the same again but this time plot for all channels together.
+				fillFourMomPair(hs, allChannels, bhadBTrackJet1tagColl, bhads[iBHad].mom(), tj, weights);
 			}
-			fillFourMomPair(channel, "BHadron-BTrackJet-2tag", bhads.at(0).mom(), antiKtVRTrackJetsBTagged.at(trackPosition).mom(), weight);
-			fillFourMomPair("AllChannels", "BHadron-BTrackJet-2tag", bhads.at(0).mom(), antiKtVRTrackJetsBTagged.at(trackPosition).mom(), weight);
 		}
-		//This is used to determine the deltaR between the second hadron and it's closest jet. 
+		//This is used to determine the deltaR between each hadron and the b-tagged jet it is matched to.
 		if(cutBits[TWOBHADRONSFOUND] and cutBits[TWOBTAGGEDTRACKJET]){
-			channel = lepchan + "BoostedHbb";
-			double dr1 = Rivet::deltaR(bhads.at(1).mom(),antiKtVRTrackJetsBTagged.at(0).mom());
-			double dr2 = Rivet::deltaR(bhads.at(1).mom(),antiKtVRTrackJetsBTagged.at(1).mom());
-			int trackPosition;
-			if(dr1 < dr2){ //So we want to match the first b-hadrons to it's closest jets.
-				trackPosition=0;	
-			}else{
-				trackPosition=1;
+			channel = boostedHbbChannel[lepchan];
+			for (size_t iBHad = 0; iBHad < bhads.size(); ++iBHad) {
+				if (bhadMatches[iBHad] == DeltaRMatrix::NOMATCH) continue;
+
+				const FourMomentum& tj = trackJets[bhadMatches[iBHad]];
+				fillFourMomPair(hs, channel, bhadBTrackJet2tagColl, bhads[iBHad].mom(), tj, weights);
+				fillFourMomPair(hs, allChannels, bhadBTrackJet2tagColl, bhads[iBHad].mom(), tj, weights);
 			}
-			fillFourMomPair(channel, "BHadron-BTrackJet-2tag", bhads.at(1).mom(), antiKtVRTrackJetsBTagged.at(trackPosition).mom(), weight);
-			fillFourMomPair("AllChannels", "BHadron-BTrackJet-2tag", bhads.at(1).mom(), antiKtVRTrackJetsBTagged.at(trackPosition).mom(), weight);
 		}
 		//If you have track jets with 1 or 2 b tags and associated with a calo jet then plot this as the boosted Higgs.
     if (cutBits[TWOBTAGGEDTRACKJET]) {
-			channel = lepchan + "BoostedHbb";
-			fillFourMom(channel, "BoostedHbb", boostedhiggs.mom(), weight);
-			fillFourMom(channel, "vboson", vboson, weight);
-			fillFourMomPair(channel, "vboson-boostedhiggs-2tags", vboson.mom(), boostedhiggs.mom(), weight);
+			channel = boostedHbbChannel[lepchan];
+			fillFourMomJet(hs, channel, boostedHbbColl, boostedhiggs.mom(), *sub, weights);
+			fillFourMom(hs, channel, vbosonColl, vboson, weights);
+			fillFourMomPair(hs, channel, vbosonBoostedHiggs2tagsColl, vboson.mom(), boostedhiggs.mom(), weights);
+			fillSmallRDijets(hs, channel, *smallRJets, weights);
     } else if (cutBits[ONEBTAGGEDTRACKJET]) {
-			channel = lepchan + "BoostedHb";
-			fillFourMom(channel, "BoostedHb", boostedhiggs.mom(), weight);
-			fillFourMom(channel, "vboson", vboson, weight);
-			fillFourMomPair(channel, "vboson-boostedhiggs-1tag", vboson.mom(), boostedhiggs.mom(), weight);
+			channel = boostedHbChannel[lepchan];
+			fillFourMomJet(hs, channel, boostedHbColl, boostedhiggs.mom(), *sub, weights);
+			fillFourMom(hs, channel, vbosonColl, vboson, weights);
+			fillFourMomPair(hs, channel, vbosonBoostedHiggs1tagColl, vboson.mom(), boostedhiggs.mom(), weights);
+			fillSmallRDijets(hs, channel, *smallRJets, weights);
     } 
 
 
@@ -278,222 +944,1528 @@ void MC_BOOSTEDHBB::analyze(const Event& event) {
 }
 
 
-/// Normalise histograms etc., after the run
-void MC_BOOSTEDHBB::finalize() {
+size_t MC_BOOSTEDHBB::bookChannel(const string& channel) {
 
-    // normalize to 1/fb
-    double norm = 1000*crossSection()/sumOfWeights();
-    for (map< string, map<string, map<string, Histo1DPtr> > >::iterator p = histos1D.begin(); p != histos1D.end(); ++p) {
-        for (map<string, map<string, Histo1DPtr> >::iterator q = p->second.begin(); q != p->second.end(); ++q) {
-            for (map<string, Histo1DPtr>::iterator r = q->second.begin(); r != q->second.end(); ++r) {
-                r->second->scaleW(norm); // norm to cross section
-            }
-        }
-    }
+    // the histogram tables are laid out per collection, so all channels
+    // have to be known before the first collection is booked.
+    if (!collections.empty())
+        throw Exception("MC_BOOSTEDHBB: channel " + channel + " booked after the first collection");
 
+    channels.push_back(channel);
 
-    for (map< string, map<string, map<string, Histo2DPtr> > >::iterator p = histos2D.begin(); p != histos2D.end(); ++p) {
-        for (map<string, map<string, Histo2DPtr> >::iterator q = p->second.begin(); q != p->second.end(); ++q) {
-            for (map<string, Histo2DPtr>::iterator r = q->second.begin(); r != q->second.end(); ++r) {
-                r->second->scaleW(norm); // norm to cross section
-            }
-        }
-    }
+    return channels.size() - 1;
+}
 
 
-    cutflow->scaleW(norm);
+size_t MC_BOOSTEDHBB::collection(HistoSet& hs, const string& name) {
 
+    // variations are only booked after all collections
+    if (hs.nweights > 1)
+        throw Exception("MC_BOOSTEDHBB: collection " + name + " booked after the weight variations");
 
-    return;
+    size_t coll = 0;
+    while (coll < collections.size() && collections[coll] != name)
+        ++coll;
+    if (coll == collections.size())
+        collections.push_back(name);
+
+    hs.size1D = collections.size()*channels.size()*OBS1DLEN;
+    hs.size2D = collections.size()*channels.size()*OBS2DLEN;
+    hs.fast1D.resize(hs.size1D);
+    hs.fast2D.resize(hs.size2D);
+    specs1D.resize(hs.size1D);
+    specs2D.resize(hs.size2D);
+
+    return coll;
 }
 
 
-void MC_BOOSTEDHBB::bookChannel(const string& channel) {
+void MC_BOOSTEDHBB::declareHisto(HistoSet& hs, size_t chan, size_t coll, obs1D obs,
+        const string& name, const string& title,
+        const string& xlabel, int nxbins, double xmin, double xmax) {
 
-    channels.push_back(channel);
-    histos1D[channel] = map<string, map<string, Histo1DPtr> >();
-    histos2D[channel] = map<string, map<string, Histo2DPtr> >();
+    HistoSpec& spec = specs1D[hs.index1D(chan, coll, obs)];
+    spec.name = name;
+    spec.title = title;
+    spec.xlabel = xlabel;
+    spec.nxbins = nxbins;
+    spec.xmin = xmin;
+    spec.xmax = xmax;
 
     return;
 }
 
 
-Histo1DPtr MC_BOOSTEDHBB::bookHisto(const string& name, const string& title,
-        const string& xlabel, int nxbins, double xmin, double xmax) {
-
-    double xbinwidth = (xmax - xmin)/nxbins;
+void MC_BOOSTEDHBB::declareHisto(HistoSet& hs, size_t chan, size_t coll, obs2D obs,
+        const string& name, const string& title,
+        const string& xlabel, int nxbins, double xmin, double xmax,
+        const string& ylabel, int nybins, double ymin, double ymax) {
 
-    char buff[100];
-    sprintf(buff, "events / %.2f", xbinwidth);
-    string ylabel = buff;
+    HistoSpec& spec = specs2D[hs.index2D(chan, coll, obs)];
+    spec.name = name;
+    spec.title = title;
+    spec.xlabel = xlabel;
+    spec.nxbins = nxbins;
+    spec.xmin = xmin;
+    spec.xmax = xmax;
+    spec.ylabel = ylabel;
+    spec.nybins = nybins;
+    spec.ymin = ymin;
+    spec.ymax = ymax;
 
-    return bookHisto1D(name, nxbins, xmin, xmax, title, xlabel, ylabel);
+    return;
 }
 
 
-Histo2DPtr MC_BOOSTEDHBB::bookHisto(const string& name, const string& title,
-        const string& xlabel, int nxbins, double xmin, double xmax,
-        const string& ylabel, int nybins, double ymin, double ymax) {
+// "[Wiw]" for variation iw, nothing for the nominal weight
+static string variationSuffix(size_t iw) {
+    if (!iw) return string();
+
+    std::ostringstream suffix;
+    suffix << "[W" << iw << "]";
+    return suffix.str();
+}
 
-    double xbinwidth = (xmax - xmin)/nxbins;
-    double ybinwidth = (ymax - ymin)/nybins;
 
-    char buff[100];
-    sprintf(buff, "events / %.2f / %.2f", xbinwidth, ybinwidth);
-    string zlabel = buff;
+void MC_BOOSTEDHBB::bookLazy(HistoSet& hs, size_t slot, FastHisto1D& h) {
+    const HistoSpec& spec = specs1D[slot];
+    if (spec.name.empty())
+        throw Exception("MC_BOOSTEDHBB: fill of an undeclared histogram in collection "
+                + collections[slot/(hs.nchannels*OBS1DLEN)]);
 
-    return bookHisto2D(name, nxbins, xmin, xmax, nybins, ymin, ymax, title, xlabel, ylabel, zlabel);
+    ScopedTimer t(hs.stageTimers, TIME_BOOKING);
+    h.book(hs.nweights, spec.nxbins, spec.xmin, spec.xmax);
+
+    return;
 }
 
 
-void MC_BOOSTEDHBB::bookFourMom(const string& name) {
-    MSG_DEBUG("Booking " << name << " histograms.");
+void MC_BOOSTEDHBB::bookLazy(HistoSet& hs, size_t slot, FastHisto2D& h) {
+    const HistoSpec& spec = specs2D[slot];
+    if (spec.name.empty())
+        throw Exception("MC_BOOSTEDHBB: fill of an undeclared histogram in collection "
+                + collections[slot/(hs.nchannels*OBS2DLEN)]);
 
-    foreach (const string& chan, channels) {
-        histos1D[chan][name]["pt"] = bookHisto(chan + "_" + name + "_pt", name, ptlab, 25, 0, 2000*GeV);
-        histos1D[chan][name]["eta"] = bookHisto(chan + "_" + name + "_eta", name, "$\\eta$", 25, -5, 5);
-        histos1D[chan][name]["m"] = bookHisto(chan + "_" + name + "_m", name, mlab, 25, 0, 1000*GeV);
+    ScopedTimer t(hs.stageTimers, TIME_BOOKING);
+    h.book(hs.nweights, spec.nxbins, spec.xmin, spec.xmax, spec.nybins, spec.ymin, spec.ymax);
 
-        histos2D[chan][name]["m_vs_pt"] = bookHisto(chan + "_" + name + "_m_vs_pt", name,
-                ptlab, 25, 0, 2000*GeV,
-                mlab, 25, 0, 1000*GeV);
-    }
+    return;
+}
+
+
+void MC_BOOSTEDHBB::bookCube(HistoSet& hs, cubeObs obs, FastHisto1D& h) {
+    const HistoSpec& spec = cubeSpecs[obs];
+
+    ScopedTimer t(hs.stageTimers, TIME_BOOKING);
+    h.book(hs.nweights, spec.nxbins, spec.xmin, spec.xmax);
 
     return;
 }
 
 
-void MC_BOOSTEDHBB::bookFourMomPair(const string& name) {
-    // pairs of particles also are "particles"
-    bookFourMom(name);
+void MC_BOOSTEDHBB::fillCube(const EventState& st, HistoSet& hs) {
+    if (hs.cube.empty()) return;
 
-    foreach (const string& chan, channels) {
-        // extra histograms for pairs of particles
-        histos1D[chan][name]["dr"] = bookHisto(chan + "_" + name + "_dr", drlab, "", 50, 0, 2);
+    ScopedTimer t(st.stageTimers, TIME_FILLS);
 
-        histos2D[chan][name]["dr_vs_ptTotal"] = bookHisto(chan + "_" + name + "_dr_vs_ptTotal", name,
-                ptlab, 25, 0, 2000*GeV,
-                drlab, 25, 0, 5);
-        histos2D[chan][name]["dr_vs_ptBHad"] = bookHisto(chan + "_" + name + "_dr_vs_ptBHad", name,
-                ptlab, 25, 0, 2000*GeV,
-                drlab, 25, 0, 5);
-        histos2D[chan][name]["dr_vs_ptTrackJet"] = bookHisto(chan + "_" + name + "_dr_vs_ptTrackJet", name,
-                ptlab, 25, 0, 2000*GeV,
-                drlab, 25, 0, 5);
-        histos2D[chan][name]["pt1_vs_pt2"] = bookHisto(chan + "_" + name + "_pt1_vs_pt2", name,
-                ptlab, 25, 0, 2000*GeV,
-                ptlab, 25, 0, 2000*GeV);
+    // the lepton channels are lepton multiplicities
+    const size_t nleptons[LEPCHANSLEN] = { 2, 1, 0 };
 
-        // pt balance
-        histos1D[chan][name]["pt1_minus_pt2"] = bookHisto(chan + "_" + name + "_pt1_minus_pt2", name,
-                ptlab, 25, -1000*GeV, 1000*GeV);
-    }
+    size_t bins[CUBEAXESLEN];
+    bins[CUBE_NLEP] = cube.bin(CUBE_NLEP, nleptons[st.lepchan]);
+    bins[CUBE_NTRACKJET] = cube.bin(CUBE_NTRACKJET, st.trackJets.size());
+    bins[CUBE_NBTAG] = cube.bin(CUBE_NBTAG, st.btagCols.size());
+    bins[CUBE_MET] = cube.bin(CUBE_MET, st.met);
+    bins[CUBE_VPT] = cube.bin(CUBE_VPT, st.vboson.pT());
+    const size_t category = cube.category(bins);
+
+    const FourMomentum& higgs = st.boostedhiggs.mom();
+    hs.fillCube(category, CUBE_HIGGSM, higgs.mass(), st.weights);
+    hs.fillCube(category, CUBE_HIGGSPT, higgs.pT(), st.weights);
+    hs.fillCube(category, CUBE_VHM, (st.vboson.mom() + higgs).mass(), st.weights);
 
     return;
 }
 
 
-void MC_BOOSTEDHBB::bookFourMomComp(const string& name) {
+void MC_BOOSTEDHBB::flushHistos() {
+    size_t ndeclared = 0;
+    size_t nfilled = 0;
 
-    foreach (const string& chan, channels) {
-        histos1D[chan][name]["dr"] = bookHisto(chan + "_" + name + "_dr", drlab, name, 25, 0, 0.5);
+    foreach (HistoSet& hs, histos) {
+        hs.histos1D.assign(hs.nweights*hs.size1D, Histo1DPtr());
+        hs.histos2D.assign(hs.nweights*hs.size2D, Histo2DPtr());
 
-        histos1D[chan][name]["pt1_minus_pt2"] = bookHisto(chan + "_" + name + "_pt1_minus_pt2", name,
-                ptlab, 25, -100*GeV, 100*GeV);
+        for (size_t iHisto = 0; iHisto < hs.size1D; ++iHisto) {
+            const HistoSpec& spec = specs1D[iHisto];
+            if (spec.name.empty()) continue;
 
-        histos1D[chan][name]["pt1_by_pt2"] = bookHisto(chan + "_" + name + "_pt1_by_pt2", name,
-                "$p_{T,1}/p_{T,2}$" , 25, 0, 3);
+            const FastHisto1D& fh = hs.fast1D[iHisto];
+            ndeclared += hs.nweights;
+            if (fh.booked()) nfilled += hs.nweights;
+            else if (sparseOutput) continue;
 
-        histos2D[chan][name]["dr_vs_dpt"] = bookHisto(chan + "_" + name + "_dr_vs_dpt", name,
-                ptlab, 25, -100*GeV, 100*GeV,
-                drlab, 25, 0, 0.5);
+            for (size_t iw = 0; iw < hs.nweights; ++iw) {
+                Histo1DPtr& h = hs.histos1D[iw*hs.size1D + iHisto];
+                h = bookHisto(hs.prefix + spec.name + variationSuffix(iw), spec.title,
+                        spec.xlabel, spec.nxbins, spec.xmin, spec.xmax);
+                if (fh.booked()) fh.flush(iw, *h);
+            }
+        }
 
-        histos2D[chan][name]["pt1_vs_pt2"] = bookHisto(chan + "_" + name + "_pt1_vs_pt2", name,
-                ptlab, 25, 0, 2000*GeV,
-                ptlab, 25, 0, 2000*GeV);
+        for (size_t iHisto = 0; iHisto < hs.size2D; ++iHisto) {
+            const HistoSpec& spec = specs2D[iHisto];
+            if (spec.name.empty()) continue;
+
+            const FastHisto2D& fh = hs.fast2D[iHisto];
+            ndeclared += hs.nweights;
+            if (fh.booked()) nfilled += hs.nweights;
+            else if (sparseOutput) continue;
+
+            for (size_t iw = 0; iw < hs.nweights; ++iw) {
+                Histo2DPtr& h = hs.histos2D[iw*hs.size2D + iHisto];
+                h = bookHisto(hs.prefix + spec.name + variationSuffix(iw), spec.title,
+                        spec.xlabel, spec.nxbins, spec.xmin, spec.xmax,
+                        spec.ylabel, spec.nybins, spec.ymin, spec.ymax);
+                if (fh.booked()) fh.flush(iw, *h);
+            }
+        }
     }
 
-    return;
-}
+    // only the filled categories of the cube
+    size_t ncategories = 0;
+    foreach (HistoSet& hs, histos) {
+        hs.cubeHistos.assign(hs.nweights*hs.cube.size(), Histo1DPtr());
 
+        for (size_t iSlot = 0; iSlot < hs.cube.size(); ++iSlot) {
+            const FastHisto1D& fh = hs.cube[iSlot];
+            if (!fh.booked()) continue;
 
-void MC_BOOSTEDHBB::bookFourMomColl(const string& name) {
-    bookFourMom(name);
+            const size_t category = iSlot/CUBEOBSLEN;
+            const HistoSpec& spec = cubeSpecs[iSlot%CUBEOBSLEN];
+            if (iSlot%CUBEOBSLEN == 0) ++ncategories;
 
-    // bookFourMom(name + "0");
-    // bookFourMom(name + "1");
+            for (size_t iw = 0; iw < hs.nweights; ++iw) {
+                Histo1DPtr& h = hs.cubeHistos[iw*hs.cube.size() + iSlot];
+                h = bookHisto(hs.prefix + "cube_" + cube.label(category) + "_" + spec.name + variationSuffix(iw),
+                        cube.title(category), spec.xlabel, spec.nxbins, spec.xmin, spec.xmax);
+                fh.flush(iw, *h);
+            }
+        }
+    }
+    if (cube.numAxes())
+        MSG_INFO(ncategories << " categories of the cube filled.");
 
-    foreach (const string& chan, channels)
-        histos1D[chan][name]["n"] = bookHisto(chan + "_" + name + "_n", "multiplicity", "", 10, 0, 10);
+    if (sparseOutput)
+        MSG_INFO("Writing only the " << nfilled << " filled histograms of " << ndeclared << ".");
+    else
+        MSG_INFO(nfilled << " of " << ndeclared << " histograms filled, the others are written empty.");
 
     return;
 }
 
 
-void MC_BOOSTEDHBB::fillFourMom(const string& channel, const string& name, const FourMomentum& p, double weight) {
-    MSG_DEBUG("Filling " << name << " histograms");
-
-    histos1D[channel][name]["pt"]->fill(p.pT(), weight);
-    histos1D[channel][name]["eta"]->fill(p.eta(), weight);
-    histos1D[channel][name]["m"]->fill(p.mass(), weight);
-    histos2D[channel][name]["m_vs_pt"]->fill(p.pT(), p.mass(), weight);
+void MC_BOOSTEDHBB::HistoSet::replay(const vector<FillRecord>& fills, const vector<double>& weights) {
+    foreach (const FillRecord& f, fills) {
+        switch (f.kind) {
+            case FillRecord::FILL1D:
+                at1D(f.slot).fill(f.x, weights);
+                break;
+            case FillRecord::FILL1DUNIT:
+                at1D(f.slot).fill(f.x);
+                break;
+            case FillRecord::FILL2D:
+                at2D(f.slot).fill(f.x, f.y, weights);
+                break;
+            case FillRecord::FILL2DUNIT:
+                at2D(f.slot).fill(f.x, f.y);
+                break;
+            case FillRecord::FILLCUBE: {
+                FastHisto1D& h = cube[f.slot];
+                if (!h.booked()) analysis->bookCube(*this, cubeObs(f.slot%CUBEOBSLEN), h);
+                h.fill(f.x, weights);
+                break;
+            }
+            case FillRecord::FILLCUTFLOW:
+                for (size_t iw = 0; iw < nweights; ++iw)
+                    cutflow[iw]->fill(int(f.slot), weights[iw]);
+                break;
+        }
+    }
 
     return;
 }
 
 
-void MC_BOOSTEDHBB::fillFourMomPair(const string& channel, const string& name, const FourMomentum& p1, const FourMomentum& p2, double weight) {
-    fillFourMom(channel, name, p1 + p2, weight);
-
-    double dr = Rivet::deltaR(p1, p2);
-    double pt = (p1 + p2).pT();
+void MC_BOOSTEDHBB::emptyCopy(const HistoSet& hs, HistoSet& copy, StageTimers* timers) {
+    copy.nchannels = hs.nchannels;
+    copy.nweights = hs.nweights;
+    copy.size1D = hs.size1D;
+    copy.size2D = hs.size2D;
+    copy.prefix = hs.prefix;
+    copy.analysis = this;
+    copy.stageTimers = timers;
+
+    copy.cutflow.clear();
+    foreach (const Histo1DPtr& h, hs.cutflow) {
+        Histo1DPtr c(h->newclone());
+        c->reset();
+        copy.cutflow.push_back(c);
+    }
 
-    histos1D[channel][name]["dr"]->fill(dr, weight);
-    histos2D[channel][name]["dr_vs_ptTotal"]->fill(pt, dr);
-    histos2D[channel][name]["dr_vs_ptBHad"]->fill(p1.pT(), dr);
-    histos2D[channel][name]["dr_vs_ptTrackJet"]->fill(p2.pT(), dr);
-    histos2D[channel][name]["pt1_vs_pt2"]->fill(p2.pT(), p1.pT());
-    histos1D[channel][name]["pt1_minus_pt2"]->fill(p1.pT() - p2.pT());
+    copy.fast1D.assign(hs.fast1D.size(), FastHisto1D());
+    copy.fast2D.assign(hs.fast2D.size(), FastHisto2D());
+    copy.cube.assign(hs.cube.size(), FastHisto1D());
 
     return;
 }
 
 
-void MC_BOOSTEDHBB::fillFourMomComp(const string& channel, const string& name, const FourMomentum& p1, const FourMomentum& p2, double weight) {
+void MC_BOOSTEDHBB::fillFourMom(HistoSet& hs, size_t chan, size_t coll, const FourMomentum& p, const vector<double>& weights) {
+    MSG_DEBUG("Filling " << collections[coll] << " histograms");
 
-    double dr = Rivet::deltaR(p1, p2);
+    const double pt = p.pT();
+    const double m = p.mass();
 
-    histos1D[channel][name]["dr"]->fill(dr, weight);
-    histos1D[channel][name]["pt1_minus_pt2"]->fill(p1.pT() - p2.pT());
-    histos1D[channel][name]["pt1_by_pt2"]->fill(p1.pT() / p2.pT());
-    histos2D[channel][name]["dr_vs_dpt"]->fill(p1.pT() - p2.pT(), dr, weight);
-    histos2D[channel][name]["pt1_vs_pt2"]->fill(p2.pT(), p1.pT());
+    hs.fill1D(chan, coll, OBS_PT, pt, weights);
+    hs.fill1D(chan, coll, OBS_ETA, p.eta(), weights);
+    hs.fill1D(chan, coll, OBS_M, m, weights);
+    hs.fill2D(chan, coll, OBS_M_VS_PT, pt, m, weights);
 
     return;
 }
 
 
-template <class T>
-void MC_BOOSTEDHBB::fillFourMomColl(const string& channel, const string& name, const vector<T>& ps, double weight) {
+void MC_BOOSTEDHBB::fillFourMomPair(HistoSet& hs, size_t chan, size_t coll, const FourMomentum& p1, const FourMomentum& p2, const vector<double>& weights) {
+    const FourMomentum p = p1 + p2;
+    fillFourMom(hs, chan, coll, p, weights);
 
-    MSG_DEBUG("Filling " << ps.size() << " members of collection " << name);
-    histos1D[channel][name]["n"]->fill(ps.size(), weight);
+    double dr = Rivet::deltaR(p1, p2);
+    double pt = p.pT();
+    double pt1 = p1.pT();
+    double pt2 = p2.pT();
+
+    hs.fill1D(chan, coll, OBS_DR, dr, weights);
+    hs.fill2D(chan, coll, OBS_DR_VS_PTTOTAL, pt, dr);
+    hs.fill2D(chan, coll, OBS_DR_VS_PTBHAD, pt1, dr);
+    hs.fill2D(chan, coll, OBS_DR_VS_PTTRACKJET, pt2, dr);
+    hs.fill2D(chan, coll, OBS_PT1_VS_PT2, pt2, pt1);
+    hs.fill1D(chan, coll, OBS_PT1_MINUS_PT2, pt1 - pt2);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::fillFourMomJet(HistoSet& hs, size_t chan, size_t coll, const FourMomentum& p, const JetSubstructure& sub, const vector<double>& weights) {
+    fillFourMom(hs, chan, coll, p, weights);
+
+    hs.fill1D(chan, coll, OBS_TAU21, sub.tau21(), weights);
+    hs.fill1D(chan, coll, OBS_TRIMMEDM, sub.trimmedMass(), weights);
+
+    // no mass drop, no filtered jet
+    if (sub.filteredMass() > 0)
+        hs.fill1D(chan, coll, OBS_FILTEREDM, sub.filteredMass(), weights);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::fillSmallRDijets(HistoSet& hs, size_t chan, const vector<FourMomentum>& jets, const vector<double>& weights) {
+    for (size_t iR = 0; iR < smallRDijetColls.size() && 2*iR + 1 < jets.size(); ++iR) {
+        // fewer than two jets
+        if (jets[2*iR + 1].E() <= 0) continue;
+
+        fillFourMomPair(hs, chan, smallRDijetColls[iR], jets[2*iR], jets[2*iR + 1], weights);
+    }
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::fillFourMomComp(HistoSet& hs, size_t chan, size_t coll, const FourMomentum& p1, const FourMomentum& p2, const vector<double>& weights) {
+
+    double dr = Rivet::deltaR(p1, p2);
+    double pt1 = p1.pT();
+    double pt2 = p2.pT();
+
+    hs.fill1D(chan, coll, OBS_DR, dr, weights);
+    hs.fill1D(chan, coll, OBS_PT1_MINUS_PT2, pt1 - pt2);
+    hs.fill1D(chan, coll, OBS_PT1_BY_PT2, pt1 / pt2);
+    hs.fill2D(chan, coll, OBS_DR_VS_DPT, pt1 - pt2, dr, weights);
+    hs.fill2D(chan, coll, OBS_PT1_VS_PT2, pt2, pt1);
+
+    return;
+}
+
+
+template <class T>
+void MC_BOOSTEDHBB::fillFourMomColl(HistoSet& hs, size_t chan, size_t coll, const vector<T>& ps, const vector<double>& weights) {
+
+    MSG_DEBUG("Filling " << ps.size() << " members of collection " << collections[coll]);
+    hs.fill1D(chan, coll, OBS_N, ps.size(), weights);
 
     foreach (const T& p, ps)
-        fillFourMom(channel, name, p.mom(), weight);
+        fillFourMom(hs, chan, coll, p.mom(), weights);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::startEvents(size_t nweights) {
+    bookVariations(nweights);
+    sumW.assign(nweights, 0);
+
+    if (stitchSlices) {
+        sliceSumW.assign(nweights, 0);
+        stitched.resize(histos.size());
+        for (size_t iSel = 0; iSel < histos.size(); ++iSel)
+            emptyCopy(histos[iSel], stitched[iSel], stageTimers);
+    }
+
+    if (!skimOutput.empty()) {
+        MSG_INFO("Writing events reaching the track jet stage to skim " << skimOutput);
+        skimWriter = new SkimWriter(skimOutput, nweights);
+    }
+
+    if (nthreads) startWorkers();
+
+    if (resumeEvents) restoreCheckpoint();
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::bookVariations(size_t nweights) {
+    if (nweights <= 1) return;
+
+    MSG_INFO("Histograms for " << nweights - 1 << " weight variations.");
+
+    foreach (HistoSet& hs, histos) {
+        hs.nweights = nweights;
+        hs.cutflow.resize(nweights);
+
+        // the histograms themselves are booked on their first fill
+        for (size_t iw = 1; iw < nweights; ++iw)
+            hs.cutflow[iw] = bookVariation(hs.cutflow[0], variationSuffix(iw));
+    }
+
+    return;
+}
+
+
+template <class PTR>
+PTR MC_BOOSTEDHBB::bookVariation(const PTR& nominal, const string& suffix) {
+    if (!nominal) return PTR();
+
+    PTR h(nominal->newclone());
+    h->reset();
+    h->setPath(nominal->path() + suffix);
+    addAnalysisObject(h);
+
+    return h;
+}
+
+
+void MC_BOOSTEDHBB::eventWeights(const Event& event, vector<double>& ws) {
+    const size_t nweights = histos[0].nweights;
+    ws.resize(nweights);
+    ws[0] = event.weight();
+    if (nweights == 1) return;
+
+    const HepMC::WeightContainer& genWeights = event.genEvent()->weights();
+    if (genWeights.size() < nweights)
+        throw Exception("MC_BOOSTEDHBB: event with fewer weights than the first one");
+
+    for (size_t iw = 1; iw < nweights; ++iw)
+        ws[iw] = genWeights[iw];
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::writeSums() {
+    MSG_INFO("Leaving the histograms unnormalised, sum of weights " << sumW[0]
+            << ", cross section " << crossSection() << " pb.");
+
+    for (size_t iw = 0; iw < sumW.size(); ++iw)
+        bookCounter("sumW" + variationSuffix(iw), "sum of weights")->fill(sumW[iw]);
+    bookCounter("crossSection", "cross section / pb")->fill(crossSection());
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::nextSlice(const Event& event) {
+    const GenEvent* ge = event.genEvent();
+    if (!sliceSizes.empty()) {
+        if (sliceEvents == sliceSizes[nslices])
+            endSlice();
+        if (nslices == sliceSizes.size())
+            throw Exception("MC_BOOSTEDHBB: there are more events than the slices in MC_BOOSTEDHBB_SLICEEVENTS hold");
+    } else if (sliceEvents && ge->event_number() <= lastEventNumber) {
+        // generators number the events of a file from 0 or 1. anywhere
+        // else the numbering of one file may just not increase.
+        if (ge->event_number() != 0 && ge->event_number() != 1)
+            MSG_WARNING("Slice " << nslices + 1 << " starts at event number " << ge->event_number()
+                    << ", after " << lastEventNumber << ". If that is not the start of a file, "
+                    "give the events of every slice in MC_BOOSTEDHBB_SLICEEVENTS.");
+        endSlice();
+    }
+    lastEventNumber = ge->event_number();
+
+    // the cross section of the slice is that of its last event, as
+    // crossSection() is for a whole run
+    if (ge->cross_section())
+        sliceXsec = ge->cross_section()->cross_section();
+
+    ++sliceEvents;
+    for (size_t iw = 0; iw < sliceSumW.size(); ++iw)
+        sliceSumW[iw] += weights[iw];
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::endSlice() {
+    if (!sliceEvents) return;
+
+    if (!(sliceXsec > 0)) {
+        std::ostringstream msg;
+        msg << "MC_BOOSTEDHBB: slice " << nslices << " has no cross section";
+        throw Exception(msg.str());
+    }
+
+    // normalize to 1/fb, as finalize() would the slice alone
+    vector<double> norms;
+    foreach (double sw, sliceSumW)
+        norms.push_back(1000*sliceXsec/sw);
+
+    MSG_INFO("Slice " << nslices << ": " << sliceEvents << " events, sum of weights "
+            << sliceSumW[0] << ", cross section " << sliceXsec << " pb.");
+
+    for (size_t iSel = 0; iSel < histos.size(); ++iSel) {
+        HistoSet& hs = histos[iSel];
+        HistoSet& st = stitched[iSel];
+
+        for (size_t iw = 0; iw < hs.nweights; ++iw) {
+            YODA::Histo1D cutflow(*hs.cutflow[iw]);
+            cutflow.scaleW(norms[iw]);
+            *st.cutflow[iw] += cutflow;
+            hs.cutflow[iw]->reset();
+        }
+
+        // histograms the slice never filled stay empty in the stitched set
+        for (size_t iHisto = 0; iHisto < hs.fast1D.size(); ++iHisto) {
+            FastHisto1D& h = hs.fast1D[iHisto];
+            if (!h.booked()) continue;
+            st.at1D(iHisto).addScaled(h, norms);
+            h.reset();
+        }
+        for (size_t iHisto = 0; iHisto < hs.fast2D.size(); ++iHisto) {
+            FastHisto2D& h = hs.fast2D[iHisto];
+            if (!h.booked()) continue;
+            st.at2D(iHisto).addScaled(h, norms);
+            h.reset();
+        }
+        for (size_t iSlot = 0; iSlot < hs.cube.size(); ++iSlot) {
+            FastHisto1D& h = hs.cube[iSlot];
+            if (!h.booked()) continue;
+            if (!st.cube[iSlot].booked()) bookCube(st, cubeObs(iSlot%CUBEOBSLEN), st.cube[iSlot]);
+            st.cube[iSlot].addScaled(h, norms);
+            h.reset();
+        }
+    }
+
+    ++nslices;
+    sliceEvents = 0;
+    sliceSumW.assign(sliceSumW.size(), 0);
+    sliceXsec = 0;
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::finishSlices() {
+    if (!sliceSizes.empty() && (nslices + 1 < sliceSizes.size() || sliceEvents < sliceSizes[nslices]))
+        MSG_WARNING("The run ended after " << sliceEvents << " events of slice " << nslices << ", "
+                << sliceSizes.size() << " slices were listed in MC_BOOSTEDHBB_SLICEEVENTS.");
+    endSlice();
+
+    // the booked sets take the contents of the stitched ones, which are
+    // booked where any slice filled
+    for (size_t iSel = 0; iSel < stitched.size(); ++iSel) {
+        HistoSet& hs = histos[iSel];
+        HistoSet& st = stitched[iSel];
+
+        for (size_t iw = 0; iw < hs.nweights; ++iw) {
+            hs.cutflow[iw]->reset();
+            *hs.cutflow[iw] += *st.cutflow[iw];
+        }
+        hs.fast1D.swap(st.fast1D);
+        hs.fast2D.swap(st.fast2D);
+        hs.cube.swap(st.cube);
+    }
+
+    MSG_INFO(nslices << " slices stitched.");
+
+    return;
+}
+
+
+const JetSubstructure& MC_BOOSTEDHBB::substructure(EventState& st) {
+    if (!st.substructure->computed()) {
+        ScopedTimer t(st.stageTimers, TIME_SUBSTRUCTURE);
+        st.substructure->compute();
+    }
+
+    return *st.substructure;
+}
+
+
+const vector<FourMomentum>& MC_BOOSTEDHBB::leadingSmallRJets(EventState& st) {
+    if (st.smallRJetsDone) return st.smallRJets;
+
+    ScopedTimer t(st.stageTimers, TIME_SMALLRJETS);
+    st.smallRJets.clear();
+    for (size_t iR = 0; iR < st.jets->numSmallR(); ++iR) {
+        const Jets js = st.jets->smallRJets(iR, SMALLJETPT);
+        st.smallRJets.push_back(js.size() > 0 ? js[0].mom() : FourMomentum());
+        st.smallRJets.push_back(js.size() > 1 ? js[1].mom() : FourMomentum());
+    }
+    st.smallRJetsDone = true;
+
+    return st.smallRJets;
+}
+
+
+void MC_BOOSTEDHBB::trackJetCuts(EventState& st, bool hasCaloJet) {
+    const vector<size_t>& btagCols = st.btagCols;
+    const vector<FourMomentum>& trackJets = st.trackJets;
+    const Particle& boostedhiggs = st.boostedhiggs;
+
+		st.cutBits[ONEBTAGGEDTRACKJET] = btagCols.size() == 1; //Now look for low energy single 25 GeV jet in the tracker with VariableR. Which is b tagged.
+		st.cutBits[TWOBTAGGEDTRACKJET] = btagCols.size() == 2; //Same again but 2 tracks this time both b tagged.
+
+		//Can we connect calo jet with track jets? If they are within a certain cut then we say we have associated the two different types of jet. Otherwise we assume they are different.
+		//DeltaR is the difference in pseudo rapidity and azimuthal angle between them. 
+    // all track jets have to lie within the AKT10 jet radius.
+    if (!hasCaloJet) {
+        st.cutBits[ALLTRACKJETSCONNECTEDTOCALOJET] = false;
+        return;
+    }
+    st.trackJetGrid.fill(trackJets);
+    st.cutBits[ALLTRACKJETSCONNECTEDTOCALOJET] =
+        st.trackJetGrid.countWithin(boostedhiggs.eta(), boostedhiggs.phi(), CALOJETR) == trackJets.size();
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::bTagged(EventState& st) {
+    st.btagCols.clear();
+    if (st.bhads.empty() || st.trackJets.empty()) return;
+
+    // like the ghost association, every b hadron goes into one jet at
+    // most: the nearest one that has it within its radius
+    st.tagJetGrid.fill(st.trackJets);
+    st.jetTagged.assign(st.trackJets.size(), false);
+    foreach (const Particle& bhad, st.bhads) {
+        const double eta = bhad.eta();
+        const double phi = bhad.phi();
+
+        st.nearJets.clear();
+        st.tagJetGrid.within(eta, phi, VRRMAX, st.nearJets);
+
+        int nearest = -1;
+        double nearestdr = VRRMAX;
+        foreach (size_t iJet, st.nearJets) {
+            const FourMomentum& tj = st.trackJets[iJet];
+            const double dr = deltaR(eta, phi, tj.eta(), tj.phi());
+            if (dr < vrRadius(tj.pT()) && dr < nearestdr) {
+                nearest = iJet;
+                nearestdr = dr;
+            }
+        }
+        if (nearest >= 0) st.jetTagged[nearest] = true;
+    }
+
+    for (size_t iJet = 0; iJet < st.trackJets.size(); ++iJet)
+        if (st.jetTagged[iJet]) st.btagCols.push_back(iJet);
+
+    return;
+}
+
+
+/// @name Multi-threaded mode
+//@{
+
+/// Jet inputs and selection state of an event waiting for a worker.
+struct MC_BOOSTEDHBB::PendingEvent {
+    vector<double> weights;
+    Particles bhads;
+
+    /// failed the calo jet bound of the pre-filter, when validating it
+    bool noCaloJet;
+
+    /// missing pT
+    double met;
+
+    // per selection
+    vector<bool> passed;
+    vector<CutMask> cutBits;
+    vector<lepchans> lepchan;
+    Particles vbosons;
+
+    ParticleBuffer caloParts;
+    ParticleBuffer trackParts;
+
+    /// the fills of the worker per selection, and whether it is done
+    vector<vector<FillRecord> > fills;
+    bool finished;
+};
+
+
+/// A worker thread with its own jet clustering and selection state. The
+/// events that reach the jet stage are handed out round robin in the order
+/// they get there. The worker fills nothing itself: its HistoSets record
+/// the fills in the PendingEvent, for analyze() to replay in dispatch
+/// order.
+class MC_BOOSTEDHBB::Worker {
+    public:
+        Worker(MC_BOOSTEDHBB& analysis, const MultiRadiusJets& jets)
+            : nEvents(0),
+                busy(0),
+                prefilterMissed(0),
+                timers(0),
+                analysis(analysis),
+                jets(jets),
+                done(false),
+                first(0),
+                queued(0) {
+
+                if (analysis.stageTimers)
+                    timers = new StageTimers(TIMERSLEN);
+
+                // one recording HistoSet per selection
+                shards.resize(analysis.histos.size());
+                states.resize(analysis.histos.size());
+                for (size_t iSel = 0; iSel < shards.size(); ++iSel) {
+                    analysis.emptyCopy(analysis.histos[iSel], shards[iSel], timers);
+
+                    states[iSel].stageTimers = timers;
+                    states[iSel].substructure = &substructure;
+                    states[iSel].jets = &this->jets;
+                }
+
+                thread = std::thread(&Worker::run, this);
+
+                return;
+            }
+
+        ~Worker() {
+            finish();
+            delete timers;
+
+            return;
+        }
+
+        /// queue an event, blocking while the queue is full. takes ownership.
+        void push(PendingEvent* ev) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return queued < MAXQUEUE; });
+            queue[(first + queued) % MAXQUEUE] = ev;
+            ++queued;
+            cond.notify_all();
+
+            return;
+        }
+
+        /// process everything still queued and stop the thread.
+        void finish() {
+            if (!thread.joinable()) return;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            cond.notify_all();
+            thread.join();
+
+            return;
+        }
+
+        vector<HistoSet> shards;
+        vector<EventState> states;
+
+        unsigned long nEvents;
+        double busy;
+
+        /// events passing the calo jet stage that failed its pre-filter
+        /// bound
+        unsigned long prefilterMissed;
+
+        /// null without instrumentation
+        StageTimers* timers;
+
+    private:
+        static const size_t MAXQUEUE = 64;
+
+        void run() {
+            for (;;) {
+                PendingEvent* ev;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [this] { return done || queued; });
+                    if (!queued) return;
+
+                    ev = queue[first];
+                    first = (first + 1) % MAXQUEUE;
+                    --queued;
+                }
+                cond.notify_all();
+
+                const double start = wallTime();
+                process(*ev);
+                busy += wallTime() - start;
+                ++nEvents;
+
+                analysis.markFinished(ev);
+            }
+        }
+
+        void process(PendingEvent& ev) {
+            for (size_t iSel = 0; iSel < states.size(); ++iSel) {
+                shards[iSel].fillLog = &ev.fills[iSel];
+
+                EventState& st = states[iSel];
+                st.reset();
+                st.passed = ev.passed[iSel];
+                if (!st.passed) continue;
+
+                st.weights = ev.weights;
+                st.cutBits = ev.cutBits[iSel];
+                st.lepchan = ev.lepchan[iSel];
+                st.met = ev.met;
+                st.vboson = ev.vbosons[iSel];
+                st.bhads = ev.bhads;
+            }
+
+            StageLaps laps(timers, TIME_WORKER, TIME_CALOJETSTAGE);
+            jets.setInputs(ev.caloParts, ev.trackParts);
+
+            Jets caloJets;
+            {
+                ScopedTimer t(timers, TIME_CALOJETS);
+                caloJets = jets.caloJets(analysis.loosestCaloJetPt);
+            }
+            if (!analysis.selectCaloJets(caloJets, states))
+                return;
+            if (ev.noCaloJet) ++prefilterMissed;
+            substructure.setJets(jets.caloClustering());
+
+            laps.next(TIME_TRACKJETSTAGE);
+            Jets trackJets;
+            {
+                ScopedTimer t(timers, TIME_TRACKJETS);
+                trackJets = jets.trackJets(analysis.loosestTrackJetPt);
+            }
+            analysis.selectTrackJets(trackJets, states, shards);
+
+            return;
+        }
+
+        MC_BOOSTEDHBB& analysis;
+        MultiRadiusJets jets;
+        JetSubstructure substructure;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool done;
+
+        /// ring buffer of queued events
+        PendingEvent* queue[MAXQUEUE];
+        size_t first;
+        size_t queued;
+};
+
+
+MC_BOOSTEDHBB::~MC_BOOSTEDHBB() {
+    stopWorkers();
+
+    foreach (Worker* w, workers)
+        delete w;
+    foreach (PendingEvent* ev, inFlight)
+        delete ev;
+    foreach (PendingEvent* ev, freeEvents)
+        delete ev;
+
+    // without a footer if finalize() never ran
+    delete skimWriter;
+    delete cutMaskWriter;
+
+    // the file stays for a restart
+    delete checkpointWriter;
+
+    delete stageTimers;
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::startWorkers() {
+    MSG_INFO("Running the jet stages on " << nthreads << " worker threads.");
+
+    // print the fastjet banner here rather than racing for it in the workers
+    fastjet::ClusterSequence::print_banner();
+
+    for (size_t iWorker = 0; iWorker < nthreads; ++iWorker)
+        workers.push_back(new Worker(*this, getProjection<MultiRadiusJets>("MultiRadiusJets")));
+
+    wallStart = wallTime();
 
     return;
 }
 
 
-Jets MC_BOOSTEDHBB::bTagged(const Jets& js) {
-    Jets bjs;
-    foreach(const Jet& j, js)
-        // TODO
-        // update for new rivet version
-        if (j.bTags().size()) bjs.push_back(j);
+void MC_BOOSTEDHBB::dispatch(const ParticlePartitioner& parts) {
+    PendingEvent* ev = newPendingEvent();
+    ev->weights = weights;
+    ev->noCaloJet = prefilterFailed & (1u << EventPreFilter::CALOJET);
+    ev->met = states[0].met;
+
+    // assigned in place, so a reused event keeps its capacity
+    const size_t nsel = states.size();
+    ev->passed.resize(nsel);
+    ev->cutBits.resize(nsel);
+    ev->lepchan.resize(nsel);
+    ev->vbosons.resize(nsel);
+    ev->bhads.clear();
+    for (size_t iSel = 0; iSel < nsel; ++iSel) {
+        const EventState& st = states[iSel];
+        ev->passed[iSel] = st.passed;
+        ev->cutBits[iSel] = st.cutBits;
+        ev->lepchan[iSel] = st.lepchan;
+        ev->vbosons[iSel] = Particle(st.vboson.pid(), st.vboson.momentum());
+        if (st.passed && ev->bhads.empty())
+            detachParticles(st.bhads, ev->bhads);
+    }
+
+    ev->caloParts = parts.calo();
+    ev->trackParts = parts.track();
+
+    ev->fills.resize(nsel);
+    foreach (vector<FillRecord>& fills, ev->fills)
+        fills.clear();
+    ev->finished = false;
 
-    return bjs;
+    inFlight.push_back(ev);
+    workers[nDispatched % workers.size()]->push(ev);
+    ++nDispatched;
+
+    replayFinished(false);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::markFinished(PendingEvent* ev) {
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        ev->finished = true;
+    }
+    finishedCond.notify_all();
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::replayFinished(bool wait) {
+    while (!inFlight.empty()) {
+        PendingEvent* ev = inFlight.front();
+        {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            if (wait)
+                finishedCond.wait(lock, [ev] { return ev->finished; });
+            else if (!ev->finished)
+                return;
+        }
+        inFlight.pop_front();
+
+        {
+            ScopedTimer t(stageTimers, TIME_FILLS);
+            for (size_t iSel = 0; iSel < histos.size(); ++iSel)
+                histos[iSel].replay(ev->fills[iSel], ev->weights);
+        }
+        recycle(ev);
+    }
+
+    return;
+}
+
+
+MC_BOOSTEDHBB::PendingEvent* MC_BOOSTEDHBB::newPendingEvent() {
+    {
+        std::lock_guard<std::mutex> lock(freeEventsMutex);
+        if (!freeEvents.empty()) {
+            PendingEvent* ev = freeEvents.back();
+            freeEvents.pop_back();
+            return ev;
+        }
+    }
+
+    return new PendingEvent;
+}
+
+
+void MC_BOOSTEDHBB::recycle(PendingEvent* ev) {
+    std::lock_guard<std::mutex> lock(freeEventsMutex);
+    freeEvents.push_back(ev);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::stopWorkers() {
+    foreach (Worker* w, workers)
+        w->finish();
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::mergeWorkers() {
+    const double wall = wallTime() - wallStart;
+
+    MSG_INFO(nDispatched << " events passed to " << workers.size()
+            << " worker threads in " << wall << " s:");
+
+    // the fills are replayed already, only the counts are left
+    for (size_t iWorker = 0; iWorker < workers.size(); ++iWorker) {
+        Worker& w = *workers[iWorker];
+
+        for (size_t iSel = 0; iSel < histos.size(); ++iSel)
+            for (unsigned int iStage = CALOJETSTAGE; iStage < STAGESLEN; ++iStage)
+                states[iSel].stageCounts[iStage] += w.states[iSel].stageCounts[iStage];
+
+        prefilterMissed[EventPreFilter::CALOJET] += w.prefilterMissed;
+        if (stageTimers) stageTimers->merge(*w.timers);
+
+        MSG_INFO("    worker " << iWorker << ": " << w.nEvents << " events, "
+                << w.busy << " s busy ("
+                << (wall > 0 ? 100*w.busy/wall : 0) << "%)");
+    }
+
+    return;
+}
+
+//@}
+
+
+/// @name Instrumentation
+//@{
+
+Log& MC_BOOSTEDHBB::getLog() const {
+    if (!logger) logger = &Analysis::getLog();
+    return *logger;
+}
+
+
+uint64_t MC_BOOSTEDHBB::externalAllocs() const {
+    const vector<uint64_t>& allocs = stageTimers->allocs;
+
+    uint64_t n = allocs[TIME_SUBSTRUCTURE] + allocs[TIME_BOOKING] + allocs[TIME_CHECKPOINT];
+    for (unsigned int iTimer = TIME_PARTITIONER; iTimer <= TIME_SMALLRJETS; ++iTimer)
+        n += allocs[iTimer];
+
+    return n;
+}
+
+
+void MC_BOOSTEDHBB::writeAllocations() {
+    const unsigned long nevents = stageTimers->calls[TIME_EVENT];
+
+    MSG_INFO("Heap allocations in analyze() outside the projections, jet clusterings and substructure tools:");
+    MSG_INFO("    first event:  " << ownAllocsFirst);
+    if (nevents > 1) {
+        MSG_INFO("    later events: " << ownAllocsLater << " in " << allocatingEvents << " of " << nevents - 1
+                << " events (" << double(ownAllocsLater)/(nevents - 1) << " per event, at most "
+                << maxOwnAllocs << ")");
+    }
+    if (!workers.empty())
+        MSG_INFO("    (worker threads not included, see the timing summary)");
+
+    MSG_INFO("Heap allocations per event, everything included: "
+            << (nevents ? double(stageTimers->allocs[TIME_EVENT])/nevents : 0));
+
+    bookCounter("allocations_own_first", "allocations of the first event")->fill(ownAllocsFirst);
+    bookCounter("allocations_own_later", "allocations of the later events")->fill(ownAllocsLater);
+    bookCounter("allocations_own_events", "later events with allocations")->fill(allocatingEvents);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::writeTiming() {
+    cycleClock.stop();
+    const double secsPerCycle = cycleClock.secondsPerCycle();
+
+    const char* timerNames[TIMERSLEN] = {
+        "event", "vbosonstage", "bhadronstage", "calojetstage", "trackjetstage",
+        "prefilter", "ParticlePartitioner", "ZeeFinder", "ZmumuFinder", "WenuFinder", "WmunuFinder",
+        "HeavyHadrons", "AntiKt10CaloJets", "AntiKtVRTrackJets", "CASmallRJets",
+        "bTagged", "matching", "substructure", "fills", "booking", "dispatch", "worker",
+        "checkpoint"
+    };
+
+    // latency bin edges in microseconds
+    vector<double> edges;
+    for (unsigned int iBin = 0; iBin <= StageTimers::NLATENCYBINS; ++iBin)
+        edges.push_back(std::ldexp(1.0, StageTimers::MINLOG2 + iBin)*secsPerCycle*1e6);
+
+    const double eventSecs = stageTimers->cycles[TIME_EVENT]*secsPerCycle;
+
+    std::ostringstream summary;
+    summary << "# " << std::left << std::setw(20) << "timer" << std::right
+        << std::setw(12) << "calls" << std::setw(14) << "total/s"
+        << std::setw(14) << "mean/us" << std::setw(12) << "% of event";
+    if (allocationsCounted()) summary << std::setw(14) << "allocs/call";
+    summary << "\n";
+
+    for (unsigned int iTimer = 0; iTimer < TIMERSLEN; ++iTimer) {
+        const uint64_t calls = stageTimers->calls[iTimer];
+        if (!calls) continue;
+
+        const string name = timerNames[iTimer];
+        const double secs = stageTimers->cycles[iTimer]*secsPerCycle;
+
+        summary << "  " << std::left << std::setw(20) << name << std::right
+            << std::setw(12) << calls << std::setw(14) << secs
+            << std::setw(14) << 1e6*secs/calls
+            << std::setw(12) << (eventSecs > 0 ? 100*secs/eventSecs : 0);
+        if (allocationsCounted())
+            summary << std::setw(14) << double(stageTimers->allocs[iTimer])/calls;
+        summary << "\n";
+
+        bookCounter("timing_" + name + "_calls", name + " calls")->fill(calls);
+        bookCounter("timing_" + name + "_seconds", name + " seconds")->fill(secs);
+
+        Histo1DPtr latency = bookHisto1D("timing_" + name + "_latency", edges,
+                name + " time per call", "time / us", "calls");
+        for (unsigned int iBin = 0; iBin < StageTimers::NLATENCYBINS; ++iBin) {
+            const uint64_t n = stageTimers->latency[iTimer*StageTimers::NLATENCYBINS + iBin];
+            if (n) latency->fill(std::sqrt(edges[iBin]*edges[iBin+1]), n);
+        }
+    }
+
+    MSG_INFO("Time per stage (" << secsPerCycle*1e9 << " ns per cycle"
+            << (workers.empty() ? "" : ", worker threads included") << "):");
+    std::istringstream lines(summary.str());
+    string line;
+    while (std::getline(lines, line))
+        MSG_INFO(line);
+
+    if (timingOutput != "1") {
+        std::ofstream out(timingOutput.c_str());
+        out << summary.str();
+        if (!out)
+            MSG_WARNING("Could not write the timing summary to " << timingOutput);
+    }
+
+    return;
+}
+
+//@}
+
+
+/// @name Cut masks
+//@{
+
+void MC_BOOSTEDHBB::writeCutMask(const Event& event) {
+    const Selection& sel = selections[0];
+    EventState& st = maskState;
+    CutMaskEvent& rec = cutMaskEvent;
+
+    // the vector boson stage always runs in full
+    const CutMask vbosonBits = (CutMask().set(ZLL).set(WLNU).set(ZNUNU).set(VBOSON));
+    st.reset();
+    st.cutBits |= states[0].cutBits & vbosonBits;
+
+    const ParticlePartitioner& parts = applyProjection<ParticlePartitioner>(event, "ParticlePartitioner");
+    rec.weight = weights[0];
+    rec.nleptons = std::min<size_t>(parts.leptons().size(), 255);
+    rec.met = parts.visibleMomentum().pT()/GeV;
+    rec.vbosonPt = st.cutBits[VBOSON] ? states[0].vboson.pT()/GeV : 0;
+
+    // everything else may not have run. the projections that did are
+    // not applied again.
+    st.bhads = applyProjection<HeavyHadrons>(event, "HeavyHadrons").bHadrons();
+    st.cutBits[ONEBHADRONSFOUND] = st.bhads.size() == 1;
+    st.cutBits[TWOBHADRONSFOUND] = st.bhads.size() == 2;
+    rec.nbhads = std::min<size_t>(st.bhads.size(), 255);
+
+    // all AKT10 jets, so that the file also serves looser thresholds
+    const MultiRadiusJets& jets = applyProjection<MultiRadiusJets>(event, "MultiRadiusJets");
+    const Jets akt10cjs = jets.caloJets();
+    size_t nakt10 = 0;
+    while (nakt10 < akt10cjs.size() && akt10cjs[nakt10].pT() >= sel.caloJetPtMin)
+        ++nakt10;
+    rec.nakt10 = std::min<size_t>(nakt10, 255);
+    rec.akt10Pt = akt10cjs.size() > 0 ? akt10cjs[0].pT()/GeV : 0;
+    rec.akt10Pt2 = akt10cjs.size() > 1 ? akt10cjs[1].pT()/GeV : 0;
+    rec.akt10Mass = akt10cjs.size() > 0 ? akt10cjs[0].mass()/GeV : 0;
+
+    selectCaloJets(akt10cjs, sel, st);
+    // the containment is tested against the leading jet, however many
+    if (!akt10cjs.empty())
+        st.boostedhiggs = Particle(25, akt10cjs[0].mom());
+
+    st.trackJets.clear();
+    foreach (const Jet& tj, jets.trackJets(sel.trackJetPtMin))
+        st.trackJets.push_back(tj.mom());
+    bTagged(st);
+    trackJetCuts(st, !akt10cjs.empty());
+    rec.ntrackJets = std::min<size_t>(st.trackJets.size(), 255);
+    rec.nbtags = std::min<size_t>(st.btagCols.size(), 255);
+
+    rec.cutMask = st.cutBits.to_ulong();
+    cutMaskWriter->write(rec);
+
+    return;
+}
+
+//@}
+
+
+/// @name Pre-filter
+//@{
+
+bool MC_BOOSTEDHBB::prefilter(const Event& event) {
+    if (prefilterMode == PREFILTER_OFF) return true;
+
+    {
+        ScopedTimer t(stageTimers, TIME_PREFILTER);
+        prefilterFailed = preFilter.check(event.genEvent());
+    }
+
+    ++prefilterChecked;
+    if (!prefilterFailed) return true;
+
+    size_t first = 0;
+    while (!(prefilterFailed & (1u << first))) ++first;
+    ++prefilterRejected[first];
+
+    return prefilterMode != PREFILTER_ON;
+}
+
+
+void MC_BOOSTEDHBB::prefilterMiss(size_t bound) {
+    ++prefilterMissed[bound];
+    MSG_WARNING("An event failing the pre-filter bound '" << EventPreFilter::boundName(bound)
+            << "' passed its stage of the selection.");
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::writePrefilter() {
+    unsigned long rejected = 0;
+    foreach (unsigned long n, prefilterRejected)
+        rejected += n;
+
+    const bool validating = prefilterMode == PREFILTER_VALIDATE;
+    MSG_INFO("Pre-filter: " << rejected << " of " << prefilterChecked << " events "
+            << (validating ? "would have been " : "") << "rejected ("
+            << (prefilterChecked ? 100.0*rejected/prefilterChecked : 0) << "%), by the first bound failed:");
+    for (size_t bound = 0; bound < EventPreFilter::BOUNDSLEN; ++bound)
+        MSG_INFO("    " << EventPreFilter::boundName(bound) << ": " << prefilterRejected[bound]);
+
+    if (!validating) return;
+
+    unsigned long missed = 0;
+    foreach (unsigned long n, prefilterMissed)
+        missed += n;
+
+    if (!missed) {
+        MSG_INFO("Pre-filter validated: no event failing a bound passed its stage, "
+                << "so none of the rejected events was selected.");
+        return;
+    }
+
+    MSG_ERROR("Pre-filter NOT conservative: " << missed << " events failing a bound passed its stage:");
+    for (size_t bound = 0; bound < EventPreFilter::BOUNDSLEN; ++bound)
+        MSG_ERROR("    " << EventPreFilter::boundName(bound) << ": " << prefilterMissed[bound]);
+
+    return;
+}
+
+//@}
+
+
+/// @name Skims
+//@{
+
+void MC_BOOSTEDHBB::writeSkim(EventState& st) {
+    SkimEvent& skim = st.skim;
+
+    skim.weights = st.weights;
+    skim.cutMask = st.cutBits.to_ulong();
+    skim.lepchan = st.lepchan;
+
+    skim.vboson = st.vboson.mom();
+    skim.higgs = st.boostedhiggs.mom();
+
+    // the substructure only where it will be used
+    skim.tau21 = skim.filteredMass = skim.trimmedMass = 0;
+    if (st.btagCols.size() == 1 || st.btagCols.size() == 2) {
+        const JetSubstructure& sub = substructure(st);
+        skim.tau21 = sub.tau21();
+        skim.filteredMass = sub.filteredMass();
+        skim.trimmedMass = sub.trimmedMass();
+        skim.smallRJets = leadingSmallRJets(st);
+    } else {
+        skim.smallRJets.clear();
+    }
+
+    skim.trackJets = st.trackJets;
+    skim.btags.assign(st.trackJets.size(), 0);
+    foreach (size_t iJet, st.btagCols)
+        skim.btags[iJet] = 1;
+
+    skim.bhads.clear();
+    foreach (const Particle& bhad, st.bhads)
+        skim.bhads.push_back(bhad.mom());
+
+    // the writer is shared by the worker threads and locks itself
+    skimWriter->write(skim);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::replaySkim(vector<double>& norms) {
+    SkimReader reader(skimInput);
+
+    size_t nweights = std::max<size_t>(reader.numWeights(), 1);
+    if (maxWeights && nweights > maxWeights) nweights = maxWeights;
+    bookVariations(nweights);
+
+    // the skim holds the default selection
+    EventState& st = states[0];
+    SkimEvent& skim = st.skim;
+    while (reader.next(skim)) {
+        if (skim.lepchan >= LEPCHANSLEN)
+            throw Exception("MC_BOOSTEDHBB: bad lepton channel in skim " + skimInput);
+
+        st.reset();
+        st.weights.assign(skim.weights.begin(), skim.weights.begin() + nweights);
+        st.cutBits = CutMask(skim.cutMask);
+        st.lepchan = lepchans(skim.lepchan);
+
+        // the ids are not kept; only the momenta are used from here on
+        st.vboson = Particle(0, skim.vboson);
+        st.boostedhiggs = Particle(25, skim.higgs);
+        st.substructure->setValues(skim.tau21, skim.filteredMass, skim.trimmedMass);
+        st.smallRJets = skim.smallRJets;
+        st.smallRJetsDone = true;
+        foreach (const FourMomentum& p, skim.bhads)
+            st.bhads.push_back(Particle(0, p));
+
+        st.trackJets = skim.trackJets;
+        st.btagCols.clear();
+        for (size_t iJet = 0; iJet < skim.btags.size(); ++iJet)
+            if (skim.btags[iJet]) st.btagCols.push_back(iJet);
+
+        ++st.stageCounts[TRACKJETSTAGE];
+        selectBoostedHiggs(st, histos[0]);
+    }
+
+    MSG_INFO("Replayed " << st.stageCounts[TRACKJETSTAGE] << " events from " << skimInput
+            << ", " << st.stageCounts[SELECTEDSTAGE] << " selected.");
+
+    if (!reader.hasFooter()) {
+        MSG_WARNING("Skim " << skimInput << " has no footer, the run that wrote it did not finish. "
+                << "The histograms are left unnormalised.");
+        norms.assign(nweights, 1);
+        return;
+    }
+
+    MSG_INFO("Skim written from " << reader.numEvents() << " events, sum of weights "
+            << reader.sumOfWeights()[0] << ", cross section " << reader.crossSection() << " pb.");
+
+    for (size_t iw = 0; iw < nweights; ++iw)
+        norms.push_back(1000*reader.crossSection()/reader.sumOfWeights()[iw]);
+
+    return;
+}
+
+//@}
+
+
+/// @name Checkpoints
+//@{
+
+// the sums of d, exactly
+static void saveDbn(CheckpointData& data, const YODA::Dbn1D& d) {
+    const double sums[5] = { double(d.numEntries()), d.sumW(), d.sumW2(), d.sumWX(), d.sumWX2() };
+    data.putArray(sums, 5);
+
+    return;
+}
+
+
+static YODA::Dbn1D restoreDbn(CheckpointData& data) {
+    double sums[5];
+    data.getArray(sums, 5);
+
+    return YODA::Dbn1D((unsigned long) sums[0], sums[1], sums[2], sums[3], sums[4]);
+}
+
+
+static void saveHisto(CheckpointData& data, const YODA::Histo1D& h) {
+    data.put<uint64_t>(h.numBins());
+    saveDbn(data, h.underflow());
+    saveDbn(data, h.overflow());
+    saveDbn(data, h.totalDbn());
+    for (size_t iBin = 0; iBin < h.numBins(); ++iBin)
+        saveDbn(data, h.bin(iBin).dbn());
+
+    return;
+}
+
+
+// into the empty h, so that its sums are exactly the saved ones
+static void restoreHisto(CheckpointData& data, YODA::Histo1D& h) {
+    if (data.get<uint64_t>() != h.numBins())
+        throw Exception("MC_BOOSTEDHBB: restoring " + h.path() + " with different binning");
+
+    h.reset();
+    h.underflow() += restoreDbn(data);
+    h.overflow() += restoreDbn(data);
+    h.totalDbn() += restoreDbn(data);
+    for (size_t iBin = 0; iBin < h.numBins(); ++iBin)
+        h.bin(iBin).dbn() += restoreDbn(data);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::saveHistos(CheckpointData& data, const HistoSet& hs) const {
+    foreach (const Histo1DPtr& h, hs.cutflow)
+        saveHisto(data, *h);
+
+    // only the booked slots have contents
+    foreach (const FastHisto1D& h, hs.fast1D) {
+        data.put<uint8_t>(h.booked());
+        if (h.booked()) h.save(data);
+    }
+    foreach (const FastHisto2D& h, hs.fast2D) {
+        data.put<uint8_t>(h.booked());
+        if (h.booked()) h.save(data);
+    }
+    foreach (const FastHisto1D& h, hs.cube) {
+        data.put<uint8_t>(h.booked());
+        if (h.booked()) h.save(data);
+    }
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::restoreHistos(CheckpointData& data, HistoSet& hs) {
+    foreach (Histo1DPtr& h, hs.cutflow)
+        restoreHisto(data, *h);
+
+    for (size_t iHisto = 0; iHisto < hs.fast1D.size(); ++iHisto)
+        if (data.get<uint8_t>()) hs.at1D(iHisto).restore(data);
+    for (size_t iHisto = 0; iHisto < hs.fast2D.size(); ++iHisto)
+        if (data.get<uint8_t>()) hs.at2D(iHisto).restore(data);
+    for (size_t iSlot = 0; iSlot < hs.cube.size(); ++iSlot) {
+        if (!data.get<uint8_t>()) continue;
+        bookCube(hs, cubeObs(iSlot%CUBEOBSLEN), hs.cube[iSlot]);
+        hs.cube[iSlot].restore(data);
+    }
+
+    return;
+}
+
+
+/// The snapshot is a copy of the sums, taken between two events. Writing
+/// it is left to the CheckpointWriter's thread.
+void MC_BOOSTEDHBB::writeCheckpoint() {
+    ScopedTimer t(stageTimers, TIME_CHECKPOINT);
+
+    const string error = checkpointWriter->error();
+    if (!error.empty()) MSG_WARNING("Checkpoint failed: " << error);
+
+    // the layout first, which init() checks on a restart
+    CheckpointData* snapshot = new CheckpointData;
+    snapshot->put<uint64_t>(nanalysed);
+    snapshot->put<uint64_t>(histos[0].nweights);
+    snapshot->put<uint64_t>(histos.size());
+    snapshot->put<uint64_t>(histos[0].size1D);
+    snapshot->put<uint64_t>(histos[0].size2D);
+    snapshot->put<uint64_t>(histos[0].cube.size());
+    snapshot->put<uint8_t>(stitchSlices);
+
+    snapshot->putVector(sumW);
+    foreach (const EventState& st, states)
+        snapshot->putVector(st.stageCounts);
+    snapshot->put<uint64_t>(prefilterChecked);
+    snapshot->putVector(prefilterRejected);
+    snapshot->putVector(prefilterMissed);
+    foreach (const HistoSet& hs, histos)
+        saveHistos(*snapshot, hs);
+
+    if (stitchSlices) {
+        snapshot->put<uint64_t>(sliceEvents);
+        snapshot->putVector(sliceSumW);
+        snapshot->put(sliceXsec);
+        snapshot->put<int32_t>(lastEventNumber);
+        snapshot->put<uint32_t>(nslices);
+        foreach (const HistoSet& hs, stitched)
+            saveHistos(*snapshot, hs);
+    }
+
+    checkpointWriter->write(snapshot);
+
+    return;
+}
+
+
+void MC_BOOSTEDHBB::restoreCheckpoint() {
+    if (histos[0].nweights != resumeWeights)
+        throw Exception("MC_BOOSTEDHBB: the events have another number of weights than checkpoint "
+                + checkpointFile);
+
+    CheckpointData& data = resumeData;
+    data.getVector(sumW);
+    foreach (EventState& st, states)
+        data.getVector(st.stageCounts);
+    prefilterChecked = data.get<uint64_t>();
+    data.getVector(prefilterRejected);
+    data.getVector(prefilterMissed);
+    foreach (HistoSet& hs, histos)
+        restoreHistos(data, hs);
+
+    if (stitchSlices) {
+        sliceEvents = data.get<uint64_t>();
+        data.getVector(sliceSumW);
+        sliceXsec = data.get<double>();
+        lastEventNumber = data.get<int32_t>();
+        nslices = data.get<uint32_t>();
+        foreach (HistoSet& hs, stitched)
+            restoreHistos(data, hs);
+    }
+
+    if (!data.atEnd())
+        throw Exception("MC_BOOSTEDHBB: checkpoint " + checkpointFile + " has more than this run restores");
+
+    MSG_INFO("Restored " << resumeEvents << " events from checkpoint " << checkpointFile
+            << ", sum of weights " << sumW[0] << ".");
+    resumeData = CheckpointData();
+
+    return;
 }
 
 //@}
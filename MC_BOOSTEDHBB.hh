@@ -4,6 +4,26 @@
 
 #include "Rivet/Analysis.hh"
 
+#include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "Rivet/Projections/FastJets.hh"
+
+#include "CategoryCube.hh"
+#include "Checkpoint.hh"
+#include "CutMaskFile.hh"
+#include "DeltaRMatcher.hh"
+#include "EtaPhiGrid.hh"
+#include "EventPreFilter.hh"
+#include "FastHisto.hh"
+#include "JetSubstructure.hh"
+#include "MultiRadiusJets.hh"
+#include "ParticlePartitioner.hh"
+#include "SkimFile.hh"
+#include "StageTimers.hh"
+
 namespace Rivet {
 
     class MC_BOOSTEDHBB : public Analysis {
@@ -11,11 +31,46 @@ namespace Rivet {
             /// Constructor
             MC_BOOSTEDHBB()
                 : Analysis("MC_BOOSTEDHBB"),
-                    cutBits(CUTSLEN, false) {
+                    sparseOutput(false),
+                    loosestCaloJetPt(0),
+                    loosestTrackJetPt(0),
+                    maxWeights(0),
+                    unnormalised(false),
+                    stitchSlices(false),
+                    sliceEvents(0),
+                    sliceXsec(0),
+                    lastEventNumber(0),
+                    nslices(0),
+                    checkpointWriter(0),
+                    checkpointEvery(0),
+                    nanalysed(0),
+                    resumeEvents(0),
+                    resumeWeights(0),
+                    matchStrategy(DeltaRMatrix::NEAREST),
+                    nthreads(0),
+                    nDispatched(0),
+                    wallStart(0),
+                    skimWriter(0),
+                    cutMaskWriter(0),
+                    prefilterMode(PREFILTER_OFF),
+                    prefilterFailed(0),
+                    prefilterChecked(0),
+                    prefilterRejected(EventPreFilter::BOUNDSLEN, 0),
+                    prefilterMissed(EventPreFilter::BOUNDSLEN, 0),
+                    stageTimers(0),
+                    countAllocs(false),
+                    ownAllocsFirst(0),
+                    ownAllocsLater(0),
+                    allocatingEvents(0),
+                    maxOwnAllocs(0),
+                    logger(0) {
 
                     return;
                 }
 
+            /// Destructor. Stops the worker threads if finalize() never ran.
+            ~MC_BOOSTEDHBB();
+
             /// Book histograms and initialise projections before the run
             void init();
 
@@ -26,9 +81,10 @@ namespace Rivet {
             void finalize();
 
         private:
+            /// the microbenchmarks in benchmark.cc
+            friend class MC_BOOSTEDHBBBenchmark;
 
 
-            Histo1DPtr cutflow;
             enum cuts {
                 NONE,               // 0
                 WLNU,               // 1
@@ -44,14 +100,500 @@ namespace Rivet {
                 CUTSLEN             //This is used to keep the size of this enum automatically.
             };
 
-            vector<bool> cutBits;
+            /// the cuts an event passed, one bit per cut
+            typedef std::bitset<CUTSLEN> CutMask;
+
+            /// names of the cuts, as in the cut mask files
+            static const char* const cutNames[CUTSLEN];
+
+
+            /// stages of the selection in analyze(), in the order they run.
+            /// each stage only applies the projections it needs.
+            enum stages {
+                VBOSONSTAGE,        // ParticlePartitioner, Z/W finders
+                BHADRONSTAGE,       // HeavyHadrons
+                CALOJETSTAGE,       // MultiRadiusJets, AKT10 calo jets
+                TRACKJETSTAGE,      // MultiRadiusJets, VR track jets
+                SELECTEDSTAGE,      // passed all vetoes
+                STAGESLEN
+            };
+
+
+            /// timers of the instrumentation
+            enum timers {
+                TIME_EVENT,             // all of analyze()
+                TIME_VBOSONSTAGE,
+                TIME_BHADRONSTAGE,
+                TIME_CALOJETSTAGE,
+                TIME_TRACKJETSTAGE,
+                TIME_PREFILTER,         // EventPreFilter, before the projections
+                TIME_PARTITIONER,       // projections
+                TIME_ZEEFINDER,
+                TIME_ZMUMUFINDER,
+                TIME_WENUFINDER,
+                TIME_WMUNUFINDER,
+                TIME_HEAVYHADRONS,
+                TIME_CALOJETS,
+                TIME_TRACKJETS,
+                TIME_SMALLRJETS,        // small-R jets, on first use
+                TIME_BTAGGING,          // bTagged()
+                TIME_MATCHING,          // Delta R matrix and matching
+                TIME_SUBSTRUCTURE,      // AKT10 jet substructure
+                TIME_FILLS,             // cutflow and histogram fills
+                TIME_BOOKING,           // histograms booked on their first fill
+                TIME_DISPATCH,          // handing events to the worker threads
+                TIME_WORKER,            // jet stages of one event on a worker thread
+                TIME_CHECKPOINT,        // snapshots for the checkpoint file
+                TIMERSLEN
+            };
+
+
+            /// lepton channels of the vector boson
+            enum lepchans {
+                ZLLCHAN,
+                WLNUCHAN,
+                ZNUNUCHAN,
+                LEPCHANSLEN
+            };
+
+
+            /// @name Flat histogram tables
+            ///
+            /// Every collection booked through bookFourMom() and friends gets
+            /// one block of OBS1DLEN (OBS2DLEN) slots per channel. Channels
+            /// and collections are resolved to integer handles at booking
+            /// time so that the fill methods only do index arithmetic.
+            //@{
+
+            enum obs1D {
+                OBS_PT,
+                OBS_ETA,
+                OBS_M,
+                OBS_DR,
+                OBS_PT1_MINUS_PT2,
+                OBS_PT1_BY_PT2,
+                OBS_N,
+                OBS_TAU21,
+                OBS_FILTEREDM,
+                OBS_TRIMMEDM,
+                OBS1DLEN
+            };
+
+            enum obs2D {
+                OBS_M_VS_PT,
+                OBS_DR_VS_PTTOTAL,
+                OBS_DR_VS_PTBHAD,
+                OBS_DR_VS_PTTRACKJET,
+                OBS_PT1_VS_PT2,
+                OBS_DR_VS_DPT,
+                OBS2DLEN
+            };
+
+            /// observables filled per category of the cube
+            enum cubeObs {
+                CUBE_HIGGSM,
+                CUBE_HIGGSPT,
+                CUBE_VHM,
+                CUBEOBSLEN
+            };
+
+            /// What to book in one slot of the histogram tables: the
+            /// book*() methods only declare the histograms, and each one is
+            /// booked when it is first filled. Most of them never are.
+            struct HistoSpec {
+                HistoSpec()
+                    : nxbins(0), xmin(0), xmax(0),
+                        nybins(0), ymin(0), ymax(0) {
 
+                    return;
+                }
+
+                /// without the prefix of the selection, empty for a slot
+                /// that is never filled
+                string name;
+                string title;
+                string xlabel;
+                int nxbins;
+                double xmin, xmax;
+
+                /// 2D histograms only
+                string ylabel;
+                int nybins;
+                double ymin, ymax;
+            };
+
+            /// the declared histograms, laid out as one table of a HistoSet
+            /// and shared by all of them
+            vector<HistoSpec> specs1D;
+            vector<HistoSpec> specs2D;
+
+            /// A fill a worker made, to be replayed into the booked
+            /// histograms. The weights are those of the event.
+            struct FillRecord {
+                enum kinds {
+                    FILL1D,         // x into fast1D[slot], with the weights
+                    FILL1DUNIT,     // x into fast1D[slot], unit weight
+                    FILL2D,
+                    FILL2DUNIT,
+                    FILLCUBE,       // x into cube[slot], with the weights
+                    FILLCUTFLOW     // bin slot of the cutflow, with the weights
+                };
+
+                FillRecord(kinds kind, size_t slot, double x, double y)
+                    : kind(kind), slot(slot), x(x), y(y) {
+
+                    return;
+                }
+
+                kinds kind;
+                size_t slot;
+                double x, y;
+            };
+
+            /// One complete set of the analysis histograms.
+            ///
+            /// The booked histograms are one set. In multi-threaded mode
+            /// every worker has a copy that only records its fills in
+            /// fillLog. The analysis thread replays them into the booked
+            /// set in the order the events were dispatched, which is the
+            /// order of a single-threaded run, so the sums come out the
+            /// same bit for bit.
+            ///
+            /// The event loop fills FastHistos, one per slot holding the
+            /// bins of every event weight. A slot stays empty until its
+            /// first fill books it from its HistoSpec. finalize() books
+            /// the YODA histograms and flushes the FastHistos into them.
+            struct HistoSet {
+                HistoSet()
+                    : nchannels(0),
+                        nweights(1),
+                        size1D(0),
+                        size2D(0),
+                        analysis(0),
+                        stageTimers(0),
+                        fillLog(0) {
+
+                    return;
+                }
+
+                size_t index1D(size_t chan, size_t coll, obs1D obs) const {
+                    return (coll*nchannels + chan)*OBS1DLEN + obs;
+                }
+
+                size_t index2D(size_t chan, size_t coll, obs2D obs) const {
+                    return (coll*nchannels + chan)*OBS2DLEN + obs;
+                }
+
+                /// the histogram in a slot, booked if this is its first fill
+                FastHisto1D& at1D(size_t slot) {
+                    FastHisto1D& h = fast1D[slot];
+                    if (!h.booked()) analysis->bookLazy(*this, slot, h);
+                    return h;
+                }
+
+                FastHisto2D& at2D(size_t slot) {
+                    FastHisto2D& h = fast2D[slot];
+                    if (!h.booked()) analysis->bookLazy(*this, slot, h);
+                    return h;
+                }
+
+                /// fill the histogram of every weight variation
+                void fill1D(size_t chan, size_t coll, obs1D obs,
+                        double x, const vector<double>& weights) {
+                    const size_t slot = index1D(chan, coll, obs);
+                    if (fillLog) fillLog->push_back(FillRecord(FillRecord::FILL1D, slot, x, 0));
+                    else at1D(slot).fill(x, weights);
+                }
+
+                void fill2D(size_t chan, size_t coll, obs2D obs,
+                        double x, double y, const vector<double>& weights) {
+                    const size_t slot = index2D(chan, coll, obs);
+                    if (fillLog) fillLog->push_back(FillRecord(FillRecord::FILL2D, slot, x, y));
+                    else at2D(slot).fill(x, y, weights);
+                }
+
+                /// unit weight fills, the same in every variation
+                void fill1D(size_t chan, size_t coll, obs1D obs, double x) {
+                    const size_t slot = index1D(chan, coll, obs);
+                    if (fillLog) fillLog->push_back(FillRecord(FillRecord::FILL1DUNIT, slot, x, 0));
+                    else at1D(slot).fill(x);
+                }
+
+                void fill2D(size_t chan, size_t coll, obs2D obs, double x, double y) {
+                    const size_t slot = index2D(chan, coll, obs);
+                    if (fillLog) fillLog->push_back(FillRecord(FillRecord::FILL2DUNIT, slot, x, y));
+                    else at2D(slot).fill(x, y);
+                }
+
+                void fillCutflow(int iCut, const vector<double>& weights) {
+                    if (fillLog) {
+                        fillLog->push_back(FillRecord(FillRecord::FILLCUTFLOW, iCut, 0, 0));
+                        return;
+                    }
+                    for (size_t iw = 0; iw < nweights; ++iw)
+                        cutflow[iw]->fill(iCut, weights[iw]);
+                }
+
+                /// fill an observable of a category of the cube
+                void fillCube(size_t category, cubeObs obs, double x, const vector<double>& weights) {
+                    const size_t slot = category*CUBEOBSLEN + obs;
+                    if (fillLog) {
+                        fillLog->push_back(FillRecord(FillRecord::FILLCUBE, slot, x, 0));
+                        return;
+                    }
+                    FastHisto1D& h = cube[slot];
+                    if (!h.booked()) analysis->bookCube(*this, obs, h);
+                    h.fill(x, weights);
+                }
+
+                /// apply the fills a worker recorded for one event
+                void replay(const vector<FillRecord>& fills, const vector<double>& weights);
+
+                // one per weight
+                vector<Histo1DPtr> cutflow;
+
+                // indexed by index1D(channel, collection, obs)
+                vector<FastHisto1D> fast1D;
+                // indexed by index2D(channel, collection, obs)
+                vector<FastHisto2D> fast2D;
+
+                // booked by finalize(), indexed by iweight*size1D + index1D
+                vector<Histo1DPtr> histos1D;
+                // indexed by iweight*size2D + index2D
+                vector<Histo2DPtr> histos2D;
+
+                // indexed by category*CUBEOBSLEN + obs, empty without the cube
+                vector<FastHisto1D> cube;
+                // booked by finalize() for the filled slots, indexed by
+                // iweight*cube.size() + slot
+                vector<Histo1DPtr> cubeHistos;
+
+                size_t nchannels;
+                size_t nweights;
+
+                // size of one table
+                size_t size1D;
+                size_t size2D;
+
+                /// prepended to the histogram names
+                string prefix;
+
+                /// books the histograms on first fill
+                MC_BOOSTEDHBB* analysis;
+                /// times the booking, so that its allocations are not
+                /// counted as the event's
+                StageTimers* stageTimers;
+
+                /// where the fills are recorded instead of made, null
+                /// outside the workers
+                vector<FillRecord>* fillLog;
+            };
 
             vector<string> channels;
-            map<string, map<string, map<string, Histo1DPtr> > > histos1D;
-            map<string, map<string, map<string, Histo2DPtr> > > histos2D;
+            vector<string> collections;
+
+            /// the booked histograms, one set per selection
+            vector<HistoSet> histos;
+
+            /// With MC_BOOSTEDHBB_SPARSE set only the histograms that were
+            /// filled are written. Otherwise finalize() books the rest
+            /// empty, so that the output has every histogram as before.
+            /// Either way the names are the same.
+            bool sparseOutput;
+
+            /// book slot of hs from its HistoSpec
+            void bookLazy(HistoSet& hs, size_t slot, FastHisto1D& h);
+            void bookLazy(HistoSet& hs, size_t slot, FastHisto2D& h);
+
+            /// book the YODA histograms of the booked sets, every weight
+            /// of the filled ones and, unless sparseOutput, the others,
+            /// and flush the FastHistos into them
+            void flushHistos();
+
+            /// an empty set with the layout of hs, its histograms booked on
+            /// their first fill as in hs, and empty cutflows that are not
+            /// written
+            void emptyCopy(const HistoSet& hs, HistoSet& copy, StageTimers* timers);
+
+            //@}
+
+
+            /// A working point of the selection.
+            ///
+            /// Any number of selections are evaluated on the same event: the
+            /// projections are applied once, with the loosest cuts of all
+            /// selections, and each selection applies its own cuts to their
+            /// results and fills its own histograms. The default selection
+            /// comes first; more are added with
+            ///   MC_BOOSTEDHBB_SELECTIONS="name:key=value,...;name:..."
+            /// where the keys are zmassmin, zmassmax, wmassmin, wmassmax,
+            /// met, calojetpt and trackjetpt, all in GeV, and anything not
+            /// given is taken from the default. Their histograms are named
+            /// with "name_" prepended.
+            struct Selection {
+                Selection()
+                    : zMassMin(75*GeV), zMassMax(105*GeV),
+                        wMassMin(65*GeV), wMassMax(95*GeV),
+                        metMin(30*GeV),
+                        caloJetPtMin(250*GeV),
+                        trackJetPtMin(25*GeV) {
+
+                    return;
+                }
+
+                string name;
+
+                /// window on the mass of the boson the Z/W finders return
+                double zMassMin, zMassMax;
+                double wMassMin, wMassMax;
+
+                /// missing pT for Z -> nu nu
+                double metMin;
+
+                double caloJetPtMin;
+                double trackJetPtMin;
+            };
+
+            vector<Selection> selections;
+
+            /// jet thresholds of the projections, the loosest of all selections
+            double loosestCaloJetPt;
+            double loosestTrackJetPt;
+
+            void addSelections(const string& spec);
+
+            /// whether the first boson is within [mmin, mmax]
+            static bool inMassWindow(const Particles& bosons, double mmin, double mmax);
+
+
+            /// Selection state of the event being processed for one
+            /// selection, and the scratch space it reuses from event to
+            /// event. analyze() has one per selection; so does every
+            /// worker thread.
+            struct EventState {
+                EventState()
+                    : weights(1, 0),
+                        stageTimers(0),
+                        substructure(0),
+                        jets(0),
+                        smallRJetsDone(false),
+                        passed(false),
+                        lepchan(LEPCHANSLEN),
+                        met(0),
+                        stageCounts(STAGESLEN, 0),
+                        tagJetGrid(VRRMAX),
+                        trackJetGrid(CALOJETR) {
+
+                        return;
+                    }
+
+                /// start a new event. the weights are set separately.
+                void reset() {
+                    passed = false;
+                    cutBits.reset();
+                    cutBits[NONE] = true;
+                    lepchan = LEPCHANSLEN;
+                    bhads.clear();
+                    smallRJetsDone = false;
+
+                    return;
+                }
+
+                /// nominal weight followed by the variations
+                vector<double> weights;
+
+                /// timers of the thread using this state, or null
+                StageTimers* stageTimers;
+
+                /// substructure of the AKT10 jet, shared by the selections
+                /// evaluated on the same thread
+                JetSubstructure* substructure;
+
+                /// jets of the event being processed by this thread
+                const MultiRadiusJets* jets;
+
+                /// the two leading small-R jets of every radius, zero
+                /// momenta where there are fewer. See leadingSmallRJets().
+                vector<FourMomentum> smallRJets;
+                bool smallRJetsDone;
+
+                /// false once the event is vetoed for this selection
+                bool passed;
+
+                CutMask cutBits;
+                lepchans lepchan;
+
+                /// missing pT of the event
+                double met;
+
+                Particle vboson;
+                Particle boostedhiggs;
+                Particles bhads;
+
+                /// VR track jets and the positions of the b-tagged ones
+                vector<FourMomentum> trackJets;
+                vector<size_t> btagCols;
+
+                /// number of events reaching each stage
+                vector<unsigned long> stageCounts;
 
-            void bookChannel(const string& channel);
+                /// @name Delta R matching between b hadrons and track jets
+                //@{
+                EtaPhiBuffer drRows;
+                EtaPhiBuffer drCols;
+                DeltaRMatrix drMatrix;
+                vector<size_t> bhadRows;
+                vector<int> bhadMatches;
+                //@}
+
+                /// track jets binned in (eta, phi), for the b-tagging and
+                /// the containment in the AKT10 jet
+                EtaPhiGrid tagJetGrid;
+                EtaPhiGrid trackJetGrid;
+
+                /// scratch of the b-tagging
+                vector<size_t> nearJets;
+                vector<bool> jetTagged;
+
+                /// scratch for writing the event to the skim
+                SkimEvent skim;
+            };
+
+            /// states used by analyze() itself, one per selection
+            vector<EventState> states;
+
+
+            /// channel handles
+            size_t allChannels;
+            size_t boostedHbChannel[LEPCHANSLEN];
+            size_t boostedHbbChannel[LEPCHANSLEN];
+
+            /// collection handles
+            size_t vbosonColl;
+            size_t boostedHbColl;
+            size_t boostedHbbColl;
+            size_t vbosonHiggsColl;
+            size_t bhadBTrackJet1tagColl;
+            size_t vbosonBoostedHiggs1tagColl;
+            size_t vbosonBoostedHiggs2tagsColl;
+            size_t bhadBTrackJet2tagColl;
+
+            /// leading two small-R jets, one collection per radius
+            vector<size_t> smallRDijetColls;
+
+            size_t bookChannel(const string& channel);
+            size_t collection(HistoSet& hs, const string& name);
+
+            /// declare the histogram of one slot, named without the
+            /// prefix of the selection
+            void declareHisto(HistoSet& hs, size_t chan, size_t coll, obs1D obs,
+                    const string& name, const string& title,
+                    const string& xlabel, int nxbins, double xmin, double xmax);
+
+            void declareHisto(HistoSet& hs, size_t chan, size_t coll, obs2D obs,
+                    const string& name, const string& title,
+                    const string& xlabel, int nxbins, double xmin, double xmax,
+                    const string& ylabel, int nybins, double ymin, double ymax);
 
             Histo1DPtr bookHisto(const string& name, const string& title,
                     const string& xlabel, int nxbins, double xmin, double xmax);
@@ -60,36 +602,499 @@ namespace Rivet {
                     const string& xlabel, int nxbins, double xmin, double xmax,
                     const string& ylabel, int nybins, double ymin, double ymax);
 
-            void bookFourMom(const string& name);
-            void bookFourMomPair(const string& name);
-            void bookFourMomComp(const string& name);
-            void bookFourMomColl(const string& name);
+            size_t bookFourMom(HistoSet& hs, const string& name);
+            size_t bookFourMomPair(HistoSet& hs, const string& name);
+            size_t bookFourMomComp(HistoSet& hs, const string& name);
+            size_t bookFourMomColl(HistoSet& hs, const string& name);
+            size_t bookFourMomJet(HistoSet& hs, const string& name);
 
-            void fillFourMom(const string& channel,
-                    const string& name,
+            /// @name Histogram fills
+            ///
+            /// weights holds the nominal weight and the variations. The
+            /// observables are computed once and filled into every variation.
+            //@{
+            void fillFourMom(HistoSet& hs,
+                    size_t chan,
+                    size_t coll,
                     const FourMomentum& p,
-                    double weight);
+                    const vector<double>& weights);
 
-            void fillFourMomPair(const string& channel,
-                    const string& name,
+            void fillFourMomPair(HistoSet& hs,
+                    size_t chan,
+                    size_t coll,
                     const FourMomentum& p1,
                     const FourMomentum& p2,
-                    double weight);
+                    const vector<double>& weights);
 
-            void fillFourMomComp(const string& channel,
-                    const string& name,
+            void fillFourMomComp(HistoSet& hs,
+                    size_t chan,
+                    size_t coll,
                     const FourMomentum& p1,
                     const FourMomentum& p2,
-                    double weight);
+                    const vector<double>& weights);
 
             template <class T>
-            void fillFourMomColl(const string& channel,
-                    const string& name,
+            void fillFourMomColl(HistoSet& hs,
+                    size_t chan,
+                    size_t coll,
                     const vector<T>& ps,
-                    double weight);
+                    const vector<double>& weights);
+
+            void fillFourMomJet(HistoSet& hs,
+                    size_t chan,
+                    size_t coll,
+                    const FourMomentum& p,
+                    const JetSubstructure& sub,
+                    const vector<double>& weights);
+
+            /// pairs of leading small-R jets, as from leadingSmallRJets()
+            void fillSmallRDijets(HistoSet& hs,
+                    size_t chan,
+                    const vector<FourMomentum>& jets,
+                    const vector<double>& weights);
+            //@}
+
+
+            /// @name Weight variations
+            ///
+            /// All weights of the first event are used, unless
+            /// MC_BOOSTEDHBB_NWEIGHTS limits their number (1 for the
+            /// nominal weight only). Variation iw of every histogram is
+            /// booked like the nominal one, with "[Wiw]" appended to the
+            /// path, and normalised with its own sum of weights.
+            ///
+            /// With MC_BOOSTEDHBB_UNNORMALISED set the histograms are left
+            /// as sums of weights, and the counters sumW, sumW[Wiw] and
+            /// crossSection hold what they would be normalised with.
+            /// mergeshards adds such outputs of runs over parts of one
+            /// sample and normalises the sum.
+            //@{
+            size_t maxWeights;
+
+            bool unnormalised;
+
+            /// sum of each weight over all events
+            vector<double> sumW;
+
+            /// weights of the current event
+            vector<double> weights;
+
+            /// set up everything that depends on the number of weights, on
+            /// the first event
+            void startEvents(size_t nweights);
+
+            /// size the tables for the variations and book their cutflows
+            /// on the first event
+            void bookVariations(size_t nweights);
+
+            template <class PTR>
+            PTR bookVariation(const PTR& nominal, const string& suffix);
+
+            /// the weights of event into ws
+            void eventWeights(const Event& event, vector<double>& ws);
+
+            /// book and fill the counters of unnormalised output
+            void writeSums();
+            //@}
+
+
+            /// @name Stitched slices
+            ///
+            /// With MC_BOOSTEDHBB_SLICES or MC_BOOSTEDHBB_SLICEEVENTS set
+            /// one run takes all slices of a process, e.g. the
+            /// ptj1min/ptj1max slices of runmg5split_pbs.py, one file after
+            /// the other:
+            ///   rivet -a MC_BOOSTEDHBB slice0.hepmc slice1.hepmc ...
+            /// MC_BOOSTEDHBB_SLICEEVENTS=n0,n1,... gives the number of
+            /// events of every slice, as runrivet_pbs.py -s does. Without
+            /// it a new slice starts wherever the event number does not
+            /// increase, with a warning where that is not at event number 0
+            /// or 1. The histograms of every slice are normalised with its
+            /// own cross section, that of its last event, and sums of
+            /// weights, as finalize() would normalise a run over the slice
+            /// alone, and added to the stitched sets. finalize() writes the
+            /// sum. Slices are analysed on one thread, and cannot be
+            /// written to skims or cut masks.
+            //@{
+            bool stitchSlices;
+
+            /// the events of every slice, empty to find the boundaries
+            /// from the event numbers
+            vector<unsigned long> sliceSizes;
+
+            /// events, sums of weights and cross section of the current slice
+            unsigned long sliceEvents;
+            vector<double> sliceSumW;
+            double sliceXsec;
+
+            /// of the previous event
+            int lastEventNumber;
+
+            /// slices finished so far
+            unsigned nslices;
+
+            /// the normalised finished slices, one set per selection
+            vector<HistoSet> stitched;
+
+            /// end the current slice if event starts a new one, and account
+            /// for event in the current slice
+            void nextSlice(const Event& event);
+
+            /// normalise the current slice and add it to stitched
+            void endSlice();
+
+            /// end the last slice and move stitched into histos
+            void finishSlices();
+            //@}
+
+
+            /// @name Category cube
+            ///
+            /// With MC_BOOSTEDHBB_CUBE set, every event reaching the
+            /// b-tag requirements is put in a category of (lepton
+            /// multiplicity, track jets, b-tagged track jets, MET bin, V pT
+            /// bin), and the higgs candidate mass and pT and the VH mass
+            /// are filled for its category. The category is computed
+            /// arithmetically and indexes the cube table of every HistoSet,
+            /// whose FastHistos are booked on their first fill. Only the
+            /// filled categories are written, as
+            ///   [prefix]cube_<category>_<observable>
+            /// titled with the ranges of the category; cubeproject adds
+            /// them up over any of the axes. Skim replays fill no cube, as
+            /// skims do not keep the MET.
+            //@{
+            enum cubeAxes {
+                CUBE_NLEP,
+                CUBE_NTRACKJET,
+                CUBE_NBTAG,
+                CUBE_MET,
+                CUBE_VPT,
+                CUBEAXESLEN
+            };
+
+            CategoryCube cube;
+
+            /// the histogram of each observable, named without the category
+            vector<HistoSpec> cubeSpecs;
+
+            void bookCube(HistoSet& hs, cubeObs obs, FastHisto1D& h);
+
+            /// fill the category of st, which has the track jets and b-tags
+            void fillCube(const EventState& st, HistoSet& hs);
+            //@}
+
+
+            /// @name Checkpoints
+            ///
+            /// With MC_BOOSTEDHBB_CHECKPOINT=file the histograms, cutflows,
+            /// sums of weights and the number of events analysed are
+            /// written to file every MC_BOOSTEDHBB_CHECKPOINTEVERY events
+            /// (10000), by a thread of its own (see Checkpoint.hh). A job
+            /// started again with the same file and input reads it back
+            /// and skips the events it covers, which gives exactly the
+            /// output of a run that never stopped. finalize() removes the
+            /// file. Checkpoints are taken on one thread, and not together
+            /// with skims or cut masks, which are written as the events go.
+            //@{
+            CheckpointWriter* checkpointWriter;
+            string checkpointFile;
+            unsigned long checkpointEvery;
+
+            /// events passed to analyze(), the skipped ones included
+            unsigned long nanalysed;
+
+            /// the checkpoint read by init(), until restoreCheckpoint()
+            /// takes it in, the events it covers and their number of weights
+            CheckpointData resumeData;
+            unsigned long resumeEvents;
+            size_t resumeWeights;
+
+            void writeCheckpoint();
+            void restoreCheckpoint();
+
+            /// the cutflows and FastHistos of hs
+            void saveHistos(CheckpointData& data, const HistoSet& hs) const;
+            void restoreHistos(CheckpointData& data, HistoSet& hs);
+            //@}
+
+
+            /// the staged selection of one event, for all selections. Returns
+            /// early (vetoEvent) once no selection passes.
+            void selectEvent(const Event& event);
+
+
+            /// @name Selection stages run after the jet clustering. They are
+            /// shared by analyze() and the worker threads.
+            //@{
+
+            /// AKT10 calo jet stage for all selections still passing. false
+            /// if the event is vetoed for all of them.
+            bool selectCaloJets(const Jets& akt10cjs, vector<EventState>& sts);
+            bool selectCaloJets(const Jets& akt10cjs, const Selection& sel, EventState& st);
+
+            /// VR track jet stage for all selections still passing. Writes
+            /// the event to the skim, if there is one, and continues with
+            /// selectBoostedHiggs().
+            void selectTrackJets(const Jets& antiKtVRTrackJets, vector<EventState>& sts, vector<HistoSet>& hss);
+            void selectTrackJets(const Jets& antiKtVRTrackJets, size_t iSel, EventState& st, HistoSet& hs);
+
+            /// b-tag requirements, containment of the track jets in the AKT10
+            /// jet, b hadron matching, the cutflow and all histogram fills.
+            /// Needs st.trackJets and st.btagCols.
+            void selectBoostedHiggs(EventState& st, HistoSet& hs);
+
+            /// the b-tag cut bits and, if there is an AKT10 jet at
+            /// st.boostedhiggs, whether all track jets lie within it
+            void trackJetCuts(EventState& st, bool hasCaloJet=true);
+
+            //@}
+
+
+            /// @name Jet definitions
+            //@{
+            static const double CALOJETR;
+
+            /// variable-R track jets: R = rho/pT within [RMIN, RMAX]
+            static const double VRRHO;
+            static const double VRRMIN;
+            static const double VRRMAX;
+
+            static double vrRadius(double pt);
+            //@}
+
+            /// b-tag the track jets: st.btagCols gets the positions in
+            /// st.trackJets of those a b hadron is associated to. As with
+            /// ghost association every b hadron tags one jet at most, the
+            /// nearest that has it within its variable-R radius. Uses
+            /// st.tagJetGrid.
+            void bTagged(EventState& st);
+
+
+            /// the matching of b hadrons to b-tagged track jets, from
+            /// MC_BOOSTEDHBB_MATCHING: nearest (the default), greedy or
+            /// optimal
+            DeltaRMatrix::strategy matchStrategy;
+
+            /// @name Jet clustering
+            ///
+            /// All jet collections come from the MultiRadiusJets projection,
+            /// clustered from the constituents sorted out by the
+            /// ParticlePartitioner. The small-R radii are given by
+            ///   MC_BOOSTEDHBB_SMALLJETR="0.4,0.3"
+            /// (the default); each one costs a walk over the same C/A
+            /// clustering history.
+            //@{
+
+            /// small-R jets below this are not kept
+            static const double SMALLJETPT;
+
+            /// substructure of the leading AKT10 jet for analyze()
+            JetSubstructure akt10Substructure;
+
+            /// st.substructure, computed on first use. Only called for
+            /// events that passed the preselection, so the others never
+            /// pay for it.
+            const JetSubstructure& substructure(EventState& st);
+
+            /// st.smallRJets, found on first use. Only called for events
+            /// that passed the preselection.
+            const vector<FourMomentum>& leadingSmallRJets(EventState& st);
+            //@}
+
+
+            /// @name Multi-threaded mode
+            ///
+            /// With MC_BOOSTEDHBB_NTHREADS=n (n > 0) analyze() only runs the
+            /// lepton, boson and b-hadron stages and hands the jet inputs to
+            /// n worker threads, which do the clustering and the rest of the
+            /// selection, and record the fills. analyze() replays the
+            /// fills of every finished event in dispatch order.
+            //@{
+            class Worker;
+            struct PendingEvent;
+
+            size_t nthreads;
+            vector<Worker*> workers;
+            unsigned long nDispatched;
+            double wallStart;
+
+            void startWorkers();
+            void dispatch(const ParticlePartitioner& parts);
+            void stopWorkers();
+            void mergeWorkers();
+
+            /// dispatched events not replayed yet, oldest first
+            std::deque<PendingEvent*> inFlight;
+
+            /// replay the fills of the finished events at the front of
+            /// inFlight. With wait, of all of them.
+            void replayFinished(bool wait);
+            void markFinished(PendingEvent* ev);
+            std::mutex finishedMutex;
+            std::condition_variable finishedCond;
+
+            /// finished PendingEvents, reused by dispatch() so that the
+            /// event loop does not allocate. Filled by the worker threads.
+            vector<PendingEvent*> freeEvents;
+            std::mutex freeEventsMutex;
+
+            PendingEvent* newPendingEvent();
+            void recycle(PendingEvent* ev);
+            //@}
+
+
+            /// @name Skims
+            ///
+            /// With MC_BOOSTEDHBB_SKIMOUT=file every event reaching the track
+            /// jet stage of the default selection is written to a columnar
+            /// skim (see SkimFile.hh).
+            /// With MC_BOOSTEDHBB_SKIMIN=file the input events are ignored
+            /// and finalize() refills the histograms from the skim instead,
+            /// normalised with the totals of the run that wrote it.
+            //@{
+            SkimWriter* skimWriter;
+            string skimInput;
+            string skimOutput;
+
+            void writeSkim(EventState& st);
+
+            /// refill histos from skimInput. norms gets the normalisation
+            /// of each weight.
+            void replaySkim(vector<double>& norms);
+            //@}
+
+
+            /// @name Cut masks
+            ///
+            /// With MC_BOOSTEDHBB_CUTMASKS=file the cut mask of the default
+            /// selection is written for every event, vetoed or not, with
+            /// the quantities the cuts are made on (see CutMaskFile.hh).
+            /// Every cut is evaluated, so vetoed events also run the later
+            /// projections; in multi-threaded mode the main thread clusters
+            /// the jets a second time. cutquery builds N-1 distributions
+            /// and cutflows from the file.
+            //@{
+            CutMaskWriter* cutMaskWriter;
+
+            /// scratch for the event written
+            EventState maskState;
+            CutMaskEvent cutMaskEvent;
+
+            void writeCutMask(const Event& event);
+            //@}
+
+
+            /// @name Pre-filter
+            ///
+            /// With MC_BOOSTEDHBB_PREFILTER=1 analyze() first checks every
+            /// event against the bounds of an EventPreFilter, made with the
+            /// loosest cuts of all selections, and vetoes it before any
+            /// projection runs if it fails one. With
+            /// MC_BOOSTEDHBB_PREFILTER=validate nothing is vetoed: the
+            /// events failing a bound go through the full selection, and
+            /// finalize() reports any that passed the stage the bound is
+            /// for. A selected event passes every stage, so none of those
+            /// means the pre-filter rejected no selected event. While cut
+            /// masks are written the pre-filter only validates.
+            //@{
+            enum prefilterModes {
+                PREFILTER_OFF,
+                PREFILTER_ON,
+                PREFILTER_VALIDATE
+            };
+
+            prefilterModes prefilterMode;
+            EventPreFilter preFilter;
+
+            /// bounds failed by the event being selected, one bit each
+            unsigned prefilterFailed;
+
+            /// events checked, and those failing a bound by the first one
+            /// they fail
+            unsigned long prefilterChecked;
+            vector<unsigned long> prefilterRejected;
+
+            /// events passing the stage of a bound they failed. Any of
+            /// these is a bug in the bound.
+            vector<unsigned long> prefilterMissed;
+
+            /// check the event, false if it is to be vetoed
+            bool prefilter(const Event& event);
+
+            /// an event failing bound passed its stage
+            void prefilterMiss(size_t bound);
+
+            void writePrefilter();
+            //@}
+
+
+            /// @name Instrumentation
+            ///
+            /// With MC_BOOSTEDHBB_TIMING set, analyze() records the cycles
+            /// spent and the number of calls of every stage, projection,
+            /// the b-tagging, the matching and the fills, with the
+            /// distribution of the time per call. finalize() logs a
+            /// summary, writes it to the file named by the variable unless
+            /// that is "1", and books timing_* counters and histograms.
+            /// Without it every timer is a null check.
+            //@{
+            StageTimers* stageTimers;
+            CycleClock cycleClock;
+            string timingOutput;
+
+            /// applyProjection, timed. The name is only made a string inside
+            /// the timer, so any allocation for it counts as the
+            /// projection's.
+            template <class PROJ>
+            const PROJ& applyTimed(const Event& event, const char* name, size_t timer) {
+                ScopedTimer t(stageTimers, timer);
+                return applyProjection<PROJ>(event, name);
+            }
+
+            void writeTiming();
+            //@}
+
+
+            /// @name Allocation counting
+            ///
+            /// With MC_BOOSTEDHBB_ALLOCS set the timers also count heap
+            /// allocations, as long as the process provides a counter (see
+            /// AllocCounter.hh). finalize() reports the allocations per
+            /// event made by the analysis itself, i.e. in analyze() but
+            /// outside the projections, jet clusterings and substructure
+            /// tools. Once the scratch space of the first events has grown
+            /// to size there should be none. The counters are per thread,
+            /// so counting allocations turns MC_BOOSTEDHBB_NTHREADS off.
+            //@{
+            bool countAllocs;
+
+            /// allocations by the analysis itself in the first event and
+            /// all later ones, and the later events with any
+            uint64_t ownAllocsFirst;
+            uint64_t ownAllocsLater;
+            unsigned long allocatingEvents;
+            uint64_t maxOwnAllocs;
+
+            /// counts the allocations of one analyze() call, however it
+            /// returns
+            class EventAllocations;
+
+            /// allocations so far inside the projection, clustering and
+            /// substructure timers
+            uint64_t externalAllocs() const;
+
+            void writeAllocations();
+            //@}
+
 
+            /// Analysis::getLog() builds the name of the logger on every
+            /// call, i.e. on every vetoEvent and MSG_DEBUG. This one looks
+            /// it up once.
+            Log& getLog() const;
+            mutable Log* logger;
 
-            Jets bTagged(const Jets& js);
+            /// scratch space for the b hadrons of the event
+            Particles bhadrons;
     };
 
 
@@ -0,0 +1,251 @@
+// -*- C++ -*-
+#ifndef MERGEDOUTPUTS_HH
+#define MERGEDOUTPUTS_HH
+
+#include "YODA/Counter.h"
+#include "YODA/Histo1D.h"
+#include "YODA/Histo2D.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const std::string PREFIX = "/MC_BOOSTEDHBB/";
+
+
+/// The sum of unnormalised MC_BOOSTEDHBB outputs over parts of one sample
+/// (MC_BOOSTEDHBB_UNNORMALISED), as mergeshards and treemerge add them up.
+///
+/// Histograms and counters are added by path, so the sumW counters hold
+/// the sums of weights of the whole sample. Anything that does not add is
+/// the last output's. normalised() then scales every histogram to fb with
+/// the sumW of its weight variation, as finalize() does in a single run,
+/// but leaves the timing_* objects as they are.
+///
+/// The cross section follows one of two policies. LASTXSEC takes that of
+/// the last output, as a single run takes it from its last event, so that
+/// the shards of one run, added in event order, give exactly its result.
+/// MEANXSEC takes the mean of those of the outputs weighted by their
+/// nominal sums of weights, for independent runs that each only have the
+/// estimate from their own events.
+class MergedOutputs {
+    public:
+        enum xsecPolicies { LASTXSEC, MEANXSEC };
+
+        MergedOutputs(xsecPolicies xsecPolicy)
+            : xsecPolicy(xsecPolicy), xsecSumW(0), lastXsec(0), noutputs(0),
+                xsecCounter(PREFIX + "crossSection", "cross section / pb") {
+
+            return;
+        }
+
+        ~MergedOutputs() {
+            clear();
+
+            return;
+        }
+
+        /// add the objects of one output, read from source, taking them over
+        void add(std::vector<YODA::AnalysisObject*>& aos, const std::string& source) {
+            const YODA::Counter* xsec = 0;
+            const YODA::Counter* sumW = 0;
+            for (size_t i = 0; i < aos.size(); ++i) {
+                const std::string name = analysisName(aos[i]->path());
+                if (name == "crossSection") xsec = dynamic_cast<const YODA::Counter*>(aos[i]);
+                if (name == "sumW") sumW = dynamic_cast<const YODA::Counter*>(aos[i]);
+            }
+            if (!xsec || !sumW) {
+                for (size_t i = 0; i < aos.size(); ++i)
+                    delete aos[i];
+                aos.clear();
+                throw std::runtime_error(source + " has no crossSection or sumW counter, "
+                        "it is not an unnormalised MC_BOOSTEDHBB output");
+            }
+
+            xsecSumW += xsec->sumW()*sumW->sumW();
+            lastXsec = xsec->sumW();
+            ++noutputs;
+
+            for (size_t i = 0; i < aos.size(); ++i) {
+                if (aos[i] == xsec) delete aos[i];
+                else addObject(aos[i]);
+            }
+            aos.clear();
+
+            return;
+        }
+
+        /// add other, which holds outputs after those of this one, and
+        /// empty it
+        void merge(MergedOutputs& other) {
+            for (size_t i = 0; i < other.order.size(); ++i)
+                addObject(other.order[i]);
+            other.order.clear();
+            other.byPath.clear();
+
+            xsecSumW += other.xsecSumW;
+            if (other.noutputs) lastXsec = other.lastXsec;
+            noutputs += other.noutputs;
+            other.xsecSumW = 0;
+            other.lastXsec = 0;
+            other.noutputs = 0;
+
+            return;
+        }
+
+        void clear() {
+            for (size_t i = 0; i < order.size(); ++i)
+                delete order[i];
+            order.clear();
+            byPath.clear();
+
+            return;
+        }
+
+        size_t numOutputs() const { return noutputs; }
+
+        /// the nominal sum of weights
+        double sumOfWeights() const {
+            return nominalSumW()->sumW();
+        }
+
+        /// in pb
+        double crossSection() const {
+            if (xsecPolicy == LASTXSEC) return lastXsec;
+            return xsecSumW/nominalSumW()->sumW();
+        }
+
+        /// everything to write as one unnormalised output, which add()
+        /// takes back: the objects as they are and a crossSection counter
+        std::vector<YODA::AnalysisObject*> unnormalised() {
+            xsecCounter.reset();
+            xsecCounter.fill(crossSection());
+
+            std::vector<YODA::AnalysisObject*> out(order);
+            out.push_back(&xsecCounter);
+
+            return out;
+        }
+
+        /// scale the histograms to fb and return everything to write, in
+        /// the order the paths first appeared. The sums of weights go.
+        std::vector<YODA::AnalysisObject*> normalised() {
+            const double xsec = crossSection();
+
+            std::vector<YODA::AnalysisObject*> out;
+            for (size_t i = 0; i < order.size(); ++i) {
+                YODA::AnalysisObject* ao = order[i];
+                const std::string name = analysisName(ao->path());
+                if (name.compare(0, 4, "sumW") == 0) continue;
+
+                out.push_back(ao);
+                if (name.empty() || name.compare(0, 7, "timing_") == 0) continue;
+
+                YODA::Histo1D* h1 = dynamic_cast<YODA::Histo1D*>(ao);
+                YODA::Histo2D* h2 = dynamic_cast<YODA::Histo2D*>(ao);
+                if (!h1 && !h2) continue;
+
+                const std::string sumWPath = PREFIX + "sumW" + variationSuffix(name);
+                const YODA::Counter* sumW = counter(sumWPath);
+                if (!sumW)
+                    throw std::runtime_error("no " + sumWPath + " counter for " + ao->path());
+
+                const double norm = 1000*xsec/sumW->sumW();
+                if (h1) h1->scaleW(norm);
+                if (h2) h2->scaleW(norm);
+            }
+
+            return out;
+        }
+
+    private:
+        /// the name of path in the analysis, empty for other objects
+        static std::string analysisName(const std::string& path) {
+            if (path.compare(0, PREFIX.size(), PREFIX) != 0) return std::string();
+            return path.substr(PREFIX.size());
+        }
+
+        /// the weight variation suffix of name: "[Wn]" or empty for the
+        /// nominal weight
+        static std::string variationSuffix(const std::string& name) {
+            const size_t at = name.rfind("[W");
+            if (at == std::string::npos || name[name.size() - 1] != ']') return std::string();
+            return name.substr(at);
+        }
+
+        /// add from to to, false if they cannot be added
+        static bool addTo(YODA::AnalysisObject* to, const YODA::AnalysisObject* from) {
+            if (YODA::Histo1D* h = dynamic_cast<YODA::Histo1D*>(to)) {
+                *h += dynamic_cast<const YODA::Histo1D&>(*from);
+                return true;
+            }
+            if (YODA::Histo2D* h = dynamic_cast<YODA::Histo2D*>(to)) {
+                *h += dynamic_cast<const YODA::Histo2D&>(*from);
+                return true;
+            }
+            if (YODA::Counter* c = dynamic_cast<YODA::Counter*>(to)) {
+                *c += dynamic_cast<const YODA::Counter&>(*from);
+                return true;
+            }
+
+            return false;
+        }
+
+        /// add ao, taking it over
+        void addObject(YODA::AnalysisObject* ao) {
+            const std::string path = ao->path();
+
+            std::map<std::string, YODA::AnalysisObject*>::iterator it = byPath.find(path);
+            if (it == byPath.end()) {
+                byPath[path] = ao;
+                order.push_back(ao);
+                return;
+            }
+
+            if (!addTo(it->second, ao)) {
+                std::replace(order.begin(), order.end(), it->second, ao);
+                delete it->second;
+                it->second = ao;
+                return;
+            }
+
+            delete ao;
+
+            return;
+        }
+
+        /// the counter at path, null if there is none
+        const YODA::Counter* counter(const std::string& path) const {
+            std::map<std::string, YODA::AnalysisObject*>::const_iterator it = byPath.find(path);
+            return it == byPath.end() ? 0 : dynamic_cast<const YODA::Counter*>(it->second);
+        }
+
+        const YODA::Counter* nominalSumW() const {
+            const YODA::Counter* sumW = counter(PREFIX + "sumW");
+            if (!sumW)
+                throw std::runtime_error("nothing merged");
+            return sumW;
+        }
+
+        /// by path, in the order they first appear
+        std::map<std::string, YODA::AnalysisObject*> byPath;
+        std::vector<YODA::AnalysisObject*> order;
+
+        xsecPolicies xsecPolicy;
+
+        /// the sum of cross section x nominal sum of weights of the
+        /// outputs, and the cross section of the last one
+        double xsecSumW;
+        double lastXsec;
+        size_t noutputs;
+
+        /// written by unnormalised()
+        YODA::Counter xsecCounter;
+
+        MergedOutputs(const MergedOutputs&);
+        MergedOutputs& operator=(const MergedOutputs&);
+};
+
+#endif
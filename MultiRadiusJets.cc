@@ -0,0 +1,145 @@
+// -*- C++ -*-
+#include "MultiRadiusJets.hh"
+
+#include "Rivet/Event.hh"
+#include "Rivet/Projections/FinalState.hh"
+
+#include "fastjet/JetDefinition.hh"
+#include "fastjet/contrib/VariableR.hh"
+
+namespace Rivet {
+
+MultiRadiusJets::MultiRadiusJets(const ParticlePartitioner& parts, double largeR,
+        double vrRho, double vrRmin, double vrRmax)
+    : largeR(largeR),
+        vrRho(vrRho), vrRmin(vrRmin), vrRmax(vrRmax),
+        caloParts(0),
+        trackParts(0),
+        caloAlg(FinalState(), FastJets::ANTIKT, largeR),
+        trackAlg(FinalState(), new fastjet::contrib::VariableRPlugin(vrRho, vrRmin, vrRmax,
+                    fastjet::contrib::VariableRPlugin::AKTLIKE)),
+        caloDone(false),
+        smallRDone(false),
+        trackDone(false) {
+
+    setName("MultiRadiusJets");
+    addProjection(parts, "Parts");
+
+    return;
+}
+
+
+MultiRadiusJets& MultiRadiusJets::addRadius(double r) {
+    if (r <= 0 || r >= largeR)
+        throw Exception("MultiRadiusJets: small-R jets need 0 < R < largeR");
+
+    smallRs.push_back(r);
+
+    return *this;
+}
+
+
+void MultiRadiusJets::setInputs(const ParticleBuffer& calo, const ParticleBuffer& track) {
+    caloParts = &calo;
+    trackParts = &track;
+
+    caloDone = smallRDone = trackDone = false;
+    caSeq.reset();
+
+    return;
+}
+
+
+void MultiRadiusJets::project(const Event& e) {
+    const ParticlePartitioner& parts = applyProjection<ParticlePartitioner>(e, "Parts");
+    setInputs(parts.calo(), parts.track());
+
+    return;
+}
+
+
+int MultiRadiusJets::compare(const Projection& p) const {
+    const MultiRadiusJets& other = dynamic_cast<const MultiRadiusJets&>(p);
+    return mkNamedPCmp(other, "Parts") ||
+        cmp(largeR, other.largeR) ||
+        cmp(vrRho, other.vrRho) || cmp(vrRmin, other.vrRmin) || cmp(vrRmax, other.vrRmax) ||
+        cmp(smallRs, other.smallRs);
+}
+
+
+void MultiRadiusJets::clusterCalo() const {
+    if (caloDone) return;
+    caloDone = true;
+
+    inputs.clear();
+    caloParts->appendTo(inputs);
+    caloAlg.calc(inputs);
+
+    return;
+}
+
+
+void MultiRadiusJets::clusterSmallR() const {
+    if (smallRDone) return;
+    smallRDone = true;
+
+    pseudoJets.clear();
+    pseudoJets.reserve(caloParts->size());
+    for (size_t i = 0; i < caloParts->size(); ++i)
+        pseudoJets.push_back(fastjet::PseudoJet(caloParts->px[i], caloParts->py[i],
+                    caloParts->pz[i], caloParts->E[i]));
+
+    caSeq.reset(new fastjet::ClusterSequence(pseudoJets,
+                fastjet::JetDefinition(fastjet::cambridge_algorithm, largeR)));
+
+    return;
+}
+
+
+void MultiRadiusJets::clusterTrack() const {
+    if (trackDone) return;
+    trackDone = true;
+
+    inputs.clear();
+    trackParts->appendTo(inputs);
+    trackAlg.calc(inputs);
+
+    return;
+}
+
+
+Jets MultiRadiusJets::caloJets(double ptmin) const {
+    clusterCalo();
+    return caloAlg.jetsByPt(ptmin);
+}
+
+
+const FastJets& MultiRadiusJets::caloClustering() const {
+    clusterCalo();
+    return caloAlg;
+}
+
+
+Jets MultiRadiusJets::smallRJets(size_t iR, double ptmin) const {
+    clusterSmallR();
+
+    const double r = smallRs.at(iR);
+    const vector<fastjet::PseudoJet> pjs =
+        fastjet::sorted_by_pt(caSeq->exclusive_jets(r*r/(largeR*largeR)));
+
+    Jets jets;
+    foreach (const fastjet::PseudoJet& pj, pjs) {
+        if (pj.pt() < ptmin) break;
+        jets.push_back(Jet(FourMomentum(pj.E(), pj.px(), pj.py(), pj.pz()), Particles()));
+    }
+
+    return jets;
+}
+
+
+Jets MultiRadiusJets::trackJets(double ptmin) const {
+    clusterTrack();
+    return trackAlg.jetsByPt(ptmin);
+}
+
+}
@@ -0,0 +1,101 @@
+// -*- C++ -*-
+#ifndef RIVET_MULTIRADIUSJETS_HH
+#define RIVET_MULTIRADIUSJETS_HH
+
+#include <memory>
+
+#include "Rivet/Rivet.hh"
+#include "Rivet/Jet.hh"
+#include "Rivet/Projection.hh"
+#include "Rivet/Projections/FastJets.hh"
+
+#include "fastjet/ClusterSequence.hh"
+
+#include "ParticlePartitioner.hh"
+
+namespace Rivet {
+
+    /// All jet collections of MC_BOOSTEDHBB, clustered from the inputs
+    /// sorted out by a ParticlePartitioner:
+    ///
+    ///   calo      anti-kT jets with R = largeR from the calo particles
+    ///   small-R   C/A jets from the calo particles, one collection per
+    ///             radius added with addRadius()
+    ///   track     variable-R (anti-kT like) jets from the track particles,
+    ///             R = rho/pT within [rmin, rmax]
+    ///
+    /// The small-R collections all come from a single C/A clustering with
+    /// R = largeR. C/A merges pairs in increasing Delta R, so its jets with
+    /// radius R' are exactly the state of that history once all remaining
+    /// pairs are further apart than R', i.e. its exclusive jets with
+    /// dcut = (R'/largeR)^2. Every radius after the first only costs a walk
+    /// over the history instead of a clustering.
+    ///
+    /// project() only picks up the inputs. Each clustering runs the first
+    /// time one of its collections is asked for, so an event vetoed before
+    /// it never pays for it. Outside of a Rivet run (e.g. on a worker
+    /// thread) the inputs are given with setInputs().
+    class MultiRadiusJets : public Projection {
+        public:
+            MultiRadiusJets(const ParticlePartitioner& parts, double largeR=1.0,
+                    double vrRho=60*GeV, double vrRmin=0.2, double vrRmax=0.6);
+
+            virtual const Projection* clone() const {
+                return new MultiRadiusJets(*this);
+            }
+
+            /// add a small-R collection, R < largeR
+            MultiRadiusJets& addRadius(double r);
+
+            size_t numSmallR() const { return smallRs.size(); }
+            double smallR(size_t iR) const { return smallRs[iR]; }
+
+            /// a new event. The buffers have to stay alive until the last
+            /// collection of the event has been asked for.
+            void setInputs(const ParticleBuffer& calo, const ParticleBuffer& track);
+
+            /// @name Jet collections, sorted in pT
+            //@{
+            Jets caloJets(double ptmin=0) const;
+            Jets smallRJets(size_t iR, double ptmin=0) const;
+            Jets trackJets(double ptmin=0) const;
+            //@}
+
+            /// the clustering behind caloJets()
+            const FastJets& caloClustering() const;
+
+        protected:
+            void project(const Event& e);
+            int compare(const Projection& p) const;
+
+        private:
+            void clusterCalo() const;
+            void clusterSmallR() const;
+            void clusterTrack() const;
+
+            double largeR;
+            double vrRho, vrRmin, vrRmax;
+            vector<double> smallRs;
+
+            const ParticleBuffer* caloParts;
+            const ParticleBuffer* trackParts;
+
+            /// @name Clusterings of the current event, run on first use
+            //@{
+            mutable FastJets caloAlg;
+            mutable FastJets trackAlg;
+            mutable std::shared_ptr<fastjet::ClusterSequence> caSeq;
+
+            mutable bool caloDone;
+            mutable bool smallRDone;
+            mutable bool trackDone;
+
+            /// scratch space for the inputs
+            mutable Particles inputs;
+            mutable vector<fastjet::PseudoJet> pseudoJets;
+            //@}
+    };
+
+}
+
+#endif
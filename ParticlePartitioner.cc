@@ -0,0 +1,97 @@
+// -*- C++ -*-
+#include "ParticlePartitioner.hh"
+
+#include "Rivet/Event.hh"
+
+#include <cmath>
+#include <cstdlib>
+
+namespace Rivet {
+
+void ParticleBuffer::appendTo(Particles& out) const {
+    out.reserve(out.size() + size());
+    for (size_t i = 0; i < size(); ++i)
+        out.push_back(Particle(pid[i], momentum(i)));
+
+    return;
+}
+
+
+ParticlePartitioner::ParticlePartitioner(double lepEtaMax, double lepPtMin,
+        double caloEtaMax, double trackEtaMax, double trackPtMin, double visPtMin)
+    : lepEtaMax(lepEtaMax), lepPtMin(lepPtMin),
+        caloEtaMax(caloEtaMax),
+        trackEtaMax(trackEtaMax), trackPtMin(trackPtMin),
+        visPtMin(visPtMin) {
+
+    setName("ParticlePartitioner");
+
+    return;
+}
+
+
+bool isInvisible(PdgId pid) {
+    const PdgId apid = std::abs(pid);
+    return PID::isNeutrino(pid) || apid == 1000022 || apid == 1000039;
+}
+
+
+void ParticlePartitioner::project(const Event& e) {
+    leptonBuf.clear();
+    neutrinoBuf.clear();
+    caloBuf.clear();
+    trackBuf.clear();
+
+    double vis[4] = {0, 0, 0, 0};
+
+    const GenEvent* ge = e.genEvent();
+    for (GenEvent::particle_const_iterator it = ge->particles_begin(); it != ge->particles_end(); ++it) {
+        const GenParticle* gp = *it;
+        if (gp->status() != 1) continue;
+
+        const HepMC::FourVector& p = gp->momentum();
+        const PdgId pid = gp->pdg_id();
+        const double pt = p.perp();
+        const double abseta = std::fabs(p.eta());
+
+        if (abseta < caloEtaMax && pt >= visPtMin && !isInvisible(pid)) {
+            vis[0] += p.e();
+            vis[1] += p.px();
+            vis[2] += p.py();
+            vis[3] += p.pz();
+        }
+
+        // hard leptons and neutrinos are kept out of the jets
+        if (abseta < lepEtaMax && pt >= lepPtMin) {
+            if (PID::isChLepton(pid)) {
+                leptonBuf.push_back(pid, p.px(), p.py(), p.pz(), p.e());
+                continue;
+            }
+            if (PID::isNeutrino(pid)) {
+                neutrinoBuf.push_back(pid, p.px(), p.py(), p.pz(), p.e());
+                continue;
+            }
+        }
+
+        if (abseta < caloEtaMax)
+            caloBuf.push_back(pid, p.px(), p.py(), p.pz(), p.e());
+
+        if (abseta < trackEtaMax && pt >= trackPtMin && PID::threeCharge(pid) != 0)
+            trackBuf.push_back(pid, p.px(), p.py(), p.pz(), p.e());
+    }
+
+    visible = FourMomentum(vis[0], vis[1], vis[2], vis[3]);
+
+    return;
+}
+
+
+int ParticlePartitioner::compare(const Projection& p) const {
+    const ParticlePartitioner& other = dynamic_cast<const ParticlePartitioner&>(p);
+    return cmp(lepEtaMax, other.lepEtaMax) || cmp(lepPtMin, other.lepPtMin) ||
+        cmp(caloEtaMax, other.caloEtaMax) ||
+        cmp(trackEtaMax, other.trackEtaMax) || cmp(trackPtMin, other.trackPtMin) ||
+        cmp(visPtMin, other.visPtMin);
+}
+
+}
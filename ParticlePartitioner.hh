@@ -0,0 +1,104 @@
+// -*- C++ -*-
+#ifndef RIVET_PARTICLEPARTITIONER_HH
+#define RIVET_PARTICLEPARTITIONER_HH
+
+#include "Rivet/Rivet.hh"
+#include "Rivet/Particle.hh"
+#include "Rivet/Projection.hh"
+#include "Rivet/Math/Vector4.hh"
+
+namespace Rivet {
+
+    /// Ids and momenta of a set of particles as structure of arrays.
+    class ParticleBuffer {
+        public:
+            void clear() {
+                pid.clear();
+                px.clear();
+                py.clear();
+                pz.clear();
+                E.clear();
+            }
+
+            void push_back(PdgId id, double x, double y, double z, double e) {
+                pid.push_back(id);
+                px.push_back(x);
+                py.push_back(y);
+                pz.push_back(z);
+                E.push_back(e);
+            }
+
+            size_t size() const { return pid.size(); }
+            bool empty() const { return pid.empty(); }
+
+            FourMomentum momentum(size_t i) const {
+                return FourMomentum(E[i], px[i], py[i], pz[i]);
+            }
+
+            /// append the particles to out, without links to the GenEvent
+            void appendTo(Particles& out) const;
+
+            vector<PdgId> pid;
+            vector<double> px;
+            vector<double> py;
+            vector<double> pz;
+            vector<double> E;
+    };
+
+
+    /// neutrinos and the usual invisible BSM particles, as in
+    /// VisibleFinalState
+    bool isInvisible(PdgId pid);
+
+
+    /// Sorts the final state into everything MC_BOOSTEDHBB needs from it,
+    /// in one pass over the event:
+    ///
+    ///   leptons     charged leptons with |eta| < lepEtaMax and pT >= lepPtMin
+    ///   neutrinos   neutrinos with the same cuts
+    ///   calo        the rest with |eta| < caloEtaMax
+    ///   track       the rest that is charged, with |eta| < trackEtaMax and
+    ///               pT >= trackPtMin
+    ///   visible     summed momentum of the visible particles with
+    ///               |eta| < caloEtaMax and pT >= visPtMin, leptons included
+    ///
+    /// This replaces ChargedLeptons, MissingMomentum and the vetoed final
+    /// states of the jet inputs, which each walked the event on their own.
+    class ParticlePartitioner : public Projection {
+        public:
+            ParticlePartitioner(double lepEtaMax=2.5, double lepPtMin=25*GeV,
+                    double caloEtaMax=4.2,
+                    double trackEtaMax=2.5, double trackPtMin=5*GeV,
+                    double visPtMin=0.5*GeV);
+
+            virtual const Projection* clone() const {
+                return new ParticlePartitioner(*this);
+            }
+
+            const ParticleBuffer& leptons() const { return leptonBuf; }
+            const ParticleBuffer& neutrinos() const { return neutrinoBuf; }
+            const ParticleBuffer& calo() const { return caloBuf; }
+            const ParticleBuffer& track() const { return trackBuf; }
+
+            const FourMomentum& visibleMomentum() const { return visible; }
+
+        protected:
+            void project(const Event& e);
+            int compare(const Projection& p) const;
+
+        private:
+            double lepEtaMax, lepPtMin;
+            double caloEtaMax;
+            double trackEtaMax, trackPtMin;
+            double visPtMin;
+
+            ParticleBuffer leptonBuf;
+            ParticleBuffer neutrinoBuf;
+            ParticleBuffer caloBuf;
+            ParticleBuffer trackBuf;
+            FourMomentum visible;
+    };
+
+}
+
+#endif
@@ -0,0 +1,279 @@
+// -*- C++ -*-
+#include "SkimFile.hh"
+
+#include <cstring>
+
+namespace Rivet {
+
+static const char FILEMAGIC[8] = {'M', 'C', 'B', 'H', 'S', 'K', 'M', '4'};
+static const char WRITER[] = "SkimWriter";
+static const char READER[] = "SkimReader";
+
+
+static void writeBytes(FILE* file, const void* p, size_t n) {
+    ColumnarFile::writeBytes(file, p, n, WRITER);
+
+    return;
+}
+
+
+template <class T>
+static void writeColumn(FILE* file, const vector<T>& col) {
+    ColumnarFile::writeColumn(file, col, WRITER);
+
+    return;
+}
+
+
+template <class T>
+static const T* column(const char* data, size_t size, size_t& pos, uint64_t n) {
+    return ColumnarFile::column<T>(data, size, pos, n, READER);
+}
+
+
+static void pushFourMom(vector<double>* cols, const FourMomentum& p) {
+    cols[0].push_back(p.E());
+    cols[1].push_back(p.px());
+    cols[2].push_back(p.py());
+    cols[3].push_back(p.pz());
+
+    return;
+}
+
+
+// bytes of the 32 and 8 bit columns of a block
+static uint64_t narrowColumns(uint64_t nev, uint64_t ntj) {
+    return 5*sizeof(uint32_t)*nev + ntj;
+}
+
+
+static FourMomentum fourMom(const double* const* cols, uint64_t i) {
+    return FourMomentum(cols[0][i], cols[1][i], cols[2][i], cols[3][i]);
+}
+
+
+SkimWriter::SkimWriter(const string& filename, size_t nweights, size_t blocksize)
+    : nweights(nweights), blocksize(blocksize), nwritten(0), weights(nweights) {
+
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+        throw Exception("SkimWriter: cannot open " + filename);
+
+    const uint64_t nw = nweights;
+    writeBytes(file, FILEMAGIC, sizeof(FILEMAGIC));
+    writeBytes(file, &nw, sizeof(nw));
+
+    return;
+}
+
+
+SkimWriter::~SkimWriter() {
+    if (!file) return;
+
+    // no footer: readers see a file from an unfinished run
+    flush();
+    fclose(file);
+
+    return;
+}
+
+
+void SkimWriter::write(const SkimEvent& ev) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (ev.weights.size() != nweights)
+        throw Exception("SkimWriter: wrong number of weights");
+
+    for (size_t iw = 0; iw < nweights; ++iw)
+        weights[iw].push_back(ev.weights[iw]);
+    pushFourMom(vboson, ev.vboson);
+    pushFourMom(higgs, ev.higgs);
+    substructure[0].push_back(ev.tau21);
+    substructure[1].push_back(ev.filteredMass);
+    substructure[2].push_back(ev.trimmedMass);
+    foreach (const FourMomentum& p, ev.trackJets)
+        pushFourMom(trackJets, p);
+    foreach (const FourMomentum& p, ev.bhads)
+        pushFourMom(bhads, p);
+    foreach (const FourMomentum& p, ev.smallRJets)
+        pushFourMom(smallRJets, p);
+
+    cutMask.push_back(ev.cutMask);
+    lepchan.push_back(ev.lepchan);
+    ntrackJets.push_back(ev.trackJets.size());
+    nbhads.push_back(ev.bhads.size());
+    nsmallRJets.push_back(ev.smallRJets.size());
+    btags.insert(btags.end(), ev.btags.begin(), ev.btags.end());
+
+    ++nwritten;
+    if (cutMask.size() >= blocksize) flush();
+
+    return;
+}
+
+
+void SkimWriter::close(const vector<double>& sumw, double xsec, uint64_t nevents) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+
+    if (sumw.size() != nweights)
+        throw Exception("SkimWriter: wrong number of weights");
+
+    flush();
+
+    ColumnarFile::writeTag(file, ColumnarFile::FOOTER, WRITER);
+    writeBytes(file, &xsec, sizeof(xsec));
+    writeBytes(file, &nevents, sizeof(nevents));
+    writeColumn(file, sumw);
+
+    fclose(file);
+    file = 0;
+
+    return;
+}
+
+
+void SkimWriter::flush() {
+    if (cutMask.empty()) return;
+
+    const uint64_t counts[4] = { cutMask.size(), btags.size(), bhads[0].size(), smallRJets[0].size() };
+    ColumnarFile::writeTag(file, ColumnarFile::BLOCK, WRITER);
+    writeBytes(file, counts, sizeof(counts));
+
+    // doubles first, so every column stays 8-byte aligned in the map
+    for (size_t iw = 0; iw < nweights; ++iw) writeColumn(file, weights[iw]);
+    for (size_t i = 0; i < 4; ++i) writeColumn(file, vboson[i]);
+    for (size_t i = 0; i < 4; ++i) writeColumn(file, higgs[i]);
+    for (size_t i = 0; i < 3; ++i) writeColumn(file, substructure[i]);
+    for (size_t i = 0; i < 4; ++i) writeColumn(file, trackJets[i]);
+    for (size_t i = 0; i < 4; ++i) writeColumn(file, bhads[i]);
+    for (size_t i = 0; i < 4; ++i) writeColumn(file, smallRJets[i]);
+
+    writeColumn(file, cutMask);
+    writeColumn(file, lepchan);
+    writeColumn(file, ntrackJets);
+    writeColumn(file, nbhads);
+    writeColumn(file, nsmallRJets);
+    writeColumn(file, btags);
+
+    ColumnarFile::writePadding(file, narrowColumns(cutMask.size(), btags.size()), WRITER);
+
+    for (size_t iw = 0; iw < nweights; ++iw) weights[iw].clear();
+    for (size_t i = 0; i < 4; ++i) {
+        vboson[i].clear();
+        higgs[i].clear();
+        trackJets[i].clear();
+        bhads[i].clear();
+        smallRJets[i].clear();
+    }
+    for (size_t i = 0; i < 3; ++i) substructure[i].clear();
+    cutMask.clear();
+    lepchan.clear();
+    ntrackJets.clear();
+    nbhads.clear();
+    nsmallRJets.clear();
+    btags.clear();
+
+    return;
+}
+
+
+SkimReader::SkimReader(const string& filename)
+    : data(0), size(0), pos(0), nweights(0),
+        nev(0), ntj(0), nbh(0), nsj(0), iev(0), itj(0), ibh(0), isj(0),
+        footer(false), xsec(0), nevents(0) {
+
+    mapped.open(filename, READER);
+    data = mapped.data();
+    size = mapped.size();
+
+    if (size < sizeof(FILEMAGIC) + sizeof(uint64_t) || memcmp(data, FILEMAGIC, sizeof(FILEMAGIC)) != 0)
+        throw Exception("SkimReader: " + filename + " is not a skim file");
+    pos = sizeof(FILEMAGIC);
+    nweights = *column<uint64_t>(data, size, pos, 1);
+    weights.resize(nweights);
+
+    return;
+}
+
+
+bool SkimReader::nextBlock() {
+    const ColumnarFile::sections section = ColumnarFile::readTag(data, size, pos, READER);
+    if (section == ColumnarFile::END) return false;
+
+    if (section == ColumnarFile::FOOTER) {
+        if (size - pos < (2 + nweights)*8) return false;
+
+        memcpy(&xsec, data + pos, 8);
+        memcpy(&nevents, data + pos + 8, 8);
+        sumw.resize(nweights);
+        memcpy(sumw.data(), data + pos + 16, nweights*8);
+        pos = size;
+        footer = true;
+        return false;
+    }
+
+    const uint64_t* counts = column<uint64_t>(data, size, pos, 4);
+    nev = counts[0];
+    ntj = counts[1];
+    nbh = counts[2];
+    nsj = counts[3];
+
+    for (size_t iw = 0; iw < nweights; ++iw) weights[iw] = column<double>(data, size, pos, nev);
+    for (size_t i = 0; i < 4; ++i) vboson[i] = column<double>(data, size, pos, nev);
+    for (size_t i = 0; i < 4; ++i) higgs[i] = column<double>(data, size, pos, nev);
+    for (size_t i = 0; i < 3; ++i) substructure[i] = column<double>(data, size, pos, nev);
+    for (size_t i = 0; i < 4; ++i) trackJets[i] = column<double>(data, size, pos, ntj);
+    for (size_t i = 0; i < 4; ++i) bhads[i] = column<double>(data, size, pos, nbh);
+    for (size_t i = 0; i < 4; ++i) smallRJets[i] = column<double>(data, size, pos, nsj);
+
+    cutMask = column<uint32_t>(data, size, pos, nev);
+    lepchan = column<uint32_t>(data, size, pos, nev);
+    ntrackJets = column<uint32_t>(data, size, pos, nev);
+    nbhads = column<uint32_t>(data, size, pos, nev);
+    nsmallRJets = column<uint32_t>(data, size, pos, nev);
+    btags = column<uint8_t>(data, size, pos, ntj);
+    column<uint8_t>(data, size, pos, ColumnarFile::padding(narrowColumns(nev, ntj)));
+
+    iev = itj = ibh = isj = 0;
+
+    return true;
+}
+
+
+bool SkimReader::next(SkimEvent& ev) {
+    while (iev == nev)
+        if (!nextBlock()) return false;
+
+    ev.weights.resize(nweights);
+    for (size_t iw = 0; iw < nweights; ++iw)
+        ev.weights[iw] = weights[iw][iev];
+    ev.cutMask = cutMask[iev];
+    ev.lepchan = lepchan[iev];
+    ev.vboson = fourMom(vboson, iev);
+    ev.higgs = fourMom(higgs, iev);
+    ev.tau21 = substructure[0][iev];
+    ev.filteredMass = substructure[1][iev];
+    ev.trimmedMass = substructure[2][iev];
+
+    ev.trackJets.clear();
+    ev.btags.clear();
+    for (uint32_t i = 0; i < ntrackJets[iev]; ++i, ++itj) {
+        ev.trackJets.push_back(fourMom(trackJets, itj));
+        ev.btags.push_back(btags[itj]);
+    }
+
+    ev.bhads.clear();
+    for (uint32_t i = 0; i < nbhads[iev]; ++i, ++ibh)
+        ev.bhads.push_back(fourMom(bhads, ibh));
+
+    ev.smallRJets.clear();
+    for (uint32_t i = 0; i < nsmallRJets[iev]; ++i, ++isj)
+        ev.smallRJets.push_back(fourMom(smallRJets, isj));
+
+    ++iev;
+
+    return true;
+}
+
+}
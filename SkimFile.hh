@@ -0,0 +1,159 @@
+// -*- C++ -*-
+#ifndef RIVET_SKIMFILE_HH
+#define RIVET_SKIMFILE_HH
+
+#include "Rivet/Rivet.hh"
+#include "Rivet/Math/Vector4.hh"
+
+#include <cstdio>
+#include <mutex>
+#include <stdint.h>
+
+#include "ColumnarFile.hh"
+
+namespace Rivet {
+
+    /// The physics objects MC_BOOSTEDHBB keeps for one selected event.
+    struct SkimEvent {
+        SkimEvent()
+            : cutMask(0), lepchan(0),
+                tau21(0), filteredMass(0), trimmedMass(0) {
+
+            return;
+        }
+
+        /// nominal weight followed by the variations
+        vector<double> weights;
+        uint32_t cutMask;
+        uint32_t lepchan;
+
+        FourMomentum vboson;
+        FourMomentum higgs;
+
+        /// substructure of the higgs candidate, 0 if not computed
+        double tau21;
+        double filteredMass;
+        double trimmedMass;
+
+        vector<FourMomentum> trackJets;
+        vector<uint8_t> btags;      // one flag per track jet
+        vector<FourMomentum> bhads;
+
+        /// the leading small-R jets, empty if not computed
+        vector<FourMomentum> smallRJets;
+    };
+
+
+    /// Writes SkimEvents to a compact columnar binary file.
+    ///
+    /// Events are collected into blocks. Each block stores every quantity
+    /// as one contiguous array (native byte order), so a reader can map
+    /// the file and use the arrays in place. A footer with the run totals
+    /// needed for normalisation is written by close().
+    ///
+    /// Layout:
+    ///   "MCBHSKM4" nweights
+    ///   blocks:  "BLCK" pad nev ntj nbh nsj
+    ///            weight[nweights][nev]
+    ///            vboson E,px,py,pz[nev]  higgs E,px,py,pz[nev]
+    ///            tau21[nev] filteredmass[nev] trimmedmass[nev]
+    ///            trackjet E,px,py,pz[ntj]  bhad E,px,py,pz[nbh]
+    ///            smallrjet E,px,py,pz[nsj]
+    ///            cutmask[nev] lepchan[nev] ntrackjets[nev] nbhads[nev]
+    ///            nsmallrjets[nev]
+    ///            btag[ntj]  padding to 8 bytes
+    ///   footer:  "END_" pad xsec nevents sumw[nweights]
+    ///
+    /// write() may be called from several threads.
+    class SkimWriter {
+        public:
+            SkimWriter(const string& filename, size_t nweights, size_t blocksize=4096);
+            ~SkimWriter();
+
+            void write(const SkimEvent& ev);
+
+            /// flush and write the footer. sumw (one per weight) and nevents
+            /// are the totals over all events the analysis saw, not only the
+            /// skimmed ones.
+            void close(const vector<double>& sumw, double xsec, uint64_t nevents);
+
+            uint64_t numWritten() const { return nwritten; }
+
+        private:
+            void flush();
+
+            FILE* file;
+            size_t nweights;
+            size_t blocksize;
+            uint64_t nwritten;
+            std::mutex mutex;
+
+            vector<vector<double> > weights;
+            vector<double> vboson[4];
+            vector<double> higgs[4];
+            vector<double> substructure[3];
+            vector<double> trackJets[4];
+            vector<double> bhads[4];
+            vector<double> smallRJets[4];
+            vector<uint32_t> cutMask;
+            vector<uint32_t> lepchan;
+            vector<uint32_t> ntrackJets;
+            vector<uint32_t> nbhads;
+            vector<uint32_t> nsmallRJets;
+            vector<uint8_t> btags;
+    };
+
+
+    /// Reads a skim file through a read-only memory map.
+    class SkimReader {
+        public:
+            SkimReader(const string& filename);
+
+            /// next event, false at the end of the file
+            bool next(SkimEvent& ev);
+
+            /// whether the writer got to write the footer
+            bool hasFooter() const { return footer; }
+
+            size_t numWeights() const { return nweights; }
+
+            /// sum of weights of the run that wrote the skim, per weight
+            const vector<double>& sumOfWeights() const { return sumw; }
+            double crossSection() const { return xsec; }
+            uint64_t numEvents() const { return nevents; }
+
+        private:
+            bool nextBlock();
+
+            MappedFile mapped;
+            const char* data;
+            size_t size;
+            size_t pos;
+            size_t nweights;
+
+            // current block
+            uint64_t nev, ntj, nbh, nsj;
+            uint64_t iev, itj, ibh, isj;
+            vector<const double*> weights;
+            const double* vboson[4];
+            const double* higgs[4];
+            const double* substructure[3];
+            const double* trackJets[4];
+            const double* bhads[4];
+            const double* smallRJets[4];
+            const uint32_t* cutMask;
+            const uint32_t* lepchan;
+            const uint32_t* ntrackJets;
+            const uint32_t* nbhads;
+            const uint32_t* nsmallRJets;
+            const uint8_t* btags;
+
+            bool footer;
+            vector<double> sumw;
+            double xsec;
+            uint64_t nevents;
+    };
+
+}
+
+#endif
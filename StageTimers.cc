@@ -0,0 +1,52 @@
+// -*- C++ -*-
+#include "StageTimers.hh"
+
+namespace Rivet {
+
+const unsigned int StageTimers::MINLOG2;
+const unsigned int StageTimers::NLATENCYBINS;
+
+
+void StageTimers::merge(const StageTimers& other) {
+    for (size_t i = 0; i < cycles.size(); ++i) {
+        cycles[i] += other.cycles[i];
+        calls[i] += other.calls[i];
+        allocs[i] += other.allocs[i];
+    }
+    for (size_t i = 0; i < latency.size(); ++i)
+        latency[i] += other.latency[i];
+
+    return;
+}
+
+
+static double steadySeconds() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void CycleClock::start() {
+    wall0 = steadySeconds();
+    cycles0 = cycleCount();
+
+    return;
+}
+
+
+void CycleClock::stop() {
+    wall1 = steadySeconds();
+    cycles1 = cycleCount();
+
+    return;
+}
+
+
+double CycleClock::secondsPerCycle() const {
+    // too short a run to calibrate: assume 1 GHz
+    if (cycles1 <= cycles0 || wall1 - wall0 < 1e-3) return 1e-9;
+
+    return (wall1 - wall0)/(cycles1 - cycles0);
+}
+
+}
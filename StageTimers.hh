@@ -0,0 +1,168 @@
+// -*- C++ -*-
+#ifndef RIVET_STAGETIMERS_HH
+#define RIVET_STAGETIMERS_HH
+
+#include "Rivet/Rivet.hh"
+
+#include "AllocCounter.hh"
+
+#include <chrono>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Rivet {
+
+    /// monotonic cycle counter: the time stamp counter where there is one,
+    /// nanoseconds of the steady clock otherwise.
+    inline uint64_t cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+
+    /// Call counts, total cycles, heap allocations (where the process
+    /// counts them, see AllocCounter.hh) and a latency histogram for a
+    /// fixed set of timers. Not thread safe: every thread keeps its own,
+    /// and they are merged at the end.
+    class StageTimers {
+        public:
+            /// latency bins are powers of two cycles, from 2^MINLOG2 to
+            /// 2^(MINLOG2+NLATENCYBINS). the first and last bin also take
+            /// everything below and above.
+            static const unsigned int MINLOG2 = 6;
+            static const unsigned int NLATENCYBINS = 36;
+
+            StageTimers(size_t ntimers)
+                : cycles(ntimers, 0),
+                    calls(ntimers, 0),
+                    allocs(ntimers, 0),
+                    latency(ntimers*NLATENCYBINS, 0) {
+
+                return;
+            }
+
+            void add(size_t timer, uint64_t dt, uint64_t nallocs) {
+                cycles[timer] += dt;
+                ++calls[timer];
+                allocs[timer] += nallocs;
+                ++latency[timer*NLATENCYBINS + latencyBin(dt)];
+            }
+
+            void merge(const StageTimers& other);
+
+            static size_t latencyBin(uint64_t dt) {
+                const unsigned int log2 = dt ? 63 - __builtin_clzll(dt) : 0;
+                if (log2 <= MINLOG2) return 0;
+                return std::min<unsigned int>(log2 - MINLOG2, NLATENCYBINS - 1);
+            }
+
+            vector<uint64_t> cycles;
+            vector<uint64_t> calls;
+            vector<uint64_t> allocs;
+            vector<uint64_t> latency;
+    };
+
+
+    /// Adds the time until it goes out of scope, or until stop(), to a
+    /// timer. Does nothing without timers.
+    class ScopedTimer {
+        public:
+            ScopedTimer(StageTimers* timers, size_t timer)
+                : timers(timers), timer(timer),
+                    start(timers ? cycleCount() : 0),
+                    allocs0(timers ? heapAllocations() : 0) {
+
+                return;
+            }
+
+            ~ScopedTimer() {
+                stop();
+            }
+
+            void stop() {
+                if (timers) timers->add(timer, cycleCount() - start, heapAllocations() - allocs0);
+                timers = 0;
+            }
+
+        private:
+            StageTimers* timers;
+            size_t timer;
+            uint64_t start;
+            uint64_t allocs0;
+    };
+
+
+    /// Times consecutive stages: each call to next() closes the current
+    /// stage and opens another. The stage open when it goes out of scope
+    /// is closed then, and the whole time is added to a total timer.
+    class StageLaps {
+        public:
+            StageLaps(StageTimers* timers, size_t total, size_t first)
+                : timers(timers), total(total), stage(first),
+                    start(timers ? cycleCount() : 0), lap(start),
+                    allocs0(timers ? heapAllocations() : 0), lapAllocs(allocs0) {
+
+                return;
+            }
+
+            ~StageLaps() {
+                if (!timers) return;
+
+                const uint64_t now = cycleCount();
+                const uint64_t nowAllocs = heapAllocations();
+                timers->add(stage, now - lap, nowAllocs - lapAllocs);
+                timers->add(total, now - start, nowAllocs - allocs0);
+            }
+
+            void next(size_t nextStage) {
+                if (timers) {
+                    const uint64_t now = cycleCount();
+                    const uint64_t nowAllocs = heapAllocations();
+                    timers->add(stage, now - lap, nowAllocs - lapAllocs);
+                    lap = now;
+                    lapAllocs = nowAllocs;
+                }
+                stage = nextStage;
+            }
+
+        private:
+            StageTimers* timers;
+            size_t total;
+            size_t stage;
+            uint64_t start;
+            uint64_t lap;
+            uint64_t allocs0;
+            uint64_t lapAllocs;
+    };
+
+
+    /// Converts cycles to seconds by comparing the cycle counter with the
+    /// wall clock between start() and stop().
+    class CycleClock {
+        public:
+            CycleClock()
+                : cycles0(0), cycles1(0), wall0(0), wall1(0) {
+
+                return;
+            }
+
+            void start();
+            void stop();
+
+            double secondsPerCycle() const;
+
+        private:
+            uint64_t cycles0, cycles1;
+            double wall0, wall1;
+    };
+
+}
+
+#endif
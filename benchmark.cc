@@ -0,0 +1,609 @@
+// -*- C++ -*-
+//
+// Throughput benchmark of MC_BOOSTEDHBB on reproducible synthetic events,
+// plus microbenchmarks of the histogram fills, the b-tagging and the
+// Delta R matching:
+//
+//     benchmark [nevents [seed]]
+//
+// The benchmark counts heap allocations (AllocCounter.cc is linked in).
+// With MC_BOOSTEDHBB_ALLOCS=1 it fails if the analysis itself allocates in
+// any event after the warm-up. It also fails if the FastHistos do not
+// give exactly what filling YODA histograms directly does.
+//
+// The events are ZH->llbb-like and ttbar-like (one leptonic W), generated
+// locally from the seed, so two runs with the same arguments analyse the
+// same events. The benchmark links against RivetMC_BOOSTEDHBB.so in this
+// directory, so it measures the plugin build that would be installed. The
+// MC_BOOSTEDHBB_* options apply as usual.
+
+#include "Rivet/AnalysisHandler.hh"
+#include "HepMC/GenEvent.h"
+
+#include "MC_BOOSTEDHBB.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using std::vector;
+using Rivet::FourMomentum;
+
+
+// seconds on a monotonic clock
+static double wallTime() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/// Generates simple collider-like events. Decays are isotropic two-body
+/// decays, hadronisation is a collimated spray of pions and photons and the
+/// underlying event is a flat spread of soft particles. Good enough to
+/// exercise every stage of the selection with realistic multiplicities.
+class EventGenerator {
+    public:
+        EventGenerator(unsigned int seed)
+            : rng(seed) {
+
+            return;
+        }
+
+        HepMC::GenEvent* zhllbb(int evnum);
+        HepMC::GenEvent* ttbar(int evnum);
+
+    private:
+        // uniform in [a, b). mt19937 output is the same everywhere, the
+        // std distributions are not.
+        double uniform(double a, double b) {
+            return a + (b - a)*(rng()/4294967296.0);
+        }
+
+        double gauss(double mean, double sigma) {
+            const double u1 = uniform(1e-12, 1);
+            const double u2 = uniform(0, 1);
+            return mean + sigma*std::sqrt(-2*std::log(u1))*std::cos(2*M_PI*u2);
+        }
+
+        FourMomentum ptEtaPhiM(double pt, double eta, double phi, double m) {
+            const double px = pt*std::cos(phi);
+            const double py = pt*std::sin(phi);
+            const double pz = pt*std::sinh(eta);
+            return FourMomentum(std::sqrt(px*px + py*py + pz*pz + m*m), px, py, pz);
+        }
+
+        HepMC::GenEvent* newEvent(int evnum, HepMC::GenVertex*& hard);
+        void decay(const FourMomentum& parent, double m1, double m2, FourMomentum& p1, FourMomentum& p2);
+        void addParticle(HepMC::GenVertex* vtx, const FourMomentum& p, int pid);
+        void addSpray(HepMC::GenVertex* vtx, const FourMomentum& p, double width);
+        void addBQuark(HepMC::GenEvent* ge, HepMC::GenVertex* vtx, const FourMomentum& p, int sign);
+        void addUnderlyingEvent(HepMC::GenVertex* vtx);
+
+        std::mt19937 rng;
+};
+
+
+HepMC::GenEvent* EventGenerator::newEvent(int evnum, HepMC::GenVertex*& hard) {
+    HepMC::GenEvent* ge = new HepMC::GenEvent(0, evnum);
+    ge->use_units(HepMC::Units::GEV, HepMC::Units::MM);
+    ge->weights().push_back(1.0);
+
+    HepMC::GenParticle* beam1 = new HepMC::GenParticle(HepMC::FourVector(0, 0, 6500, 6500), 2212, 4);
+    HepMC::GenParticle* beam2 = new HepMC::GenParticle(HepMC::FourVector(0, 0, -6500, 6500), 2212, 4);
+    hard = new HepMC::GenVertex();
+    hard->add_particle_in(beam1);
+    hard->add_particle_in(beam2);
+    ge->add_vertex(hard);
+    ge->set_beam_particles(beam1, beam2);
+
+    return ge;
+}
+
+
+/// isotropic two-body decay of parent into p1 and p2 with masses m1 and m2
+void EventGenerator::decay(const FourMomentum& parent, double m1, double m2,
+        FourMomentum& p1, FourMomentum& p2) {
+
+    const double m = parent.mass();
+    const double pstar = std::sqrt(std::max(0.0,
+                (m*m - (m1 + m2)*(m1 + m2))*(m*m - (m1 - m2)*(m1 - m2))))/(2*m);
+
+    const double cost = uniform(-1, 1);
+    const double sint = std::sqrt(1 - cost*cost);
+    const double phi = uniform(0, 2*M_PI);
+    const double px = pstar*sint*std::cos(phi);
+    const double py = pstar*sint*std::sin(phi);
+    const double pz = pstar*cost;
+
+    // boost both from the parent rest frame
+    const double bx = parent.px()/parent.E();
+    const double by = parent.py()/parent.E();
+    const double bz = parent.pz()/parent.E();
+    const double b2 = bx*bx + by*by + bz*bz;
+    const double gamma = 1/std::sqrt(1 - b2);
+    const double gamma2 = b2 > 0 ? (gamma - 1)/b2 : 0;
+
+    for (int sign = 1; sign >= -1; sign -= 2) {
+        const double e = std::sqrt(pstar*pstar + (sign > 0 ? m1*m1 : m2*m2));
+        const double bp = sign*(bx*px + by*py + bz*pz);
+        const double k = gamma2*bp + gamma*e;
+        FourMomentum p(gamma*(e + bp), sign*px + k*bx, sign*py + k*by, sign*pz + k*bz);
+        (sign > 0 ? p1 : p2) = p;
+    }
+
+    return;
+}
+
+
+void EventGenerator::addParticle(HepMC::GenVertex* vtx, const FourMomentum& p, int pid) {
+    vtx->add_particle_out(new HepMC::GenParticle(
+                HepMC::FourVector(p.px(), p.py(), p.pz(), p.E()), pid, 1));
+
+    return;
+}
+
+
+/// hadronise p into a spray of pions and photons around its direction
+void EventGenerator::addSpray(HepMC::GenVertex* vtx, const FourMomentum& p, double width) {
+    const size_t n = 3 + (size_t) uniform(0, std::min(20.0, 2 + p.pT()/10));
+
+    vector<double> fractions(n);
+    double sum = 0;
+    foreach (double& f, fractions) {
+        f = uniform(0.05, 1);
+        sum += f;
+    }
+
+    foreach (double f, fractions) {
+        const double r = uniform(0, 1);
+        const int pid = r < 0.33 ? 211 : r < 0.66 ? -211 : 22;
+        addParticle(vtx, ptEtaPhiM(p.pT()*f/sum,
+                    p.eta() + gauss(0, width), p.phi() + gauss(0, width),
+                    pid == 22 ? 0 : 0.1396), pid);
+    }
+
+    return;
+}
+
+
+/// b quark: a weakly decaying B meson with most of the momentum plus a
+/// spray with the rest
+void EventGenerator::addBQuark(HepMC::GenEvent* ge, HepMC::GenVertex* vtx,
+        const FourMomentum& p, int sign) {
+
+    const double z = uniform(0.6, 0.9);
+    const FourMomentum pb = ptEtaPhiM(z*p.pT(), p.eta(), p.phi(), 5.28);
+
+    HepMC::GenParticle* bhad = new HepMC::GenParticle(
+            HepMC::FourVector(pb.px(), pb.py(), pb.pz(), pb.E()), sign*511, 2);
+    vtx->add_particle_out(bhad);
+
+    HepMC::GenVertex* decayVtx = new HepMC::GenVertex();
+    decayVtx->add_particle_in(bhad);
+    addSpray(decayVtx, pb, 0.02);
+    ge->add_vertex(decayVtx);
+
+    addSpray(vtx, ptEtaPhiM((1 - z)*p.pT(), p.eta(), p.phi(), 0), 0.1);
+
+    return;
+}
+
+
+void EventGenerator::addUnderlyingEvent(HepMC::GenVertex* vtx) {
+    const size_t n = 50 + (size_t) uniform(0, 150);
+    for (size_t i = 0; i < n; ++i) {
+        const double r = uniform(0, 1);
+        const int pid = r < 0.33 ? 211 : r < 0.66 ? -211 : 22;
+        const double pt = 0.3 - 1.5*std::log(uniform(1e-6, 1));
+        addParticle(vtx, ptEtaPhiM(pt, uniform(-4.5, 4.5), uniform(-M_PI, M_PI),
+                    pid == 22 ? 0 : 0.1396), pid);
+    }
+
+    return;
+}
+
+
+/// boosted H->bb recoiling against a Z->ee or Z->mumu
+HepMC::GenEvent* EventGenerator::zhllbb(int evnum) {
+    HepMC::GenVertex* hard;
+    HepMC::GenEvent* ge = newEvent(evnum, hard);
+
+    const double pt = uniform(200, 600);
+    const double phi = uniform(-M_PI, M_PI);
+    const FourMomentum higgs = ptEtaPhiM(pt, gauss(0, 1), phi, 125);
+    const FourMomentum zboson = ptEtaPhiM(pt*uniform(0.8, 1.2), gauss(0, 1),
+            phi + M_PI + gauss(0, 0.2), gauss(91.19, 2.5));
+
+    FourMomentum b1, b2;
+    decay(higgs, 0, 0, b1, b2);
+    addBQuark(ge, hard, b1, 1);
+    addBQuark(ge, hard, b2, -1);
+
+    FourMomentum l1, l2;
+    decay(zboson, 0, 0, l1, l2);
+    const int lep = uniform(0, 1) < 0.5 ? 11 : 13;
+    addParticle(hard, l1, lep);
+    addParticle(hard, l2, -lep);
+
+    addUnderlyingEvent(hard);
+
+    return ge;
+}
+
+
+/// ttbar with one leptonic and one hadronic W
+HepMC::GenEvent* EventGenerator::ttbar(int evnum) {
+    HepMC::GenVertex* hard;
+    HepMC::GenEvent* ge = newEvent(evnum, hard);
+
+    const double pt = uniform(50, 500);
+    const double phi = uniform(-M_PI, M_PI);
+    const FourMomentum tops[2] = {
+        ptEtaPhiM(pt, gauss(0, 1.2), phi, 172.5),
+        ptEtaPhiM(pt*uniform(0.8, 1.2), gauss(0, 1.2), phi + M_PI + gauss(0, 0.3), 172.5)
+    };
+
+    for (int iTop = 0; iTop < 2; ++iTop) {
+        const int sign = iTop ? -1 : 1;
+
+        FourMomentum w, b;
+        decay(tops[iTop], 80.4, 4.8, w, b);
+        addBQuark(ge, hard, b, sign);
+
+        FourMomentum d1, d2;
+        decay(w, 0, 0, d1, d2);
+        if (iTop == 0) {
+            const int lep = uniform(0, 1) < 0.5 ? 11 : 13;
+            addParticle(hard, d1, -lep);
+            addParticle(hard, d2, lep + 1);
+        } else {
+            addSpray(hard, d1, 0.1);
+            addSpray(hard, d2, 0.1);
+        }
+    }
+
+    addUnderlyingEvent(hard);
+
+    return ge;
+}
+
+
+namespace Rivet {
+
+/// Calls into the analysis for the microbenchmarks. A friend of
+/// MC_BOOSTEDHBB.
+class MC_BOOSTEDHBBBenchmark {
+    public:
+        MC_BOOSTEDHBBBenchmark(MC_BOOSTEDHBB& analysis, unsigned int seed)
+            : analysis(analysis), rng(seed) {
+
+            return;
+        }
+
+        double fillFourMomPair(size_t ncalls);
+
+        /// fills of one histogram with all event weights, into a YODA
+        /// histogram per weight or into one FastHisto1D
+        double fillYoda(size_t ncalls);
+        double fillFast(size_t ncalls);
+
+        /// whether FastHistos flushed into YODA histograms give exactly
+        /// what filling those directly does
+        bool flushMatches();
+        double bTagged(size_t ncalls);
+        double matching(size_t ncalls, DeltaRMatrix::strategy strat);
+
+        /// allocations by the analysis itself so far, without the first
+        /// event, if it counts them
+        bool countsAllocations() const { return analysis.countAllocs; }
+        uint64_t ownAllocations() const { return analysis.ownAllocsLater; }
+        unsigned long allocatingEvents() const { return analysis.allocatingEvents; }
+
+    private:
+        double uniform(double a, double b) {
+            return a + (b - a)*(rng()/4294967296.0);
+        }
+
+        FourMomentum randomMomentum(double ptmin, double ptmax) {
+            const double pt = uniform(ptmin, ptmax);
+            const double eta = uniform(-2.5, 2.5);
+            const double phi = uniform(-M_PI, M_PI);
+            return FourMomentum(pt*std::cosh(eta), pt*std::cos(phi), pt*std::sin(phi), pt*std::sinh(eta));
+        }
+
+        MC_BOOSTEDHBB& analysis;
+        std::mt19937 rng;
+
+        // inputs are cycled through a pool, so the branches see varied data
+        static const size_t POOLSIZE = 1024;
+        volatile size_t sink;
+};
+
+
+double MC_BOOSTEDHBBBenchmark::fillFourMomPair(size_t ncalls) {
+    MC_BOOSTEDHBB::HistoSet& hs = analysis.histos[0];
+    const vector<double> weights(hs.nweights, 1.0);
+
+    vector<FourMomentum> ps;
+    for (size_t i = 0; i < POOLSIZE + 1; ++i)
+        ps.push_back(randomMomentum(25, 500));
+
+    const double start = wallTime();
+    for (size_t i = 0; i < ncalls; ++i) {
+        const size_t j = i % POOLSIZE;
+        analysis.fillFourMomPair(hs, analysis.allChannels, analysis.vbosonHiggsColl, ps[j], ps[j+1], weights);
+    }
+
+    return (wallTime() - start)/ncalls;
+}
+
+
+// values for fills of a histogram from 0 to 2000, including some outside
+// and some on the bin edges
+static vector<double> fillValues(std::mt19937& rng, size_t n) {
+    vector<double> xs;
+    for (size_t i = 0; i < n; ++i) {
+        if (i % 8 == 0) xs.push_back(80.0*(rng() % 27) - 80);
+        else xs.push_back(-100 + 2200*(rng()/4294967296.0));
+    }
+
+    return xs;
+}
+
+
+double MC_BOOSTEDHBBBenchmark::fillYoda(size_t ncalls) {
+    const size_t nweights = analysis.histos[0].nweights;
+    vector<double> weights;
+    for (size_t iw = 0; iw < nweights; ++iw)
+        weights.push_back(uniform(0.5, 1.5));
+    const vector<double> xs = fillValues(rng, POOLSIZE);
+
+    vector<YODA::Histo1D> hs(nweights, YODA::Histo1D(25, 0, 2000));
+
+    const double start = wallTime();
+    for (size_t i = 0; i < ncalls; ++i) {
+        const double x = xs[i % POOLSIZE];
+        for (size_t iw = 0; iw < nweights; ++iw)
+            hs[iw].fill(x, weights[iw]);
+    }
+
+    return (wallTime() - start)/ncalls;
+}
+
+
+double MC_BOOSTEDHBBBenchmark::fillFast(size_t ncalls) {
+    const size_t nweights = analysis.histos[0].nweights;
+    vector<double> weights;
+    for (size_t iw = 0; iw < nweights; ++iw)
+        weights.push_back(uniform(0.5, 1.5));
+    const vector<double> xs = fillValues(rng, POOLSIZE);
+
+    FastHisto1D h;
+    h.book(nweights, 25, 0, 2000);
+
+    const double start = wallTime();
+    for (size_t i = 0; i < ncalls; ++i)
+        h.fill(xs[i % POOLSIZE], weights);
+
+    return (wallTime() - start)/ncalls;
+}
+
+
+static bool sameDbn(const YODA::Dbn1D& a, const YODA::Dbn1D& b) {
+    return a.numEntries() == b.numEntries() && a.sumW() == b.sumW() && a.sumW2() == b.sumW2() &&
+        a.sumWX() == b.sumWX() && a.sumWX2() == b.sumWX2();
+}
+
+
+static bool sameDbn(const YODA::Dbn2D& a, const YODA::Dbn2D& b) {
+    return a.numEntries() == b.numEntries() && a.sumW() == b.sumW() && a.sumW2() == b.sumW2() &&
+        a.sumWX() == b.sumWX() && a.sumWX2() == b.sumWX2() &&
+        a.sumWY() == b.sumWY() && a.sumWY2() == b.sumWY2() && a.sumWXY() == b.sumWXY();
+}
+
+
+bool MC_BOOSTEDHBBBenchmark::flushMatches() {
+    const size_t nfills = 100000;
+    const vector<double> xs = fillValues(rng, nfills);
+    const vector<double> ys = fillValues(rng, nfills);
+    vector<double> ws;
+    for (size_t i = 0; i < nfills; ++i)
+        ws.push_back(uniform(-0.5, 1.5));
+
+    YODA::Histo1D direct1D(25, 0, 2000), flushed1D(25, 0, 2000);
+    YODA::Histo2D direct2D(25, 0, 2000, 25, 0, 2000), flushed2D(25, 0, 2000, 25, 0, 2000);
+    FastHisto1D fast1D;
+    FastHisto2D fast2D;
+    fast1D.book(1, 25, 0, 2000);
+    fast2D.book(1, 25, 0, 2000, 25, 0, 2000);
+
+    vector<double> w(1);
+    for (size_t i = 0; i < nfills; ++i) {
+        w[0] = ws[i];
+        direct1D.fill(xs[i], w[0]);
+        fast1D.fill(xs[i], w);
+        direct2D.fill(xs[i], ys[i], w[0]);
+        fast2D.fill(xs[i], ys[i], w);
+    }
+    fast1D.flush(0, flushed1D);
+    fast2D.flush(0, flushed2D);
+
+    bool same = sameDbn(direct1D.totalDbn(), flushed1D.totalDbn()) &&
+        sameDbn(direct1D.underflow(), flushed1D.underflow()) &&
+        sameDbn(direct1D.overflow(), flushed1D.overflow()) &&
+        sameDbn(direct2D.totalDbn(), flushed2D.totalDbn());
+    for (size_t i = 0; i < direct1D.numBins(); ++i)
+        same = same && sameDbn(direct1D.bin(i).dbn(), flushed1D.bin(i).dbn());
+    for (size_t i = 0; i < direct2D.numBins(); ++i)
+        same = same && sameDbn(direct2D.bin(i).dbn(), flushed2D.bin(i).dbn());
+
+    return same;
+}
+
+
+double MC_BOOSTEDHBBBenchmark::bTagged(size_t ncalls) {
+    // 2 to 6 track jets, each with a b hadron nearby with probability 0.3,
+    // plus 1 or 2 stray b hadrons
+    vector<MC_BOOSTEDHBB::EventState> states(POOLSIZE);
+    foreach (MC_BOOSTEDHBB::EventState& st, states) {
+        const size_t njets = 2 + (size_t) uniform(0, 5);
+        for (size_t i = 0; i < njets; ++i) {
+            const FourMomentum p = randomMomentum(25, 300);
+            st.trackJets.push_back(p);
+            if (uniform(0, 1) < 0.3) st.bhads.push_back(Particle(511, p*0.7));
+        }
+
+        const size_t nstray = 1 + (size_t) uniform(0, 2);
+        for (size_t i = 0; i < nstray; ++i)
+            st.bhads.push_back(Particle(511, randomMomentum(5, 100)));
+    }
+
+    size_t ntagged = 0;
+    const double start = wallTime();
+    for (size_t i = 0; i < ncalls; ++i) {
+        MC_BOOSTEDHBB::EventState& st = states[i % POOLSIZE];
+        analysis.bTagged(st);
+        ntagged += st.btagCols.size();
+    }
+    const double secs = wallTime() - start;
+    sink = ntagged;
+
+    return secs/ncalls;
+}
+
+
+double MC_BOOSTEDHBBBenchmark::matching(size_t ncalls, DeltaRMatrix::strategy strat) {
+    // rows: 1 or 2 b hadrons. columns: 2 to 6 track jets, matched against
+    // up to 3 b-tagged ones. as in selectBoostedHiggs().
+    vector<EtaPhiBuffer> rows(POOLSIZE), cols(POOLSIZE);
+    vector<vector<size_t> > bhadRows(POOLSIZE), btagCols(POOLSIZE);
+    for (size_t i = 0; i < POOLSIZE; ++i) {
+        const size_t nbhads = 1 + (size_t) uniform(0, 2);
+        for (size_t j = 0; j < nbhads; ++j) {
+            rows[i].push_back(randomMomentum(20, 300));
+            bhadRows[i].push_back(j);
+        }
+
+        const size_t njets = 2 + (size_t) uniform(0, 5);
+        for (size_t j = 0; j < njets; ++j) {
+            cols[i].push_back(randomMomentum(25, 300));
+            if (j < 3) btagCols[i].push_back(j);
+        }
+    }
+
+    DeltaRMatrix drMatrix;
+    vector<int> matches;
+    size_t nmatched = 0;
+    const double start = wallTime();
+    for (size_t i = 0; i < ncalls; ++i) {
+        const size_t j = i % POOLSIZE;
+        drMatrix.compute(rows[j], cols[j]);
+        drMatrix.match(bhadRows[j], btagCols[j], strat, matches);
+        nmatched += matches[0] != DeltaRMatrix::NOMATCH;
+    }
+    const double secs = wallTime() - start;
+    sink = nmatched;
+
+    return secs/ncalls;
+}
+
+}
+
+
+static double percentile(const vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t) (q*sorted.size()))];
+}
+
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        std::cerr << "usage: " << argv[0] << " [nevents [seed]]" << std::endl;
+        return 1;
+    }
+
+    const size_t nevents = argc > 1 ? std::strtoul(argv[1], 0, 10) : 5000;
+    const unsigned int seed = argc > 2 ? std::strtoul(argv[2], 0, 10) : 12345;
+    if (!nevents) {
+        std::cerr << "need at least one event" << std::endl;
+        return 1;
+    }
+
+    // two ZH events for every ttbar event. generated up front so the
+    // generation is not timed.
+    std::cout << "generating " << nevents << " events with seed " << seed << std::endl;
+    EventGenerator gen(seed);
+    vector<HepMC::GenEvent*> events;
+    for (size_t i = 0; i < nevents; ++i)
+        events.push_back(i % 3 == 2 ? gen.ttbar(i) : gen.zhllbb(i));
+
+    Rivet::MC_BOOSTEDHBB* analysis = new Rivet::MC_BOOSTEDHBB();
+    Rivet::AnalysisHandler ah;
+    ah.addAnalysis(analysis);   // takes ownership
+    ah.setCrossSection(1.0);
+    ah.init(*events[0]);
+
+    Rivet::MC_BOOSTEDHBBBenchmark micro(*analysis, seed);
+
+    // warm up the caches and book the weight variations
+    const size_t nwarmup = std::min<size_t>(nevents, 200);
+    for (size_t i = 0; i < nwarmup; ++i)
+        ah.analyze(*events[i]);
+    const uint64_t warmupAllocs = micro.ownAllocations();
+    const unsigned long warmupAllocating = micro.allocatingEvents();
+
+    vector<double> latencies;
+    latencies.reserve(nevents);
+    const double start = wallTime();
+    foreach (const HepMC::GenEvent* ge, events) {
+        const double t0 = wallTime();
+        ah.analyze(*ge);
+        latencies.push_back(wallTime() - t0);
+    }
+    const double loop = wallTime() - start;
+    const uint64_t ownAllocs = micro.ownAllocations() - warmupAllocs;
+    const unsigned long allocating = micro.allocatingEvents() - warmupAllocating;
+
+    // drains the worker threads in multi-threaded mode
+    const double t0 = wallTime();
+    ah.finalize();
+    const double fin = wallTime() - t0;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("\nevent loop\n");
+    std::printf("    events:                %zu (+ %zu warm-up)\n", nevents, nwarmup);
+    std::printf("    events/s:              %.1f\n", nevents/loop);
+    std::printf("    events/s incl. finalize: %.1f\n", nevents/(loop + fin));
+    std::printf("    latency/us  p50:       %.1f\n", 1e6*percentile(latencies, 0.50));
+    std::printf("                p90:       %.1f\n", 1e6*percentile(latencies, 0.90));
+    std::printf("                p99:       %.1f\n", 1e6*percentile(latencies, 0.99));
+    std::printf("                p99.9:     %.1f\n", 1e6*percentile(latencies, 0.999));
+    std::printf("                max:       %.1f\n", 1e6*latencies.back());
+    if (micro.countsAllocations()) {
+        std::printf("    allocations by the analysis after warm-up: %llu in %lu events\n",
+                (unsigned long long) ownAllocs, allocating);
+    }
+    const size_t ncalls = 1000000;
+    std::printf("\nmicrobenchmarks (%zu calls each)\n", ncalls);
+    std::printf("    fillFourMomPair/ns:    %.1f\n", 1e9*micro.fillFourMomPair(ncalls));
+    std::printf("    fill YODA/ns:          %.1f\n", 1e9*micro.fillYoda(ncalls));
+    std::printf("    fill FastHisto/ns:     %.1f\n", 1e9*micro.fillFast(ncalls));
+    std::printf("    bTagged/ns:            %.1f\n", 1e9*micro.bTagged(ncalls));
+    std::printf("    matching nearest/ns:   %.1f\n", 1e9*micro.matching(ncalls, Rivet::DeltaRMatrix::NEAREST));
+    std::printf("    matching greedy/ns:    %.1f\n", 1e9*micro.matching(ncalls, Rivet::DeltaRMatrix::GREEDY));
+    std::printf("    matching optimal/ns:   %.1f\n", 1e9*micro.matching(ncalls, Rivet::DeltaRMatrix::OPTIMAL));
+
+    const bool flushOK = micro.flushMatches();
+    std::printf("    FastHisto flush identical to YODA fills: %s\n", flushOK ? "yes" : "NO");
+
+    foreach (HepMC::GenEvent* ge, events)
+        delete ge;
+
+    if (!flushOK) return 1;
+    return micro.countsAllocations() && ownAllocs ? 1 : 0;
+}
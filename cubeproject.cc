@@ -0,0 +1,150 @@
+// -*- C++ -*-
+//
+// Project the category cube of an MC_BOOSTEDHBB output (run with
+// MC_BOOSTEDHBB_CUBE) onto some of its axes:
+//
+//     cubeproject in.yoda out.yoda [axis ...]
+//
+// The cube histograms are named
+//     [prefix]cube_<axis><bin>_..._<observable>[Wn]
+// and every one is added into the histogram of its bins on the axes
+// given, e.g. with "nlep met" cube_nlep1_ntrackjet2_nbtag2_met3_vpt1_higgsm
+// goes into cube_nlep1_met3_higgsm, titled with the ranges of those two
+// axes. Without axes each observable is summed over the whole cube. The
+// input may be normalised or not, as the histograms of one weight
+// variation share their normalisation. Anything else is written as it is.
+
+#include "YODA/Histo1D.h"
+#include "YODA/ReaderYODA.h"
+#include "YODA/WriterYODA.h"
+
+#include <cctype>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static const string CUBE = "cube_";
+
+
+// the axis of a category token, e.g. "met" for "met3"
+static string axisName(const string& token) {
+    size_t end = token.size();
+    while (end > 0 && std::isdigit(token[end - 1])) --end;
+    return token.substr(0, end);
+}
+
+
+// s split at sep
+static vector<string> split(const string& s, const string& sep) {
+    vector<string> parts;
+    size_t begin = 0;
+    for (;;) {
+        const size_t at = s.find(sep, begin);
+        parts.push_back(s.substr(begin, at - begin));
+        if (at == string::npos) break;
+        begin = at + sep.size();
+    }
+
+    return parts;
+}
+
+
+// the path of the projection of the cube histogram at path, empty if it
+// is not one
+static string projectedPath(const string& path, const std::set<string>& axes) {
+    const size_t at = path.find(CUBE);
+    if (at == string::npos) return string();
+
+    const vector<string> tokens = split(path.substr(at + CUBE.size()), "_");
+    if (tokens.size() < 2) return string();
+
+    // the last token is the observable
+    string projected = path.substr(0, at + CUBE.size());
+    for (size_t i = 0; i + 1 < tokens.size(); ++i) {
+        if (axisName(tokens[i]) == tokens[i])
+            return string();
+        if (axes.count(axisName(tokens[i])))
+            projected += tokens[i] + "_";
+    }
+
+    return projected + tokens.back();
+}
+
+
+// the parts of a category title on the axes kept, e.g. "nlep = 1; met >= 300"
+static string projectedTitle(const string& title, const std::set<string>& axes) {
+    string projected;
+    const vector<string> parts = split(title, "; ");
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (!axes.count(parts[i].substr(0, parts[i].find(' ')))) continue;
+        if (!projected.empty()) projected += "; ";
+        projected += parts[i];
+    }
+
+    return projected;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " in.yoda out.yoda [axis ...]" << std::endl;
+        return 1;
+    }
+
+    const std::set<string> axes(argv + 3, argv + argc);
+
+    vector<YODA::AnalysisObject*> aos;
+
+    // the projections by path, and everything written, in input order
+    std::map<string, YODA::Histo1D*> projections;
+    vector<YODA::AnalysisObject*> out;
+    size_t ncube = 0;
+
+    try {
+        YODA::ReaderYODA::create().read(argv[1], aos);
+
+        for (size_t i = 0; i < aos.size(); ++i) {
+            YODA::AnalysisObject* ao = aos[i];
+            YODA::Histo1D* h = dynamic_cast<YODA::Histo1D*>(ao);
+            const string path = h ? projectedPath(h->path(), axes) : string();
+            if (path.empty()) {
+                out.push_back(ao);
+                continue;
+            }
+
+            ++ncube;
+            std::map<string, YODA::Histo1D*>::iterator it = projections.find(path);
+            if (it != projections.end()) {
+                *it->second += *h;
+                continue;
+            }
+
+            YODA::Histo1D* p = new YODA::Histo1D(*h);
+            p->setPath(path);
+            p->setTitle(projectedTitle(h->title(), axes));
+            projections[path] = p;
+            out.push_back(p);
+        }
+
+        YODA::WriterYODA::write(argv[2], out);
+
+        std::cerr << ncube << " cube histograms projected onto " << projections.size()
+            << " in " << argv[2] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < aos.size(); ++i)
+        delete aos[i];
+    for (std::map<string, YODA::Histo1D*>::iterator it = projections.begin(); it != projections.end(); ++it)
+        delete it->second;
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+// -*- C++ -*-
+//
+// Cutflows and N-1 distributions from a cut mask file written with
+// MC_BOOSTEDHBB_CUTMASKS, without the original HepMC files:
+//
+//     cutquery masks.bin cutflow [cut ...]
+//     cutquery masks.bin nminus1 var nbins lo hi [cut ...]
+//
+// A cut is the name of a mask bit (e.g. VBOSON), the name with a leading
+// "!" for events failing it, or a comparison var<op>value with op one of
+// <, <=, >, >=, ==, !=. The variables are
+//
+//     vpt met akt10pt akt10pt2 akt10m             (GeV)
+//     nleptons nbhads nakt10 ntrackjets nbtags
+//
+// Without cuts the selection of the analysis is used. cutflow applies the
+// cuts in the order given. nminus1 histograms var for the events passing
+// all cuts but one, for each cut in turn. Weights are normalised to the
+// cross section in fb, as the histograms of the analysis.
+
+#include "CutMaskFile.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace Rivet;
+
+
+static const char* const VARNAMES[] = {
+    "vpt", "met", "akt10pt", "akt10pt2", "akt10m",
+    "nleptons", "nbhads", "nakt10", "ntrackjets", "nbtags"
+};
+static const size_t NVARS = sizeof(VARNAMES)/sizeof(VARNAMES[0]);
+
+// the vetoes of the analysis, in the order it applies them
+static const char* const DEFAULTCUTS[] = {
+    "VBOSON", "nbhads>=1", "nbhads<=2", "ONEAKT10JET", "nbtags<=2"
+};
+
+
+static double variable(const CutMaskEvent& ev, size_t ivar) {
+    switch (ivar) {
+        case 0: return ev.vbosonPt;
+        case 1: return ev.met;
+        case 2: return ev.akt10Pt;
+        case 3: return ev.akt10Pt2;
+        case 4: return ev.akt10Mass;
+        case 5: return ev.nleptons;
+        case 6: return ev.nbhads;
+        case 7: return ev.nakt10;
+        case 8: return ev.ntrackJets;
+        default: return ev.nbtags;
+    }
+}
+
+
+static int variableIndex(const string& name) {
+    for (size_t i = 0; i < NVARS; ++i)
+        if (name == VARNAMES[i]) return i;
+
+    return -1;
+}
+
+
+/// One cut: a mask bit or a comparison of a variable with a value.
+struct MaskCut {
+    enum ops { LT, LE, GT, GE, EQ, NE, BIT, NOTBIT };
+
+    string label;
+    ops op;
+    int index;  // bit or variable
+    double value;
+
+    bool passes(const CutMaskEvent& ev) const {
+        if (op == BIT) return ev.cutMask & (1u << index);
+        if (op == NOTBIT) return !(ev.cutMask & (1u << index));
+
+        const double x = variable(ev, index);
+        switch (op) {
+            case LT: return x < value;
+            case LE: return x <= value;
+            case GT: return x > value;
+            case GE: return x >= value;
+            case EQ: return x == value;
+            default: return x != value;
+        }
+    }
+};
+
+
+static MaskCut parseCut(const string& spec, const CutMaskReader& reader) {
+    MaskCut cut;
+    cut.label = spec;
+    cut.value = 0;
+
+    // comparisons, two-character operators first
+    static const char* const opnames[] = { "<=", ">=", "==", "!=", "<", ">" };
+    static const MaskCut::ops ops[] = { MaskCut::LE, MaskCut::GE, MaskCut::EQ, MaskCut::NE, MaskCut::LT, MaskCut::GT };
+    for (size_t iop = 0; iop < 6; ++iop) {
+        const size_t at = spec.find(opnames[iop]);
+        if (at == string::npos || at == 0) continue;
+
+        cut.op = ops[iop];
+        cut.index = variableIndex(spec.substr(0, at));
+        if (cut.index < 0)
+            throw Exception("unknown variable in cut " + spec);
+
+        const string value = spec.substr(at + strlen(opnames[iop]));
+        char* end = 0;
+        cut.value = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end)
+            throw Exception("bad value in cut " + spec);
+        return cut;
+    }
+
+    const bool negate = spec[0] == '!';
+    cut.op = negate ? MaskCut::NOTBIT : MaskCut::BIT;
+    cut.index = reader.cutBit(negate ? spec.substr(1) : spec);
+    if (cut.index < 0)
+        throw Exception("unknown cut " + spec);
+
+    return cut;
+}
+
+
+// the cross section per unit weight, in fb
+static double normalisation(const CutMaskReader& reader) {
+    if (!reader.hasFooter()) {
+        std::cerr << "warning: the run writing the file did not finish, the weights are not normalised" << std::endl;
+        return 1;
+    }
+
+    return 1000*reader.crossSection()/reader.sumOfWeights();
+}
+
+
+static int cutflow(CutMaskReader& reader, const vector<MaskCut>& cuts) {
+    // entry 0 is all events
+    vector<unsigned long> n(cuts.size() + 1, 0);
+    vector<double> sumw(cuts.size() + 1, 0);
+
+    CutMaskEvent ev;
+    while (reader.next(ev)) {
+        ++n[0];
+        sumw[0] += ev.weight;
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            if (!cuts[i].passes(ev)) break;
+            ++n[i+1];
+            sumw[i+1] += ev.weight;
+        }
+    }
+
+    const double norm = normalisation(reader);
+    std::printf("%-40s %12s %14s %8s\n", "cut", "events", "xsec/fb", "eff");
+    for (size_t i = 0; i <= cuts.size(); ++i) {
+        std::printf("%-40s %12lu %14.6g %8.4f\n", i ? cuts[i-1].label.c_str() : "all",
+                n[i], norm*sumw[i], i && sumw[i-1] != 0 ? sumw[i]/sumw[i-1] : 1.0);
+    }
+
+    return 0;
+}
+
+
+static int nminus1(CutMaskReader& reader, const vector<MaskCut>& cuts,
+        size_t ivar, size_t nbins, double lo, double hi) {
+
+    // per cut left out: underflow, the bins, overflow
+    const size_t stride = nbins + 2;
+    vector<double> sumw(cuts.size()*stride, 0);
+    vector<double> sumw2(cuts.size()*stride, 0);
+
+    CutMaskEvent ev;
+    while (reader.next(ev)) {
+        // the first failed cut, and whether it is the only one
+        size_t failed = cuts.size();
+        bool several = false;
+        for (size_t i = 0; i < cuts.size() && !several; ++i) {
+            if (cuts[i].passes(ev)) continue;
+            if (failed < cuts.size()) several = true;
+            failed = i;
+        }
+        if (several) continue;
+
+        const double x = variable(ev, ivar);
+        size_t bin = nbins + 1;
+        if (x < lo) bin = 0;
+        else if (x < hi) bin = std::min(1 + (size_t) ((x - lo)/(hi - lo)*nbins), nbins);
+
+        // passing everything counts for every cut left out
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            if (failed < cuts.size() && i != failed) continue;
+            sumw[i*stride + bin] += ev.weight;
+            sumw2[i*stride + bin] += ev.weight*ev.weight;
+        }
+    }
+
+    const double norm = normalisation(reader);
+    for (size_t i = 0; i < cuts.size(); ++i) {
+        std::printf("# N-1 %s: %s without %s\n", VARNAMES[ivar], VARNAMES[ivar], cuts[i].label.c_str());
+        std::printf("# %12s %12s %14s %14s\n", "xlow", "xhigh", "xsec/fb", "error");
+        for (size_t bin = 0; bin < stride; ++bin) {
+            const double xlow = bin == 0 ? -HUGE_VAL : lo + (bin - 1)*(hi - lo)/nbins;
+            const double xhigh = bin == stride - 1 ? HUGE_VAL : lo + bin*(hi - lo)/nbins;
+            std::printf("  %12.6g %12.6g %14.6g %14.6g\n", xlow, xhigh,
+                    norm*sumw[i*stride + bin], norm*std::sqrt(sumw2[i*stride + bin]));
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+    const string usage = string("usage: ") + argv[0] + " masks.bin cutflow [cut ...]\n"
+        + "       " + argv[0] + " masks.bin nminus1 var nbins lo hi [cut ...]";
+    if (argc < 3) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+
+    try {
+        CutMaskReader reader(argv[1]);
+        const string command = argv[2];
+
+        int icut = 3;
+        size_t ivar = 0, nbins = 0;
+        double lo = 0, hi = 0;
+        if (command == "nminus1") {
+            if (argc < 7) {
+                std::cerr << usage << std::endl;
+                return 1;
+            }
+
+            const int var = variableIndex(argv[3]);
+            if (var < 0)
+                throw Exception(string("unknown variable ") + argv[3]);
+            ivar = var;
+            nbins = std::strtoul(argv[4], 0, 10);
+            lo = std::atof(argv[5]);
+            hi = std::atof(argv[6]);
+            if (!nbins || !(hi > lo))
+                throw Exception("need nbins > 0 and hi > lo");
+            icut = 7;
+        } else if (command != "cutflow") {
+            std::cerr << usage << std::endl;
+            return 1;
+        }
+
+        vector<MaskCut> cuts;
+        for (int i = icut; i < argc; ++i)
+            cuts.push_back(parseCut(argv[i], reader));
+        if (cuts.empty()) {
+            foreach (const char* spec, DEFAULTCUTS)
+                cuts.push_back(parseCut(spec, reader));
+        }
+
+        if (command == "cutflow")
+            return cutflow(reader, cuts);
+        return nminus1(reader, cuts, ivar, nbins, lo, hi);
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,91 @@
+// -*- C++ -*-
+//
+// Run MC_BOOSTEDHBB over a range of the events of a HepMC file, so that
+// one file can be split across jobs:
+//
+//     hepmcrange index events.hepmc
+//     hepmcrange run events.hepmc first last out.yoda
+//
+// index scans the file once, writes the byte offset of every event to
+// events.hepmc.idx and prints the number of events. run analyses the
+// events [first, last), reading straight from the offset of the first;
+// it builds the index itself if there is none or the file changed. last
+// is cut to the number of events.
+//
+// The output is left unnormalised (MC_BOOSTEDHBB_UNNORMALISED), with the
+// sums of weights of the range: mergeshards adds the outputs of all
+// ranges and normalises the sum, which gives what one run over the whole
+// file does. The other MC_BOOSTEDHBB_* options apply as usual. The
+// analysis plugin has to be on RIVET_ANALYSIS_PATH.
+
+#include "Rivet/AnalysisHandler.hh"
+#include "HepMC/GenEvent.h"
+#include "HepMC/IO_GenEvent.h"
+
+#include "HepMCIndex.hh"
+
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    const std::string usage = std::string("usage: ") + argv[0] + " index events.hepmc\n"
+        + "       " + argv[0] + " run events.hepmc first last out.yoda";
+
+    const std::string command = argc > 1 ? argv[1] : "";
+    if (!(command == "index" && argc == 3) && !(command == "run" && argc == 6)) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+
+    try {
+        Rivet::HepMCIndex index;
+        if (command == "index") {
+            index.build(argv[2]);
+            index.save(std::string(argv[2]) + ".idx");
+            std::cout << index.numEvents() << std::endl;
+            return 0;
+        }
+
+        index.open(argv[2]);
+        const uint64_t first = std::strtoull(argv[3], 0, 10);
+        const uint64_t last = std::min<uint64_t>(std::strtoull(argv[4], 0, 10), index.numEvents());
+        if (first >= last) {
+            std::cerr << argv[0] << ": no events in [" << argv[3] << ", " << argv[4] << "), "
+                << argv[2] << " has " << index.numEvents() << std::endl;
+            return 1;
+        }
+
+        setenv("MC_BOOSTEDHBB_UNNORMALISED", "1", 1);
+
+        Rivet::HepMCRangeStream in(argv[2], index, first, last);
+        HepMC::IO_GenEvent io(in);
+
+        Rivet::AnalysisHandler ah;
+        ah.addAnalysis("MC_BOOSTEDHBB");
+
+        uint64_t nread = 0;
+        while (HepMC::GenEvent* ge = io.read_next_event()) {
+            if (!nread) ah.init(*ge);
+            ah.analyze(*ge);
+            delete ge;
+            ++nread;
+        }
+
+        if (nread != last - first) {
+            std::cerr << argv[0] << ": read " << nread << " of the " << last - first
+                << " events in the range" << std::endl;
+            return 1;
+        }
+
+        ah.finalize();
+        ah.writeData(argv[5]);
+
+        std::cerr << "events [" << first << ", " << last << ") of " << argv[2]
+            << " written to " << argv[5] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
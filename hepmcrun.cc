@@ -0,0 +1,95 @@
+// -*- C++ -*-
+//
+// Run MC_BOOSTEDHBB over a HepMC file, plain or gzip-compressed, or over
+// standard input, without rivet reading the events on the analysis thread:
+//
+//     hepmcrun events.hepmc.gz out.yoda [queuesize]
+//     zcat events.hepmc.gz | hepmcrun - out.yoda
+//
+// Reading and inflating the input, and parsing it into events, run on
+// threads of their own (HepMCPipeline), which keep up to queuesize events
+// (64) ready for analyze(). At the end the time of every stage is printed
+// to stderr, and whether the analysis waited for its input (input bound)
+// or the input for the analysis (compute bound). The MC_BOOSTEDHBB_*
+// options apply as usual, and the analysis plugin has to be on
+// RIVET_ANALYSIS_PATH.
+
+#include "Rivet/AnalysisHandler.hh"
+#include "HepMC/GenEvent.h"
+
+#include "HepMCPipeline.hh"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+// seconds on a monotonic clock
+static double wallTime() {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "usage: " << argv[0] << " events.hepmc[.gz]|- out.yoda [queuesize]" << std::endl;
+        return 1;
+    }
+
+    const size_t queueSize = argc > 3 ? std::strtoul(argv[3], 0, 10) : 64;
+    if (!queueSize) {
+        std::cerr << argv[0] << ": the queue size must be positive" << std::endl;
+        return 1;
+    }
+
+    try {
+        const double start = wallTime();
+        Rivet::HepMCPipeline pipeline(argv[1], queueSize);
+
+        Rivet::AnalysisHandler ah;
+        ah.addAnalysis("MC_BOOSTEDHBB");
+
+        double analysing = 0;
+        while (HepMC::GenEvent* ge = pipeline.next()) {
+            const double t = wallTime();
+            if (pipeline.numEvents() == 1) ah.init(*ge);
+            ah.analyze(*ge);
+            analysing += wallTime() - t;
+            delete ge;
+        }
+
+        if (!pipeline.numEvents()) {
+            std::cerr << argv[0] << ": no events in " << argv[1] << std::endl;
+            return 1;
+        }
+
+        ah.finalize();
+        ah.writeData(argv[2]);
+
+        const double total = wallTime() - start;
+        const Rivet::HepMCPipeline::Times t = pipeline.times();
+
+        std::fprintf(stderr, "%lu events of %s written to %s in %.2f s\n",
+                pipeline.numEvents(), argv[1], argv[2], total);
+        std::fprintf(stderr, "  input    %.1f MB read, %.1f MB inflated\n",
+                pipeline.bytesRead()/1e6, pipeline.bytesInflated()/1e6);
+        std::fprintf(stderr, "  reader   read %8.2f s  inflate %8.2f s  blocked %8.2f s\n",
+                t.read, t.inflate, t.readerBlocked);
+        std::fprintf(stderr, "  parser   parse %7.2f s  starved %8.2f s  blocked %8.2f s\n",
+                t.parse, t.parserStarved, t.parserBlocked);
+        std::fprintf(stderr, "  analysis analyse %5.2f s  starved %8.2f s\n",
+                analysing, t.consumerStarved);
+
+        // the analysis waiting on the parser means the input is the limit;
+        // the parser waiting on the analysis means the analysis is
+        const char* verdict = t.consumerStarved > t.parserBlocked ? "input bound" : "compute bound";
+        std::fprintf(stderr, "  %s: the analysis waited %.0f%% of the run for events\n",
+                verdict, total > 0 ? 100*t.consumerStarved/total : 0.);
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,57 @@
+// -*- C++ -*-
+//
+// Add the unnormalised outputs of MC_BOOSTEDHBB runs over parts of one
+// sample, e.g. the event ranges of hepmcrange, and normalise the sum:
+//
+//     mergeshards out.yoda shard.yoda ...
+//
+// The shards are added and normalised as MergedOutputs describes: the
+// histograms are scaled to fb with the sumW of their weight variation.
+// The cross section is that of the last shard, since one run takes it
+// from its last event: give the shards in the order of their events, and
+// the result is that of one run over all of them. The timing_* objects
+// are added but not scaled; anything else is taken from the last shard.
+// treemerge adds up independent runs, with the mean cross section, on all
+// cores.
+
+#include "YODA/ReaderYODA.h"
+#include "YODA/WriterYODA.h"
+
+#include "MergedOutputs.hh"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " out.yoda shard.yoda ..." << std::endl;
+        return 1;
+    }
+
+    MergedOutputs merged(MergedOutputs::LASTXSEC);
+
+    try {
+        for (int iFile = 2; iFile < argc; ++iFile) {
+            vector<YODA::AnalysisObject*> aos;
+            YODA::ReaderYODA::create().read(argv[iFile], aos);
+            merged.add(aos, argv[iFile]);
+        }
+
+        YODA::WriterYODA::write(argv[1], merged.normalised());
+
+        std::cerr << argc - 2 << " shards merged into " << argv[1] << ", sum of weights "
+            << merged.sumOfWeights()
+            << ", cross section " << merged.crossSection() << " pb" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,12 +1,75 @@
 #!/usr/bin/env python
 
-from subprocess import Popen
+from subprocess import Popen, PIPE
 from sys import argv, stdout
+from os.path import abspath, dirname, join
 from pbssubmit import pbssubmit
 from time import sleep
 
-def runrivet_pbs(fhepmcnames):
+# hepmcrange, mergeshards, treemerge and the plugin are built in the directory above
+bindir = dirname(dirname(abspath(__file__)))
+
+def countevents(fhepmc):
+    # indexes the file, which the jobs then find next to it
+    index = Popen([join(bindir, "hepmcrange"), "index", fhepmc], stdout=PIPE)
+    return int(index.communicate()[0])
+
+
+def runrivet_shards(fhepmc, eventsperjob, fmergeds=None):
+    # index the file once here rather than in every job
+    nevents = countevents(fhepmc)
+
+    running = []
+    fyodas = []
+    for first in range(0, nevents, eventsperjob):
+        last = min(first + eventsperjob, nevents)
+        fyoda = fhepmc.replace(".hepmc", ".%d-%d.yoda" % (first, last))
+        flog = fhepmc.replace(".hepmc", ".%d-%d.rivet.log" % (first, last))
+
+        cmd = "RIVET_ANALYSIS_PATH=%s:$RIVET_ANALYSIS_PATH %s run %s %d %d %s" % \
+                (bindir, join(bindir, "hepmcrange"), fhepmc, first, last, fyoda)
+
+        running.append(pbssubmit("rivet.%s.%d" % (fhepmc, first), cmd,
+            outfile=flog, queue="medium6"))
+        fyodas.append(fyoda)
+
+        sleep(1)
+        continue
+
+    # merged with everything else
+    if fmergeds is not None:
+        fmergeds += fyodas
+        return running
+
+    print "%d events of %s in %d jobs. once they are done, merge them with" % \
+            (nevents, fhepmc, len(fyodas))
+    print "%s %s %s" % (join(bindir, "mergeshards"),
+            fhepmc.replace("hepmc", "yoda"), " ".join(fyodas))
+    print
+    stdout.flush()
+
+    return running
+
+
+def runrivet_slices(fhepmcnames, fyoda):
+    # all slices of one process in one job, stitched by the analysis,
+    # which is told where every slice ends
+    flog = fyoda.replace("yoda", "rivet.log")
+    sizes = [countevents(fhepmc) for fhepmc in fhepmcnames]
+
+    cmd = "MC_BOOSTEDHBB_SLICEEVENTS=%s rivet --pwd -a MC_BOOSTEDHBB -H %s %s" % \
+            (",".join(map(str, sizes)), fyoda, " ".join(fhepmcnames))
+
+    return [pbssubmit("rivet.%s" % fyoda, cmd, outfile=flog, queue="medium6")]
+
+
+def runrivet_pbs(fhepmcnames, eventsperjob=0, fstitched=None, fmerged=None):
     running = []
+    fmergeds = [] if fmerged else None
+    if fstitched:
+        running += runrivet_slices(fhepmcnames, fstitched)
+        fhepmcnames = []
+
     for fhepmc in fhepmcnames:
         if not fhepmc.endswith(".hepmc"):
             print "Unrecognized file: %s." % fhepmc
@@ -15,11 +78,18 @@ def runrivet_pbs(fhepmcnames):
             stdout.flush()
             continue
 
+        if eventsperjob:
+            running += runrivet_shards(fhepmc, eventsperjob, fmergeds)
+            continue
+
         fyoda = fhepmc.replace("hepmc", "yoda")
         flog = fhepmc.replace("hepmc", "rivet.log")
 
         cmd = "rivet --pwd -a MC_BOOSTEDHBB -H %s %s" % \
                 (fyoda, fhepmc)
+        if fmerged:
+            cmd = "MC_BOOSTEDHBB_UNNORMALISED=1 " + cmd
+            fmergeds.append(fyoda)
 
         running.append(pbssubmit("rivet.%s" % fhepmc,  cmd,
             outfile=flog, queue="medium6"))
@@ -27,20 +97,50 @@ def runrivet_pbs(fhepmcnames):
         sleep(1)
         continue
 
+    if fmerged:
+        flist = fmerged.replace("yoda", "list")
+        with open(flist, "w") as f:
+            f.write("\n".join(fmergeds) + "\n")
+        print "%d outputs listed in %s. once they are done, merge them with" % \
+                (len(fmergeds), flist)
+        print "%s %s @%s" % (join(bindir, "treemerge"), fmerged, flist)
+        print
+        stdout.flush()
+
     for p in running:
         p.wait()
         print p.stdout.read()
         print p.stderr.read()
-    
+
     return
 
 
 def main(args):
-    if len(argv) < 2:
+    # -n N: split every file into jobs of N events
+    eventsperjob = 0
+    if len(args) > 2 and args[1] == "-n":
+        eventsperjob = int(args[2])
+        args = args[:1] + args[3:]
+
+    # -s out.yoda: the files are the slices of one process, stitched into
+    # out.yoda by one job
+    fstitched = None
+    if len(args) > 2 and args[1] == "-s":
+        fstitched = args[2]
+        args = args[:1] + args[3:]
+
+    # -m out.yoda: the files are parts of one sample, run unnormalised to
+    # be merged into out.yoda by treemerge
+    fmerged = None
+    if len(args) > 2 and args[1] == "-m":
+        fmerged = args[2]
+        args = args[:1] + args[3:]
+
+    if len(args) < 2:
         print "no hepmc output specified"
         exit()
 
-    runrivet_pbs(args[1:])
+    runrivet_pbs(args[1:], eventsperjob, fstitched, fmerged)
 
     return 0
 
@@ -0,0 +1,43 @@
+// -*- C++ -*-
+//
+// Refill the MC_BOOSTEDHBB histograms from a skim written with
+// MC_BOOSTEDHBB_SKIMOUT, without the original HepMC files:
+//
+//     skimreplay skim.bin out.yoda
+//
+// The analysis plugin has to be on RIVET_ANALYSIS_PATH.
+
+#include "Rivet/AnalysisHandler.hh"
+#include "HepMC/GenEvent.h"
+
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " skim.bin out.yoda" << std::endl;
+        return 1;
+    }
+
+    setenv("MC_BOOSTEDHBB_SKIMIN", argv[1], 1);
+
+    Rivet::AnalysisHandler ah;
+    ah.addAnalysis("MC_BOOSTEDHBB");
+
+    // the handler needs an event with beams to initialise the analysis.
+    // in replay mode the analysis ignores it.
+    HepMC::GenEvent ge;
+    HepMC::GenParticle* beam1 = new HepMC::GenParticle(HepMC::FourVector(0, 0, 6500, 6500), 2212, 4);
+    HepMC::GenParticle* beam2 = new HepMC::GenParticle(HepMC::FourVector(0, 0, -6500, 6500), 2212, 4);
+    HepMC::GenVertex* vtx = new HepMC::GenVertex();
+    vtx->add_particle_in(beam1);
+    vtx->add_particle_in(beam2);
+    ge.add_vertex(vtx);
+    ge.set_beam_particles(beam1, beam2);
+
+    ah.init(ge);
+    ah.finalize();
+    ah.writeData(argv[2]);
+
+    return 0;
+}
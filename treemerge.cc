@@ -0,0 +1,199 @@
+// -*- C++ -*-
+//
+// Add up many unnormalised outputs of MC_BOOSTEDHBB runs over files of
+// one sample (MC_BOOSTEDHBB_UNNORMALISED, or the shards of hepmcrange),
+// on all local cores, and normalise the sum once:
+//
+//     treemerge [-j N] out.yoda in.yoda ... [@list ...]
+//
+// @list names a file listing inputs, one per line, for campaigns with
+// more of them than a command line takes. The inputs are split into N
+// (the number of cores) consecutive runs, and every run is added up by a
+// process of its own, reading one file at a time, into an unnormalised
+// partial sum next to out.yoda. The partial sums of neighbours are then
+// added in pairs, again one process per pair, until two are left, which
+// are added and normalised into out.yoda. Processes rather than threads,
+// as YODA's reader keeps static parser state: this way every file is
+// parsed in parallel with the others. The result does not depend on the
+// timing, only on the order of the inputs and N.
+//
+// The sum is normalised as in mergeshards (see MergedOutputs), but with
+// the cross sections of the runs averaged, weighted by their sums of
+// weights.
+
+#include "YODA/ReaderYODA.h"
+#include "YODA/WriterYODA.h"
+
+#include "MergedOutputs.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+
+// the inputs named by arg, one file or the lines of an @list
+static void addInputs(const string& arg, vector<string>& inputs) {
+    if (arg.empty() || arg[0] != '@') {
+        inputs.push_back(arg);
+        return;
+    }
+
+    std::ifstream list(arg.substr(1).c_str());
+    if (!list)
+        throw std::runtime_error("cannot read " + arg.substr(1));
+
+    string line;
+    while (std::getline(list, line)) {
+        const size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == string::npos) continue;
+        const size_t end = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(begin, end + 1 - begin));
+    }
+
+    return;
+}
+
+
+// add up files into merged
+static void mergeFiles(MergedOutputs& merged, const vector<string>& files) {
+    for (size_t i = 0; i < files.size(); ++i) {
+        vector<YODA::AnalysisObject*> aos;
+        YODA::ReaderYODA::create().read(files[i], aos);
+        merged.add(aos, files[i]);
+    }
+
+    return;
+}
+
+
+// add up every group of files into the unnormalised output of the same
+// index, each in a process of its own, and wait for all of them
+static void forkMerges(const vector<vector<string> >& groups, const vector<string>& outnames) {
+    vector<pid_t> pids;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        const pid_t pid = fork();
+        if (pid < 0) break;
+        if (pid > 0) {
+            pids.push_back(pid);
+            continue;
+        }
+
+        int status = 0;
+        try {
+            MergedOutputs merged(MergedOutputs::MEANXSEC);
+            mergeFiles(merged, groups[i]);
+            YODA::WriterYODA::write(outnames[i], merged.unnormalised());
+        } catch (const std::exception& e) {
+            std::cerr << "treemerge: " << e.what() << std::endl;
+            status = 1;
+        }
+        _exit(status);
+    }
+
+    bool ok = pids.size() == groups.size();
+    for (size_t i = 0; i < pids.size(); ++i) {
+        int status = 0;
+        if (waitpid(pids[i], &status, 0) != pids[i] || !WIFEXITED(status) || WEXITSTATUS(status))
+            ok = false;
+    }
+
+    if (!ok)
+        throw std::runtime_error(pids.size() == groups.size() ? "a partial sum failed" : "cannot fork");
+
+    return;
+}
+
+
+int main(int argc, char** argv) {
+    size_t nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    int iArg = 1;
+    if (argc > 2 && string(argv[1]) == "-j") {
+        nworkers = std::strtoul(argv[2], 0, 10);
+        iArg = 3;
+    }
+
+    if (argc - iArg < 2) {
+        std::cerr << "usage: " << argv[0] << " [-j N] out.yoda in.yoda ... [@list ...]" << std::endl;
+        return 1;
+    }
+    const string outname = argv[iArg];
+
+    // the partial sums, by run
+    vector<string> partials;
+
+    try {
+        vector<string> inputs;
+        for (int i = iArg + 1; i < argc; ++i)
+            addInputs(argv[i], inputs);
+        if (inputs.empty())
+            throw std::runtime_error("no inputs");
+
+        nworkers = std::max<size_t>(1, std::min(nworkers, inputs.size()));
+
+        // every process adds up a run of consecutive inputs
+        vector<vector<string> > groups(nworkers);
+        for (size_t iw = 0; iw < nworkers; ++iw) {
+            std::ostringstream name;
+            name << outname << ".part" << iw;
+            partials.push_back(name.str());
+
+            const size_t first = iw*inputs.size()/nworkers;
+            const size_t last = (iw + 1)*inputs.size()/nworkers;
+            groups[iw].assign(inputs.begin() + first, inputs.begin() + last);
+        }
+
+        // with one run there is nothing to do in parallel
+        if (nworkers > 1) {
+            forkMerges(groups, partials);
+
+            // then the sums of neighbours, in pairs, into the left one,
+            // until two are left
+            size_t step = 1;
+            for (; 2*step < nworkers; step *= 2) {
+                groups.clear();
+                vector<string> outnames;
+                for (size_t iw = 0; iw + step < nworkers; iw += 2*step) {
+                    groups.push_back(vector<string>());
+                    groups.back().push_back(partials[iw]);
+                    groups.back().push_back(partials[iw + step]);
+                    outnames.push_back(partials[iw]);
+                }
+                forkMerges(groups, outnames);
+            }
+
+            groups.assign(1, vector<string>());
+            groups[0].push_back(partials[0]);
+            groups[0].push_back(partials[step]);
+        }
+
+        MergedOutputs merged(MergedOutputs::MEANXSEC);
+        mergeFiles(merged, groups[0]);
+        YODA::WriterYODA::write(outname, merged.normalised());
+
+        std::cerr << inputs.size() << " outputs merged into " << outname << " in "
+            << nworkers << " processes, sum of weights " << merged.sumOfWeights()
+            << ", cross section " << merged.crossSection() << " pb" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        for (size_t i = 0; i < partials.size(); ++i)
+            std::remove(partials[i].c_str());
+        return 1;
+    }
+
+    for (size_t i = 0; i < partials.size(); ++i)
+        std::remove(partials[i].c_str());
+
+    return 0;
+}